@@ -10,9 +10,19 @@
 // i2c read  0x77 4 > read_result
 // i2c write 0x12 8 0x2020c1d3 0x11e0a248
 // i2c file  test_file.i2c
+// i2c bench 500
+// i2c bench kernel 0x74 0x01 1 200
+// i2c kernel detect
+// i2c bus 1 serve
+// i2c broker read 0x69 0x75 1
+// i2c trace run.trace file test_file.i2c
+// i2c dump  run.trace csv
+// i2c record run.i2c file test_file.i2c
+// i2c replay run.i2c file test_file.i2c
 ///////////////////////////////////////////////////////////////////////////////
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "i2c_cli/i2c_cli_private.h"
 #include "../tools/src/macros.h"
@@ -32,27 +42,112 @@ int main(int argc, char** argv)                                        // main
 {
   // Clear a line
   printf("\n");
-  // Set default i2c bus
+  // Set default i2c bus, and no trace
   int bus_select = 1, offset = 0;
-  // Scan args for a bus flag
+  char *trace_file = NULL, *record_file = NULL;
+  // Scan args for bus and trace flags
   for (int i = 1; (i + offset) < argc; i++)
   {
     argv[i] = argv[i+offset];
     // If bus flag found
-    if (!strcmp("bus", argv[i]))
+    if (!strcmp("bus", argv[i]) && (i + offset + 1 < argc))
     {
       // Take next argument as the chosen bus
-      bus_select = atoi(argv[i+1]);
+      bus_select = atoi(argv[i+offset+1]);
       // Adjust offset
-      offset = 2;
+      offset += 2;
+      // Decrement i
+      i--;
+    }
+    // If kernel flag found, other than as the bench mode
+    else if (!strcmp("kernel", argv[i]) &&
+             ((i != 2) || strcmp("bench", argv[1])))
+    {
+      // Drive the bus through /dev/i2c-N
+      i2c_set_backend(I2C_BACKEND_KERNEL);
+      // Adjust offset
+      offset += 1;
+      // Decrement i
+      i--;
+    }
+    // If broker flag found
+    else if (!strcmp("broker", argv[i]))
+    {
+      // Make requests of the process serving the bus
+      i2c_set_backend(I2C_BACKEND_BROKER);
+      // Adjust offset
+      offset += 1;
+      // Decrement i
+      i--;
+    }
+    // If record flag found
+    else if (!strcmp("record", argv[i]) && (i + offset + 1 < argc))
+    {
+      // Take next argument as the file to record to
+      record_file = argv[i+offset+1];
+      // Adjust offset
+      offset += 2;
+      // Decrement i
+      i--;
+    }
+    // If replay flag found
+    else if (!strcmp("replay", argv[i]) && (i + offset + 1 < argc))
+    {
+      // Play back the recording as fast as it will go
+      i2c_set_replay(argv[i+offset+1], 0);
+      // Adjust offset
+      offset += 2;
+      // Decrement i
+      i--;
+    }
+    // If trace flag found
+    else if (!strcmp("trace", argv[i]) && (i + offset + 1 < argc))
+    {
+      // Take next argument as the file to save the trace to
+      trace_file = argv[i+offset+1];
+      // Adjust offset
+      offset += 2;
       // Decrement i
       i--;
     }
   }
   // Reduce argc by offset
   argc -= offset;
+  // Benchmarking the backends runs against the real bus
+  if ((argc > 5) && !(strcmp(argv[1], "bench")) &&
+      !(strcmp(argv[2], "kernel")))
+  {
+    // Default to 100 sets of reads per backend
+    i2c_bench_backend(bus_select, strtol(argv[3], NULL, 0),
+                      strtol(argv[4], NULL, 0), atoi(argv[5]),
+                      argc > 6 ? atoi(argv[6]) : 100);
+    return 0;
+  }
+  // Benchmarking the waits runs against a simulated bus, so needs
+  // no access
+  if ((argc > 1) && !(strcmp(argv[1], "bench")))
+  {
+    // Default to 100 transfers per measurement
+    i2c_bench_wait(argc > 2 ? atoi(argv[2]) : 100);
+    return 0;
+  }
+  // Serve the bus to other processes, never returning
+  if ((argc > 1) && !(strcmp(argv[1], "serve")))
+  {
+    return i2c_broker_serve(bus_select);
+  }
+  // Printing a saved trace needs no access either
+  if ((argc > 2) && !(strcmp(argv[1], "dump")))
+  {
+    return i2c_trace_print(argv[2], (argc > 3) && !strcmp(argv[3], "csv"));
+  }
   // Initialise i2c access
   i2c_bus *i2c = i2c_init(bus_select);
+  // Record everything from here, if asked to
+  if (record_file && i2c_record_start(i2c, record_file))
+  {
+    return EXIT_FAILURE;
+  }
   // Generate list of devices
   i2c_dev *dev = i2c_dev_detect(i2c);
   // If no arguments or detect argument
@@ -94,6 +189,15 @@ int main(int argc, char** argv)                                        // main
     // Print the usage guidelines - extended version
     print_usage(1);
   }
+  // Save the transfers made, if asked to
+  if (trace_file)
+  {
+    i2c_trace_save(trace_file);
+  }
+  if (record_file)
+  {
+    i2c_record_stop(i2c);
+  }
   // Deallocate the bus
   i2c_dev_dealloc(&dev);
   return 0;
@@ -14,7 +14,6 @@
 int main(int argc, char** argv)
 {
   // TODO - Sanitise the arguments first
-  // Route with the given args
-  imu_route(argv, argc);
-  return 0;
+  // Route with the given args, failing should the route fail
+  return imu_route(argv, argc) ? 1 : 0;
 }
@@ -26,9 +26,23 @@ typedef enum {MPU3300, ITG3050, L3G4200D, PCA9548A, NA} model_t;
 // Required for definitions
 typedef struct Sensor Sensor;
 typedef struct Axes Axes;
+typedef struct SampleBatch SampleBatch;
+typedef struct SamplePool SamplePool;
 typedef struct ConfigFunctionMap ConfigFunctionMap;
 typedef struct Mux Mux;
 typedef struct MuxNetwork MuxNetwork;
+typedef struct DevLoad DevLoad;
+typedef struct DevFifo DevFifo;
+typedef struct DevFifoStats DevFifoStats;
+typedef struct DevPlan DevPlan;
+typedef struct DevAcqBus DevAcqBus;
+typedef struct DevAcquire DevAcquire;
+typedef struct DevStream DevStream;
+typedef struct DevStreamStats DevStreamStats;
+typedef struct DevFrame DevFrame;
+typedef struct DevSchedSensor DevSchedSensor;
+typedef struct DevSchedBus DevSchedBus;
+typedef struct DevSched DevSched;
 
 ///////////////////////////////////////////////////////////////////////////////
 // DEVS INTERFACE
@@ -21,6 +21,11 @@ void itg_dealloc(Sensor **s)
     // The return without doing anything
     return;
   }
+  // Stop any stream, its thread would outlive the struct
+  if ((*s)->stream)
+  {
+    dev_stream_stop(*s);
+  }
   // Free the sensor struct
   free(*s);
   // Null the pointer
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "itg_private.h"
+#include "itg_registers.h"
 #include "macros.h"
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -27,9 +28,18 @@ char itg_default_config[] = \
 , fifo_en:yes\
 , i2c_bypass:yes";
 
+// Bits of each register that clear themselves once written, and
+// so must never be held in the register shadow
+static const uint8_t itg_self_clearing[256] = {
+  [ITG_USER_CTRL]  = 0x0b,
+  [ITG_POWER_MGMT] = 0x80
+};
+
 // Set the default values of itg3050
 void itg_reset(Sensor *s)
 {
+  // Read the registers afresh before applying the defaults
+  dev_shadow_invalidate(s);
   // If default is not null
   if (itg_default_config != NULL)
   {
@@ -90,10 +100,23 @@ Sensor *itg_init(    i2c_bus*    i2c,
   s->i2c = i2c;
   // Assign the i2c addr
   s->i2c_addr = i2c_addr;
+  // Talk to the itg in fast mode
+  i2c_set_dev_clock(i2c, i2c_addr, ITG_I2C_HZ);
   // Assign the mux handle, null or otherwise
   s->mux = mux;
   // Assign the mux channel setting
   s->mux_channel = mux_channel;
+  // No transfer has failed yet
+  s->io_error = 0;
+  // Start with an empty register shadow
+  s->self_clearing = itg_self_clearing;
+  dev_shadow_invalidate(s);
+  // Nothing yet read from the fifo
+  s->fifo_carried = 0;
+  s->fifo_drained_ns = 0;
+  s->fifo_stats = (DevFifoStats) { 0 };
+  // Not yet streaming
+  s->stream = NULL;
   ///////////////////////////////////////////////
   // Assign reset
   s->reset = &itg_reset;                                    // RESET
@@ -101,12 +124,16 @@ Sensor *itg_init(    i2c_bus*    i2c,
   s->i2c_bypass = &itg_i2c_bypass;                          // I2C_BYPASS
   // Assign the read function
   s->read = &itg_read;                                      // READ
+  // Assign the batch read function
+  s->read_batch = &itg_read_batch;                          // READ_BATCH
   // Assign config
   s->config = &itg_config;                                  // CONFIG
   // Assign the pipe function
   s->pipe = &dev_pipe;                                      // PIPE
   // Assign the fifo capacity function
   s->fifo_capacity = &itg_fifo_capacity;                    // FIFO_CAPACITY
+  // Assign the bus load function
+  s->load = &itg_load;                                       // LOAD
   // Assign dealloc
   s->dealloc = &itg_dealloc;                                // DEALLOC
   ///////////////////////////////////////////////
@@ -16,10 +16,13 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #define FETCH_REG(reg) \
-  i2c_read_reg(s->i2c, s->i2c_addr, reg)
+  dev_fetch_reg(s, reg)
 
 #define SET_REG(reg, val) \
-  i2c_write_reg(s->i2c, s->i2c_addr, reg, &val, 1)
+  dev_set_reg(s, reg, val)
+
+#define FETCH_BLOCK(reg, buf, len) \
+  i2c_read_into(s->i2c, s->i2c_addr, reg, buf, len)
 
 ///////////////////////////////////////////////////////////////////////////////
 // PRIVATE INTERFACE
@@ -30,6 +33,10 @@ void    itg_reset         (  Sensor      *s  );                       // RESET
 // Read from the given sensor with the given target
 Axes    *itg_read         (  Sensor*     s,                           // READ
                              target_t    t  );
+// Read from the given sensor and target into the batch
+int     itg_read_batch    (  Sensor*     s,                          // READ_BATCH
+                             target_t    t,
+                             SampleBatch *b  );
 // Configure the given itg struct pointer using the keyval array
 int     itg_config        (  Sensor*     s,                           // CONFIG
                              char*       conf_str  );
@@ -50,6 +57,7 @@ uint8_t itg_config_int_pin(Sensor *s, KeyVal *pairs);
 uint8_t itg_config_sync(Sensor *s, KeyVal *pairs);
 uint8_t itg_config_user_ctrl(Sensor *s, KeyVal *pairs);
 float   itg_fifo_capacity(Sensor *s);
+int     itg_load(Sensor *s, DevLoad *load);
 void    yn_toggle(uint8_t *reg, int bit, char *yn);
 
 #endif
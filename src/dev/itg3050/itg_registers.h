@@ -52,6 +52,10 @@
 #define ITG_FIFO_COUNTL 0x3b
 // Entry point for FIFO
 #define ITG_FIFO_R 0x3c
+// Size of the fifo buffer in bytes
+#define ITG_FIFO_SIZE 512
+// Fastest i2c clock supported (fast mode)
+#define ITG_I2C_HZ 400000
 // Address of fifo controls
 #define ITG_FIFO_EN 0x12
 
@@ -74,3 +74,34 @@ uint8_t mpu_config_samplerate(Sensor *s, KeyVal *pairs)
   // Else return 0
   return 0;
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// BUS LOAD
+///////////////////////////////////////////////////////////////////////////////
+
+// Fills the load the fifo puts on the bus, from the sample rate,
+// the readings selected for the fifo and whether it is enabled
+int mpu_load(Sensor *s, DevLoad *load)
+{
+  // Report only failed reads of these registers, not an earlier
+  // transfer error, which is left standing for dev_config
+  int prior = s->io_error;
+  s->io_error = 0;
+  uint8_t dlpf = FETCH_REG(MPU_CONFIG) & 0x7u,
+          smplrt_div = FETCH_REG(MPU_SMPLRT_DIV),
+          fifo_en = FETCH_REG(MPU_FIFO_EN),
+          user_ctrl = FETCH_REG(MPU_USER_CTRL);
+  int err = s->io_error;
+  s->io_error = prior ? prior : err;
+  // Output rate is 8khz without the low pass filter, else 1khz
+  load->sample_hz = ((dlpf == 0) || (dlpf == 7) ? 8000.0 : 1000.0) /
+                    (1 + smplrt_div);
+  // Each reading selected adds two bytes to a frame
+  load->frame_bytes = 0;
+  for (int bit = 0; (user_ctrl & 0x40) && (bit < 8); bit++)
+  {
+    load->frame_bytes += 2 * ((fifo_en >> bit) & 1);
+  }
+  load->fifo_bytes = MPU_FIFO_SIZE;
+  return err;
+}
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "mpu_private.h"
+#include "mpu_registers.h"
 #include "macros.h"
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -52,9 +53,19 @@ char mpu_default_config[] = \
 , fs_range:225\
 , i2c_bypass:off";
 
+// Bits of each register that clear themselves once written, and
+// so must never be held in the register shadow
+static const uint8_t mpu_self_clearing[256] = {
+  [MPU_SIGNAL_PATH_RESET] = 0x07,
+  [MPU_USER_CTRL]         = 0x07,
+  [MPU_POWER_MGMT_1]      = 0x80
+};
+
 // Set the default values of mpu3300
 void mpu_reset(Sensor *s)
 {
+  // Read the registers afresh before applying the defaults
+  dev_shadow_invalidate(s);
   // If default is not null
   if (mpu_default_config != NULL)
   {
@@ -113,12 +124,23 @@ Sensor *mpu_init(    i2c_bus*    i2c,
   s->i2c = i2c;
   // Assign the i2c addr
   s->i2c_addr = i2c_addr;
+  // Talk to the mpu in fast mode
+  i2c_set_dev_clock(i2c, i2c_addr, MPU_I2C_HZ);
   // Assign the mux handle, null or otherwise
   s->mux = mux;
   // Assign the mux channel setting
   s->mux_channel = mux_channel;
-  // Assign pipe_running as false
-  s->pipe_running = 0;
+  // No transfer has failed yet
+  s->io_error = 0;
+  // Start with an empty register shadow
+  s->self_clearing = mpu_self_clearing;
+  dev_shadow_invalidate(s);
+  // Nothing yet read from the fifo
+  s->fifo_carried = 0;
+  s->fifo_drained_ns = 0;
+  s->fifo_stats = (DevFifoStats) { 0 };
+  // Not yet streaming
+  s->stream = NULL;
   ///////////////////////////////////////////////
   // Assign reset
   s->reset = &mpu_reset;                                    // RESET
@@ -126,6 +148,8 @@ Sensor *mpu_init(    i2c_bus*    i2c,
   s->i2c_bypass = &mpu_i2c_bypass;                          // I2C_BYPASS
   // Assign the read function
   s->read = &mpu_read;                                      // READ
+  // Assign the batch read function
+  s->read_batch = &mpu_read_batch;                          // READ_BATCH
   // Assign config
   s->config = &mpu_config;                                  // CONFIG
   // Assign selftest
@@ -134,6 +158,8 @@ Sensor *mpu_init(    i2c_bus*    i2c,
   s->pipe = &dev_pipe;                                      // PIPE
   // Assign the fifo capacity function
   s->fifo_capacity = &mpu_fifo_capacity;                    // FIFO_CAPACITY
+  // Assign the bus load function
+  s->load = &mpu_load;                                       // LOAD
   // Assign dealloc
   s->dealloc = &mpu_dealloc;                                // DEALLOC
   ///////////////////////////////////////////////
@@ -22,29 +22,30 @@
 
    Currently possible targets are `HOST` or `AUX`, standing
    for the native gyro axes and aux sensor respectively.
+
+   `mpu_read_batch` conforms to `ReadBatch`, filling a batch the
+   caller supplies instead, and is the only way to drain the `FIFO`.
 */
 
 // Retrieves only the mpu's gyro axes data, then returns
 // the data as an Axes struct pointer.
 static Axes *read_gyro(Sensor *s)
 {
-  // malloc new axes struct
-  Axes *res = malloc(sizeof(Axes));
   // Read the results in a burst, starting from xout reg
-  uint8_t *readings = i2c_read_block( s->i2c,
-                                      s->i2c_addr,
-                                      MPU_XOUT_H,
-                                      6 );
+  uint8_t readings[6];
+  if (FETCH_BLOCK(MPU_XOUT_H, readings, 6))
+  {
+    ERR("Failed to read gyro axes from 0x%02x.\n\n", s->i2c_addr);
+    return NULL;
+  }
+  // malloc new axes struct, no next axes (not reading aux here)
+  Axes *res = axes_malloc(NULL);
   // Extract x y z values
   res->x = (readings[0] << 8) | readings[1];
   res->y = (readings[2] << 8) | readings[3];
   res->z = (readings[4] << 8) | readings[5];
-  // Free the array
-  free(readings);
   // Set type of results
   res->type = GYRO;
-  // No next axes (not reading aux here)
-  res->next = NULL;
   // Return the resulting readings
   return res;
 }
@@ -56,6 +57,23 @@ static Axes *read_aux(Sensor *s)
   return NULL;
 }
 
+// Retrieves only the mpu's gyro axes data into the batch
+static int read_gyro_batch(Sensor *s, SampleBatch *b)
+{
+  uint8_t readings[6];
+  if (b->count == b->capacity)
+  {
+    return 0;
+  }
+  if (FETCH_BLOCK(MPU_XOUT_H, readings, 6))
+  {
+    ERR("Failed to read gyro axes from 0x%02x.\n\n", s->i2c_addr);
+    return DEV_NOT_RESPOND;
+  }
+  batch_decode(b, readings, 1);
+  return 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // READ SENSOR DATA IN BURST
 ///////////////////////////////////////////////////////////////////////////////
@@ -63,46 +81,24 @@ static Axes *read_aux(Sensor *s)
    Once the fifo is configured, it is possible to read data from the device
    using the built in 1024 byte buffer. As such, this read_burst method will
    read the data from the fifo, assuming that the fifo is set to xg yg zg,
-   and then parse it into an Axes linked list.
+   and then parse it into the arrays of a SampleBatch. Overflows and
+   partial frames are handled by dev_fifo_drain, see dev_fifo.c.
 */
 
-static Axes *read_burst(Sensor *s)
+// Where the fifo registers of the mpu sit
+static const DevFifo mpu_fifo = {
+  .int_status = MPU_INT_STATUS, .int_oflow = 0x10,
+  .count_h = MPU_FIFO_COUNTH, .count_h_mask = 0x07,
+  .fifo_r = MPU_FIFO_R_W,
+  .user_ctrl = MPU_USER_CTRL, .fifo_reset = 0x04,
+  .size = MPU_FIFO_SIZE
+};
+
+static int read_burst(Sensor *s, SampleBatch *b)
 {
-  // Get the current data count
-  int fifo_count = (FETCH_REG(MPU_FIFO_COUNTH) << 8) +
-                    FETCH_REG(MPU_FIFO_COUNTL);
-  // Return null if currently empty
-  if (!fifo_count)
-  {
-    // Return null
-    return NULL;
-  }
-  // Adjust count to a multiple of three
-  fifo_count = (fifo_count / 6) * 6;
-  // Otherwise generate an array of uint8_ts
-  uint8_t *block = i2c_read_block( s->i2c, 
-                                   s->i2c_addr, 
-                                   MPU_FIFO_R_W,
-                                   fifo_count ),
-          *data = (block + fifo_count);
-  // Create pointers to Axes
-  Axes *head = NULL;
-  // Parse into axes data
-  for (int i = fifo_count / 6; i > 0; i--)
-  {
-    // malloc next link with the previous head as its next
-    head = axes_malloc(head);
-    // Decrement data
-    data -= 6;
-    // Extract x y z values
-    head->x = (data[0] << 8) | data[1];
-    head->y = (data[2] << 8) | data[3];
-    head->z = (data[4] << 8) | data[5];
-  }
-  // Free the byte array
-  free(block);
-  // Return the Axes
-  return head;
+  // Whole frames only, realigned after any overflow, and no more
+  // than the batch has room for, the rest left for the next read
+  return dev_fifo_drain(s, &mpu_fifo, b);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -113,11 +109,14 @@ static Axes *read_burst(Sensor *s)
 // the mpu's fifo that is filled
 float mpu_fifo_capacity(Sensor *s)
 {
-  // Get the current data count
-  int fifo_count = (FETCH_REG(MPU_FIFO_COUNTH) << 8) +
-                    FETCH_REG(MPU_FIFO_COUNTL);
+  // Get the current data count, high and low in one read
+  uint8_t count[2];
+  if (FETCH_BLOCK(MPU_FIFO_COUNTH, count, 2))
+  {
+    return 0;
+  }
   // Return used / fifo capacity
-  return ((float)fifo_count / 1024);
+  return ((float)(((0x07 & count[0]) << 8) | count[1]) / MPU_FIFO_SIZE);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -135,11 +134,11 @@ Axes *mpu_read(Sensor *s, target_t t)
     ERR("Sensor pointer is not valid.\n\n");
     exit(EXIT_FAILURE);
   }
-  // If there is a multiplexer, configure for access
-  if (s->mux)
+  // If there is a multiplexer, configure for access, giving
+  // up on this read should the mux not respond
+  if (s->mux && s->mux->set_channel(s->mux, s->mux_channel))
   {
-    // Set the channel
-    s->mux->set_channel(s->mux, s->mux_channel);
+    return NULL;
   }
   switch (t)
   {
@@ -153,11 +152,52 @@ Axes *mpu_read(Sensor *s, target_t t)
       // Return the auxiliary sensor readings
       return read_aux(s);
       break;
-    // Else if wanting fifo burst readings
+    // Fifo readings are drained into batches
     case FIFO:
-      // Return fifo burst readings
-      return read_burst(s);
+      ERR("The fifo is read with read_batch.\n\n");
       break;
   }
   return NULL;
 }
+
+// Entry point for reads into a batch, emptying it first. Takes the
+// Sensor pointer, a target as above, and the batch to fill. Returns
+// 0, leaving the samples read in the batch, else an error code.
+int mpu_read_batch(Sensor *s, target_t t, SampleBatch *b)     // mpu_read_batch
+{
+  // Check for valid sensor pointer
+  if (s == NULL)
+  { 
+    ERR("Sensor pointer is not valid.\n\n");
+    exit(EXIT_FAILURE);
+  }
+  b->count = 0;
+  b->type = GYRO;
+  // If there is a multiplexer, configure for access, giving
+  // up on this read should the mux not respond
+  if (s->mux && s->mux->set_channel(s->mux, s->mux_channel))
+  {
+    return DEV_NOT_RESPOND;
+  }
+  int err = 0;
+  switch (t)
+  {
+    // If targetting the mpu
+    case HOST:
+      err = read_gyro_batch(s, b);
+      break;
+    // The auxiliary is not yet read
+    case AUX:
+      break;
+    // Else if wanting fifo burst readings
+    case FIFO:
+      err = read_burst(s, b);
+      break;
+  }
+  // Stamp what was read with when it was taken
+  if (!err)
+  {
+    batch_stamp(s, b);
+  }
+  return err;
+}
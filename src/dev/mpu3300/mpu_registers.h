@@ -75,6 +75,10 @@
 #define MPU_FIFO_COUNTL 0x73
 // Entry point for FIFO
 #define MPU_FIFO_R_W 0x74
+// Size of the fifo buffer in bytes
+#define MPU_FIFO_SIZE 1024
+// Fastest i2c clock supported (fast mode)
+#define MPU_I2C_HZ 400000
 
 // Identity register
 #define MPU_WHO_AM_I 0x75
@@ -34,6 +34,9 @@ char selftest_conf[] = \
 // in binary, where 1's will represent sensor error beyond normal range.
 int mpu_selftest(Sensor *mpu, int print_output)
 {
+  // A batch to hold a full fifo of readings, and the averages
+  SampleBatch *batch = batch_malloc(DEV_BATCH_SAMPLES);
+  Axes selftest_average, standard_average;
   // Reset gyro defaults
   mpu->reset(mpu);
   // Activate selftest
@@ -41,28 +44,34 @@ int mpu_selftest(Sensor *mpu, int print_output)
   // Wait for the selftest to kick in
   nanosleep((struct timespec[]) {{0, 500000}}, NULL);
 
-  // Take readings
-  Axes *selftest_axes = mpu->read(mpu, FIFO);
-  // Calculate average for the selftest results
-  Axes *selftest_average = axes_average(selftest_axes);
-  // Dealloc the selftest_axes
-  axes_dealloc(&selftest_axes);
+  // Take readings, then calculate average for the selftest results
+  if (mpu->read_batch(mpu, FIFO, batch) ||
+      batch_average(batch, &selftest_average))
+  {
+    ERR("Failed to take selftest readings from 0x%02x.\n\n", mpu->i2c_addr);
+    batch_dealloc(&batch);
+    return 7;
+  }
 
   // Deactive selftest
   mpu->config(mpu, "selftest:off");
   // Wait for the selftest to shut off
   nanosleep((struct timespec[]) {{0, 500000}}, NULL);
 
-  // Take readings
-  Axes *standard_axes = mpu->read(mpu, FIFO);
-  // Calculate average for each axis
-  Axes *standard_average = axes_average(standard_axes);
-  // Dealloc the standard_axes
-  axes_dealloc(&standard_axes);
+  // Take readings, then calculate average for each axis
+  int err = mpu->read_batch(mpu, FIFO, batch) ||
+            batch_average(batch, &standard_average);
+  // Dealloc the batch
+  batch_dealloc(&batch);
+  if (err)
+  {
+    ERR("Failed to take standard readings from 0x%02x.\n\n", mpu->i2c_addr);
+    return 7;
+  }
   // Find selftest_response = (selftest - standard)
-  selftest_average->x -= standard_average->x;
-  selftest_average->y -= standard_average->y;
-  selftest_average->z -= standard_average->z;
+  selftest_average.x -= standard_average.x;
+  selftest_average.y -= standard_average.y;
+  selftest_average.z -= standard_average.z;
   // Calculate change from factory trim
   double ft_x = CALC_FT(i2c_read_reg( mpu->i2c,
                                       mpu->i2c_addr,
@@ -75,9 +84,9 @@ int mpu_selftest(Sensor *mpu, int print_output)
                                       MPU_SELF_TEST_Z ));
   // (selftest_response - ft) / ft
   double scores[3] = {
-    (selftest_average->x - ft_x) / ft_x,
-    (selftest_average->y - ft_y) / ft_y,
-    (selftest_average->z - ft_z) / ft_z,
+    (selftest_average.x - ft_x) / ft_x,
+    (selftest_average.y - ft_y) / ft_y,
+    (selftest_average.z - ft_z) / ft_z,
   };
   // If print is yes
   if (print_output)
@@ -102,9 +111,6 @@ int mpu_selftest(Sensor *mpu, int print_output)
   {
     ERR("Selftest has failed. -14 < tval < 14 is acceptable range.\n\n");
   }
-  // Free used memory
-  axes_dealloc(&standard_average);
-  axes_dealloc(&selftest_average);
   // Return health
   return health;
 }
@@ -27,6 +27,10 @@
 #define PCA_C1 0x01
 #define PCA_C2 0x02
 #define PCA_C3 0x03
+// Number of channels in use
+#define PCA_NO_OF_CHANNELS 4
+// Selects of the channel between reading it back, by default
+#define PCA_VERIFY_EVERY 64
 
 ///////////////////////////////////////////////////////////////////////////////
 // INTERFACE - FUNCTION STUBS
@@ -39,12 +43,21 @@ Mux         *pca_init            (  i2c_bus   *i2c,                   // INIT
 // Fetches the current channel code (raw reg val) and updates
 // the channel field inside the mux struct
 uint8_t     pca_get_channel      (  Mux *m  );                        // GET CHANNEL
-// Sets the mux channel value with a given short
-// Also runs a write test to verify success (updates channel field)
+// Sets the mux channel value with a given short, skipped if already
+// selected. Every verify_every selects, reads back the channel held
 int         pca_set_channel      (  Mux     *m,                       // SET CHANNEL
                                     short c  );
+// Makes two muxes on the same bus disable each other on selecting
+int         pca_cascade          (  Mux *a,                           // CASCADE
+                                    Mux *b  );
 // Generates a mux network from all the devices visible on the buses
 MuxNetwork  *pca_get_devs        (  Mux *m  );                        // GET DEVS
+// Scans for the candidate addresses (all if NULL) outside the mux,
+// into maps[0], and on each channel c, into maps[1 + c]
+int         pca_scan             (  Mux         *m,                   // SCAN
+                                    const short *candidates,
+                                    int         count,
+                                    i2c_map     maps[PCA_NO_OF_CHANNELS + 1]  );
 // Dealloc an pca mux struct, watch for any memory leaks
 void        pca_dealloc          (  Mux** m  );                       // DEALLOC
 
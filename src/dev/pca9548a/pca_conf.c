@@ -5,6 +5,7 @@
 // PA Consulting - Lawrence Jones
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <stdio.h>
 #include <stdlib.h>
 #include "pca_private.h"
 #include "macros.h"
@@ -16,6 +17,24 @@
    The mux is only ever used directly to access it's current
    channel register or to write to it.
    As such, there are only two functions below to achieve this.
+
+   Every sensor access selects the channel of its sensor first, yet
+   most find it already selected. The channel last written is kept
+   in the struct, and selecting it again costs nothing on the bus.
+   The cache is trusted until a transfer to the mux fails, the mux
+   being read back only every verify_every selects, should that be
+   asked for. Counting selects rather than writes means a mux that
+   has reset (and so disabled every channel) is found even on a bus
+   whose sensors share one channel, and so never write the mux.
+
+   A channel selected through the bus queue (I2C_TXN_MUX) goes
+   around the struct, so the cache is dropped whenever the bus has
+   run one for the mux since.
+
+   Two muxes sharing a bus have peers set by pca_cascade. Before a
+   channel of one is selected the other is disabled, unless it is
+   known to be disabled already, so two gyros of the same address
+   are never both on the bus.
  */
 
 // Helper to avoid duplicating validity checks
@@ -40,6 +59,18 @@ void verify_mux(Mux *m)
   }
 }
 
+// Drop the cached channel should the bus queue have selected one
+// of the mux since
+static void check_queued(Mux *m)
+{
+  unsigned long queued = i2c_mux_selects(m->i2c, m->i2c_addr);
+  if (queued != m->queued)
+  {
+    m->queued = queued;
+    m->cached = 0;
+  }
+}
+
 // Fetches the current channel code from the given mux,
 // then updates the field inside the given struct and
 // returns the code as the value
@@ -49,28 +80,45 @@ uint8_t pca_get_channel(Mux *m)
   verify_mux(m);
   // Once verified, read the channel code from the mux 
   // into the channel field
-  m->channel = i2c_read_byte(m->i2c, m->i2c_addr);
+  if (i2c_read_byte_into(m->i2c, m->i2c_addr, &m->channel))
+  {
+    // Leave the field as it was should the mux not respond, but no
+    // longer trust it
+    ERR("Failed to read channel of mux at addr 0x%02x.\n\n", m->i2c_addr);
+    m->cached = 0;
+  }
+  else
+  {
+    m->cached = 1;
+  }
   // Return the value read
   return m->channel;
 }
 
-// Sets the pca control channel and verifies write
-// success
+// Sets the pca control channel, skipping the write should
+// the channel be known to be selected already. Returns 0
+// on success, else an error code from i2c_err.h
 int pca_set_channel(Mux *m, short c)
 {
   uint8_t byte = 0;
-  // Verify the mux is accessible
-  if (!i2c_bus_addr_active(m->i2c, m->i2c_addr))
-  {
-    // Print error
-    ERR("PCA Mux is not accessible at address 0x%02x\n\n", m->i2c_addr);
-    // Return error
-    return I2C_DEV_DEAD;
-  }
+  int code;
   // Verify arg health
   verify_mux(m);
-  // Once verified, transfer the channel code to
-  // the device
+  m->selects++;
+  check_queued(m);
+  if (m->peer)
+  {
+    check_queued(m->peer);
+  }
+  // Disable the channels of any mux sharing the bus, unless
+  // they are known to be disabled already
+  if ((c != -1) && m->peer && !(m->peer->cached && !m->peer->channel) &&
+      (code = m->peer->set_channel(m->peer, PCA_CD)))
+  {
+    return code;
+  }
+  // Once verified, transfer the channel code to the
+  // device, which checks the mux is present and retries
   if (c == -1)
   {
     byte = 0;
@@ -79,16 +127,50 @@ int pca_set_channel(Mux *m, short c)
   {
     byte = 1 << c;
   }
-  i2c_write_byte(m->i2c, m->i2c_addr, byte);
-  // Once written, verify that write has been successful
-  m->get_channel(m);
-  // After fetching the channel, write has been successful
-  // iff the new channel field is equal to the desired parameter
-  if (byte != m->channel)
+  // Every so often, read back the channel the mux holds, writing
+  // it again below should it differ from the cache
+  if (m->verify_every && m->cached && !(m->selects % m->verify_every))
+  {
+    uint8_t cached = m->channel;
+    m->verifies++;
+    if ((m->get_channel(m) != cached) && m->cached)
+    {
+      printf("Warning: Mux with addr 0x%02x lost its channel, "
+             "selecting it again.\n\n", m->i2c_addr);
+    }
+  }
+  // Nothing to do should the channel be selected already
+  if (m->cached && (m->channel == byte))
+  {
+    m->skipped++;
+    return 0;
+  }
+  m->writes++;
+  if ((code = i2c_try_write_block(m->i2c, m->i2c_addr, 1, &byte)))
+  {
+    // The mux may have taken the byte or not, so is unknown
+    m->cached = 0;
+    ERR("Write to mux with addr 0x%02x has failed.\n\n", m->i2c_addr);
+    return code;
+  }
+  m->channel = byte;
+  m->cached = 1;
+  return 0;
+}
+
+// Make the two muxes peers on the one bus, each disabling the
+// other before selecting a channel. Returns 0, else
+// DEV_INVALID_HANDLE should the muxes be on different buses.
+int pca_cascade(Mux *a, Mux *b)
+{
+  verify_mux(a);
+  verify_mux(b);
+  if ((a->i2c != b->i2c) || (a == b))
   {
-    // If not equal then write has failed
-    ERR("Write to mux with addr 0x%02x has failed.\n\n", 
-        m->i2c_addr);
+    ERR("Only two muxes on the same bus may be cascaded.\n\n");
+    return DEV_INVALID_HANDLE;
   }
+  a->peer = b;
+  b->peer = a;
   return 0;
 }
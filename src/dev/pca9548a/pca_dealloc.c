@@ -29,6 +29,11 @@ void pca_dealloc(Mux **m)
     // Exit with error
     exit(EXIT_FAILURE);
   }
+  // Leave no peer pointing at the freed mux
+  if ((*m)->peer)
+  {
+    (*m)->peer->peer = NULL;
+  }
   // Free the struct
   free(*m);
 }
@@ -71,6 +71,12 @@ Mux *pca_init(i2c_bus *i2c,
   m->set_channel = &pca_set_channel;
   // Assign the mux networking function
   //m->get_devs = &pca_get_devs;
+  // Nothing is known of the channel until first written
+  m->cached = 0;
+  m->queued = i2c_mux_selects(i2c, i2c_addr);
+  m->verify_every = PCA_VERIFY_EVERY;
+  m->peer = NULL;
+  m->selects = m->skipped = m->writes = m->verifies = 0;
   // Set the channel to 0 initially
   m->set_channel(m, 0);
   // Assign dealloc function
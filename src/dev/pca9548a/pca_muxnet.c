@@ -48,100 +48,74 @@ void mux_network_print(Mux *m)
   };
 }
 
-int i2c_devs_contains(i2c_dev *list, i2c_dev *node)
+// Scans for the count candidate addresses (or every address if
+// NULL) first with all channels disabled, then on each channel in
+// turn. maps[0] receives the devices outside the mux, and
+// maps[1 + c] those seen only on channel c. Leaves all channels
+// disabled. Returns 0 on success, else the error from the mux.
+int pca_scan(Mux         *m,
+             const short *candidates,
+             int         count,
+             i2c_map     maps[PCA_NO_OF_CHANNELS + 1])
 {
-  // If the node is null
-  if (!node)
+  int code;
+  // Initially disable all channels, and gather the devices on the
+  // network that are not on the mux
+  if ((code = pca_set_channel(m, PCA_CD)))
   {
-    // Then return false
-    return 0;
+    return code;
   }
-  // Create a previous start node
-  list = &((i2c_dev){-1, list});
-  // While there is a valid next node
-  while ((list = list->next))
+  maps[0] = i2c_dev_scan(m->i2c, candidates, count);
+  // For each channel
+  for (int c = 0; c < PCA_NO_OF_CHANNELS; c++)
   {
-    // If the addresses are equal
-    if (node->addr == list->addr)
+    if ((code = pca_set_channel(m, c)))
     {
-      // Then return true
-      return 1;
+      return code;
     }
-  }
-  // If not found a match then return false
-  return 0;
-}
-
-void i2c_dev_filter(i2c_dev **as, i2c_dev *bs)
-{
-  // If as or bs are null
-  if (!as || !bs)
-  {
-    // Return as nothing need be done
-    return;
-  }
-  // Make an i2c_dev for the start of the chain
-  // and create a pointer for the next node
-  *as = &((i2c_dev){-1,*as});
-  i2c_dev *a1 = *as,
-          *a2 = *as;
-  // While a2 is not null
-  while ((a2 = a1->next))
-  {
-    // If the node a2 is included in bs
-    if (i2c_devs_contains(bs, a2))
-    {
-      // Then remove a2 from the chain
-      a1->next = a2->next;
-      // Free the a2 pointer
-      free(a2);
-    }
-    else
+    // Scan, removing any non-muxed devs
+    maps[1 + c] = i2c_dev_scan(m->i2c, candidates, count);
+    for (int w = 0; w < 4; w++)
     {
-      // Increment a1
-      a1 = a2;
+      maps[1 + c].bits[w] &= ~maps[0].bits[w];
     }
   }
-  // Move the as pointer to the next node
-  *as = (*as)->next;
+  return pca_set_channel(m, PCA_CD);
 }
 
-
 // Scans all the available buses and generates a MuxNetwork
 // Does not include other devices present on the network
 MuxNetwork *pca_get_devs(Mux *m)
 {
-  // Initially disable all channels
-  pca_set_channel(m, PCA_CD);
-  // Gather all devices on network not on mux
-  i2c_dev *extdevs = i2c_dev_detect(m->i2c),
-          *muxdevs = NULL;
+  i2c_map maps[PCA_NO_OF_CHANNELS + 1];
+  // Scan the whole address range
+  if (pca_scan(m, NULL, 0, maps))
+  {
+    return NULL;
+  }
   // Declare and init a MuxNetwork
   MuxNetwork *net = malloc(sizeof(MuxNetwork)),
              *crrt = net;
   // Set the net channel to -1 (external devices) initially
   net->channel = -1;
   // Assign the first devs as externals
-  net->dev = extdevs;
-  // For channel 0 to 3
-  for (int i = 0; i < 4; i++)
+  net->dev = i2c_map_to_devs(maps[0]);
+  // For each channel
+  for (int i = 0; i < PCA_NO_OF_CHANNELS; i++)
   {
-    // Set the channel
-    m->set_channel(m, i);
-    // Scan bus for devices
-    muxdevs = i2c_dev_detect(m->i2c);
-    // TODO - Implement filter
-    // Remove any non-muxed devs from the scan
-    i2c_dev_filter(&muxdevs, extdevs);
     // Add to current network by malloc...
     crrt->next = malloc(sizeof(MuxNetwork));
     // Increment crrt
     crrt = crrt->next;
     // ...assign the channel value...
     crrt->channel = i;
-    // ...assign the muxdevs with externals removed
-    crrt->dev = muxdevs;
+    // ...assign the muxed devs, without the dummy head
+    i2c_dev *dummy = i2c_map_to_devs(maps[1 + i]);
+    crrt->dev = dummy->next;
+    free(dummy);
   }
+  // Terminate the network
+  crrt->next = NULL;
   // Return the origin of the MuxNet
   return net;
 }
@@ -9,9 +9,11 @@
 #define DEV_SHARED_HEADER_INC
 
 #include <stdint.h>
+#include <pthread.h>
 #include "dev.h"
 #include "keyval.h"
 #include "i2c.h"
+#include "gpio.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 // ERROR CODES
@@ -19,13 +21,30 @@
 
 #define DEV_INVALID_HANDLE 0xf0
 #define DEV_NOT_RESPOND    0xf1
+#define DEV_OVER_CAPACITY  0xf2
 
 ///////////////////////////////////////////////////////////////////////////////
 // TYPEDEF
 ///////////////////////////////////////////////////////////////////////////////
 
+// Samples a batch holds by default, a full fifo of xyz frames
+#define DEV_BATCH_SAMPLES (1024 / 6)
+
+// Share of the fifo a stream lets fill between drains by default,
+// and the bounds on the interval between them
+#define DEV_STREAM_FILL   0.5
+#define DEV_STREAM_MIN_NS 1000000
+#define DEV_STREAM_MAX_NS 500000000
+
+// Most buses an acquisition may drain at once, and sensors on each
+#define DEV_ACQ_BUSES   4
+#define DEV_ACQ_SENSORS 16
+
 // Function type for configuration helpers
 typedef uint8_t       (*Configs)(Sensor *s, KeyVal *pairs);
+// Function type handed the batch drained from a sensor, which is
+// refilled once it returns
+typedef void          (*DevSink)(Sensor *s, SampleBatch *b, void *arg);
 
 ///////////////////////////////////////////////////////////////////////////////
 // STRUCTS
@@ -39,6 +58,218 @@ struct ConfigFunctionMap {
   Configs helper;
 };
 
+// Readings held as arrays, one entry per sample, filled in place
+// by a sensor's read_batch
+struct SampleBatch {
+  // States what type of readings, accel or gyro
+  type_t type;
+  // Samples held, and the most the batch can hold
+  int count, capacity;
+  // The respective xyz readings of each sample
+  int16_t *x, *y, *z;
+  // Monotonic time each sample was taken in nanoseconds, estimated
+  // from the time of the read and the sample rate
+  uint64_t *t_ns;
+};
+
+// Batches allocated up front, taken and given back by readers
+struct SamplePool {
+  pthread_mutex_t lock;
+  // The batches free to take, how many, and how many in all
+  SampleBatch **free;
+  int count, size;
+};
+
+// The load a sensor's fifo puts on the bus, as configured
+struct DevLoad {
+  // Samples taken each second, bytes of each in the fifo, and the
+  // bytes the fifo holds. A frame of 0 means the fifo is disabled.
+  double sample_hz;
+  unsigned frame_bytes, fifo_bytes;
+};
+
+// Where the fifo registers of a model sit
+struct DevFifo {
+  // Interrupt status and the bit raised on overflow
+  short int_status;
+  uint8_t int_oflow;
+  // Fifo count, high byte first, and the bits of it implemented
+  short count_h;
+  uint8_t count_h_mask;
+  // Register the fifo is read from
+  short fifo_r;
+  // User control and the bit that resets the fifo
+  short user_ctrl;
+  uint8_t fifo_reset;
+  // Bytes the fifo holds
+  int size;
+};
+
+// What has gone wrong draining a sensor's fifo
+struct DevFifoStats {
+  // Overflows seen, and fifo resets made to recover alignment
+  unsigned long overflows, resets;
+  // Frames lost to either, as best as can be told
+  unsigned long frames_lost;
+};
+
+// The plan for draining a set of sensors sharing a bus
+struct DevPlan {
+  // Seconds of bus time each drain costs whatever the data, and the
+  // share of the bus taken by the data itself
+  double fixed_s, data_share;
+  // Interval planned between drains, and the share of the bus in use
+  double interval_s, utilisation;
+  // Shortest interval the bus keeps up with, and the longest before
+  // a fifo would overflow
+  double min_interval_s, max_interval_s;
+  // Whether the plan is over capacity, or close to it
+  int over, warn;
+};
+
+// A bus being drained by an acquisition thread of its own
+struct DevAcqBus {
+  i2c_bus *i2c;
+  // Sensors on the bus, and how many
+  Sensor *sensors[DEV_ACQ_SENSORS];
+  int count;
+  // Core the thread is pinned to, -1 if left to the scheduler
+  int cpu;
+  // Drains made, readings taken, transfers that failed, and frames
+  // lost to the fifos overflowing
+  unsigned long drains, readings, failures, lost;
+  // The batch drained into
+  SampleBatch *batch;
+  // The thread
+  pthread_t thread;
+  DevAcquire *acq;
+};
+
+// An acquisition, draining the fifos of sensors on any of the buses
+struct DevAcquire {
+  // The sensors, and how many
+  Sensor **sensors;
+  int count;
+  // Interval between drains, and how long to acquire for
+  long interval_ns;
+  double seconds;
+  // Handed each set of readings, if not NULL
+  DevSink sink;
+  void *arg;
+  // The buses drained, filled in by dev_acquire
+  DevAcqBus bus[DEV_ACQ_BUSES];
+  int buses;
+};
+
+// What a stream has done so far
+struct DevStreamStats {
+  // Drains made, those finding the fifo empty, and those failing
+  unsigned long drains, empty, failures;
+  // Times the thread woke, and edges of the interrupt line seen
+  unsigned long wakeups, edges;
+  // Of the sensor's fifo, as last drained
+  DevFifoStats fifo;
+  // Samples handed to the sink
+  unsigned long samples;
+  // Share of the fifo filled at the fullest drain
+  double peak_fill;
+  // Interval between drains now in use
+  long interval_ns;
+};
+
+// A sensor being drained continuously by a thread of its own
+struct DevStream {
+  Sensor *s;
+  // Handed each batch drained, if not NULL
+  DevSink sink;
+  void *arg;
+  // Share of the fifo let fill between drains
+  double fill;
+  // The interrupt line drains are driven by, NULL to drain by time,
+  // and a pipe written to stop the thread waiting on the line
+  GpioEvent *line;
+  int stop[2];
+  // The thread, and whether it should keep running
+  pthread_t thread;
+  int running;
+  // Guards running and the stats, wake is signalled to stop
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  // The batch drained into
+  SampleBatch *batch;
+  DevStreamStats stats;
+};
+
+// Most sensors a schedule may drain, and the samples of each held
+// while waiting to be aligned with the others
+#define DEV_SCHED_SENSORS (DEV_ACQ_BUSES * DEV_ACQ_SENSORS)
+#define DEV_SCHED_HISTORY 1024
+
+// A reading of every sensor of a schedule, aligned to one time
+struct DevFrame {
+  // Time the frame stands for, and its place in the sequence
+  uint64_t t_ns;
+  unsigned long seq;
+  // The readings, in the order the sensors were given
+  int count;
+  int16_t x[DEV_SCHED_SENSORS], y[DEV_SCHED_SENSORS], z[DEV_SCHED_SENSORS];
+  // Set for each sensor yet to give a sample, its readings left zero
+  uint8_t missing[DEV_SCHED_SENSORS];
+};
+
+// Handed each frame as it is aligned
+typedef void (*DevFrameSink)(DevFrame *frame, void *arg);
+
+// A sensor of a schedule, and the samples it has yet to be aligned
+struct DevSchedSensor {
+  Sensor *s;
+  // When the fifo is next due to reach the target fill, and how long
+  // it takes to get there, set under the schedule lock
+  uint64_t due_ns;
+  long fill_ns;
+  // Samples waiting, oldest first from head
+  uint64_t t_ns[DEV_SCHED_HISTORY];
+  int16_t x[DEV_SCHED_HISTORY], y[DEV_SCHED_HISTORY], z[DEV_SCHED_HISTORY];
+  int head, held;
+  // Drains made, and those made early alongside another on its channel
+  unsigned long drains, grouped;
+};
+
+// The sensors of a schedule sharing a bus, drained by one thread
+struct DevSchedBus {
+  i2c_bus *i2c;
+  // Indices of the sensors of the schedule on this bus
+  int sensors[DEV_ACQ_SENSORS];
+  int count;
+  // Drains made, and mux channel switches made between them
+  unsigned long drains, switches;
+  SampleBatch *batch;
+  pthread_t thread;
+  DevSched *sched;
+};
+
+// Drains the fifos of many sensors, each as it is next due, and emits
+// their readings as frames aligned in time
+struct DevSched {
+  DevSchedSensor sensors[DEV_SCHED_SENSORS];
+  int count;
+  DevSchedBus bus[DEV_ACQ_BUSES];
+  int buses;
+  // Share of each fifo let fill between drains, and how long to run
+  double fill, seconds;
+  // Interval between frames, the slowest sensor's sample period
+  long frame_ns;
+  // Handed each frame aligned
+  DevFrameSink sink;
+  void *arg;
+  // Guards the samples waiting and the frames
+  pthread_mutex_t lock;
+  // Time of the next frame, 0 until every sensor has a sample, and
+  // frames emitted, of which those emitted with a sensor behind
+  uint64_t next_ns;
+  unsigned long frames, late;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // FUNCTION STUBS
 ///////////////////////////////////////////////////////////////////////////////
@@ -47,17 +278,96 @@ struct ConfigFunctionMap {
 KeyVal *str_to_keyval(char *str);
 // Yes no live bit swap
 void yn_toggle(uint8_t *reg, int bit, char *yn);
+// Read a register of the sensor, recording any failure
+uint8_t dev_fetch_reg(Sensor *s, short reg);
+// Write a register of the sensor, unless a transfer has failed
+int dev_set_reg(Sensor *s, short reg, uint8_t val);
+// Retry the writes of any registers that failed to reach the device
+int dev_flush_regs(Sensor *s);
+// Forget the register shadow, so registers are read afresh
+void dev_shadow_invalidate(Sensor *s);
 // General configuration function for sensors
 int dev_config(Sensor *s, char *conf_str, ConfigFunctionMap *map);
 // Malloc an Axes struct and return pointer
 Axes *axes_malloc(Axes *next);
-// Calculate the averages for the axes given an Axes linked list
-Axes *axes_average(Axes *ax);
 // Dealloc an Axes linked list and null up in stack
 void axes_dealloc(Axes **a);
+// Malloc a batch able to hold capacity samples
+SampleBatch *batch_malloc(int capacity);
+// Dealloc a batch and null up in stack
+void batch_dealloc(SampleBatch **b);
+// Decode big-endian xyz frames into the batch, after any it holds
+void batch_decode(SampleBatch *b, const uint8_t *data, int frames);
+// As batch_decode, without vector instructions
+void batch_decode_scalar(SampleBatch *b, const uint8_t *data, int frames);
+// Name of the decoder batch_decode was built with
+const char *batch_decoder(void);
+// Compare batch_decode against the scalar decoder over fifo sizes,
+// printing the frames decoded each second to stdout
+void dev_bench_decode(int iterations);
+// Stamp the samples of the batch as read just now from the sensor
+void batch_stamp(Sensor *s, SampleBatch *b);
+// Drain the fifo described into the batch, recovering from overflow
+int dev_fifo_drain(Sensor *s, const DevFifo *fifo, SampleBatch *b);
+// Start the fifo afresh, forgetting any partial frame held
+int dev_fifo_reset(Sensor *s, const DevFifo *fifo);
+// Calculate the averages of the samples held into avg
+int batch_average(SampleBatch *b, Axes *avg);
+// Malloc a pool of batches, each able to hold capacity samples
+SamplePool *batch_pool_malloc(int batches, int capacity);
+// Take an emptied batch from the pool, NULL if none are free
+SampleBatch *batch_take(SamplePool *p);
+// Give a batch back to the pool
+void batch_give(SamplePool *p, SampleBatch *b);
+// Dealloc a pool and every batch in it, null up in stack
+void batch_pool_dealloc(SamplePool **p);
 // Verify a device
 int dev_fails_to_respond(i2c_bus *i2c, int i2c_addr, Mux *mux, int mux_channel);
-// Initialise a device fifo
+// Stream readings into a fifo at path
 int dev_pipe(Sensor *s, const char* path);
+// As dev_pipe, draining as the INT line signals if given one
+int dev_pipe_irq(Sensor *s, const char* path, GpioEvent *line);
+// Stop streaming into the fifo and remove it
+int dev_pipe_close(Sensor *s);
+// Start streaming from a sensor, draining once fill of the fifo
+int dev_stream_start(Sensor *s, double fill, DevSink sink, void *arg);
+// Start streaming from a sensor, draining as its interrupt line counts
+// fill of the fifo
+int dev_stream_start_irq(Sensor *s,
+                         GpioEvent *line,
+                         double fill,
+                         DevSink sink,
+                         void *arg);
+// Stop streaming from a sensor
+int dev_stream_stop(Sensor *s);
+// Copy the statistics of a sensor's stream
+int dev_stream_stats(Sensor *s, DevStreamStats *stats);
+// Malloc a schedule, letting fifos fill to fill, running for seconds
+DevSched *dev_sched_malloc(double fill,
+                           double seconds,
+                           DevFrameSink sink,
+                           void *arg);
+// Dealloc a schedule and null up in stack
+void dev_sched_dealloc(DevSched **sched);
+// Add a sensor to the schedule, returning 0 or DEV_INVALID_HANDLE
+int dev_sched_add(DevSched *sched, Sensor *s);
+// Plan the schedule, returning 0 or the error should a bus be unable
+// to keep up
+int dev_sched_plan(DevSched *sched);
+// Drain the sensors of the schedule for its seconds, emitting frames
+int dev_sched_run(DevSched *sched);
+// Print what the schedule did
+void dev_sched_print(DevSched *sched);
+// Print the statistics of a stream to stdout
+void dev_stream_print(DevStreamStats *stats);
+// Plan the draining of the sensors' fifos every interval
+int dev_plan(Sensor **s, int count, double interval_s, double fill,
+             DevPlan *plan);
+// Print a plan to stdout
+void dev_plan_print(DevPlan *plan);
+// Drain the sensors, a thread for each bus each on its own core
+int dev_acquire(DevAcquire *acq);
+// Print what each bus of an acquisition did to stdout
+void dev_acquire_print(DevAcquire *acq);
 
 #endif
@@ -0,0 +1,226 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: dev_acquire.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+// Required for pinning threads to cores
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include "macros.h"
+#include "dev_sensor.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// PARALLEL ACQUISITION
+///////////////////////////////////////////////////////////////////////////////
+/*
+   The two BSCs run independently, so sensors split across I2C0 and
+   I2C1 may be drained at the same time. Each bus is given a thread
+   of its own, pinned to a core of its own, which drains every sensor
+   on that bus in turn each interval. Threads only meet at the state
+   table of the i2c module, so with a core each the throughput of
+   the buses adds up.
+
+   Core 0 is left to the main thread and to interrupts, the buses
+   taking cores 1 upwards. A Pi with a single core leaves the threads
+   to the scheduler.
+
+   Before starting, each bus is planned (see dev_plan.c), and the
+   acquisition refused should any bus be over capacity.
+*/
+
+// Share of a fifo that may fill between drains
+#define ACQ_FILL 0.8
+
+// Monotonic clock in nanoseconds
+static uint64_t now_ns(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// Transfers to the sensors of the bus that failed outright so far
+static unsigned long bus_failures(DevAcqBus *bus)
+{
+  unsigned long failures = 0;
+  for (int i = 0; i < bus->count; i++)
+  {
+    i2c_dev_errors errors;
+    i2c_get_dev_errors(bus->i2c, bus->sensors[i]->i2c_addr, &errors);
+    failures += errors.failures;
+  }
+  return failures;
+}
+
+// Frames of the sensors on the bus lost to their fifos so far
+static unsigned long bus_lost(DevAcqBus *bus)
+{
+  unsigned long lost = 0;
+  for (int i = 0; i < bus->count; i++)
+  {
+    lost += bus->sensors[i]->fifo_stats.frames_lost;
+  }
+  return lost;
+}
+
+// Thread draining every sensor of one bus each interval
+static void *acquire_bus(void *arg)
+{
+  DevAcqBus *bus = arg;
+  DevAcquire *acq = bus->acq;
+  // Pin to the core chosen, the bus keeps going if not allowed
+  if (bus->cpu >= 0)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(bus->cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+    {
+      bus->cpu = -1;
+    }
+  }
+  unsigned long failed_before = bus_failures(bus),
+                lost_before = bus_lost(bus);
+  uint64_t next = now_ns(),
+           end = next + (uint64_t)(acq->seconds * 1e9);
+  while (next < end)
+  {
+    for (int i = 0; i < bus->count; i++)
+    {
+      Sensor *s = bus->sensors[i];
+      // An empty fifo reads as nothing
+      if (!s->read_batch(s, FIFO, bus->batch) && bus->batch->count)
+      {
+        bus->readings += bus->batch->count;
+        if (acq->sink)
+        {
+          acq->sink(s, bus->batch, acq->arg);
+        }
+      }
+    }
+    bus->drains++;
+    // Sleep until the next interval is due
+    next += acq->interval_ns;
+    struct timespec until = { next / 1000000000ull, next % 1000000000ull };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL));
+  }
+  bus->failures = bus_failures(bus) - failed_before;
+  bus->lost = bus_lost(bus) - lost_before;
+  return NULL;
+}
+
+// Split the sensors by bus, returning 0 or DEV_INVALID_HANDLE if
+// there are more buses or sensors than an acquisition can take
+static int split_buses(DevAcquire *acq)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  acq->buses = 0;
+  for (int i = 0; i < acq->count; i++)
+  {
+    Sensor *s = acq->sensors[i];
+    int b = 0;
+    // Find the bus of the sensor, else take the next
+    while ((b < acq->buses) && (acq->bus[b].i2c != s->i2c))
+    {
+      b++;
+    }
+    if (b == DEV_ACQ_BUSES)
+    {
+      ERR("Cannot acquire from more than %d buses.\n\n", DEV_ACQ_BUSES);
+      return DEV_INVALID_HANDLE;
+    }
+    DevAcqBus *bus = &acq->bus[b];
+    if (b == acq->buses)
+    {
+      acq->buses++;
+      *bus = (DevAcqBus) { .i2c = s->i2c, .acq = acq };
+      // Cores from 1 upwards, wrapping round past the last
+      bus->cpu = (cpus > 1) ? 1 + b % (cpus - 1) : -1;
+    }
+    else if (bus->count == DEV_ACQ_SENSORS)
+    {
+      ERR("Cannot acquire from more than %d sensors on a bus.\n\n",
+          DEV_ACQ_SENSORS);
+      return DEV_INVALID_HANDLE;
+    }
+    bus->sensors[bus->count++] = s;
+  }
+  return 0;
+}
+
+// Drain the sensors every interval for the seconds asked, a thread
+// for each bus. Returns 0 once done, else an error code should the
+// acquisition be refused.
+int dev_acquire(DevAcquire *acq)                                 // dev_acquire
+{
+  int err = split_buses(acq);
+  if (err)
+  {
+    return err;
+  }
+  // Refuse should any bus be unable to keep up
+  for (int b = 0; b < acq->buses; b++)
+  {
+    DevPlan plan;
+    DevAcqBus *bus = &acq->bus[b];
+    if ((err = dev_plan(bus->sensors, bus->count, acq->interval_ns / 1e9,
+                        ACQ_FILL, &plan)))
+    {
+      dev_plan_print(&plan);
+      return err;
+    }
+  }
+  // Every bus drains into a batch of its own, made up front
+  SamplePool *pool = batch_pool_malloc(acq->buses, DEV_BATCH_SAMPLES);
+  // Start the thread of each bus, then wait on them all
+  int started = 0;
+  for (; started < acq->buses; started++)
+  {
+    DevAcqBus *bus = &acq->bus[started];
+    bus->batch = batch_take(pool);
+    if ((err = pthread_create(&bus->thread, NULL, &acquire_bus, bus)))
+    {
+      ERR("Thread creation failed with error (%d)\n\n", err);
+      break;
+    }
+  }
+  for (int b = 0; b < acq->buses; b++)
+  {
+    DevAcqBus *bus = &acq->bus[b];
+    if (b < started)
+    {
+      pthread_join(bus->thread, NULL);
+    }
+    // A bus whose thread failed to start may still hold a batch
+    if (bus->batch)
+    {
+      batch_give(pool, bus->batch);
+      bus->batch = NULL;
+    }
+  }
+  batch_pool_dealloc(&pool);
+  return err;
+}
+
+// Print what each bus of the acquisition did
+void dev_acquire_print(DevAcquire *acq)                    // dev_acquire_print
+{
+  unsigned long readings = 0;
+  printf("  Thread | Core | Sensors | Drains | Readings | Failed | Lost\n");
+  for (int b = 0; b < acq->buses; b++)
+  {
+    DevAcqBus *bus = &acq->bus[b];
+    printf("  %-6d | %4d | %7d | %6lu | %8lu | %6lu | %4lu\n", b, bus->cpu,
+           bus->count, bus->drains, bus->readings, bus->failures, bus->lost);
+    readings += bus->readings;
+  }
+  printf("\n  %lu readings in %.1fs, %.0f readings/s\n\n", readings,
+         acq->seconds, readings / acq->seconds);
+}
@@ -32,45 +32,6 @@ Axes *axes_malloc(Axes *next)
   return ax;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// TOOLS
-///////////////////////////////////////////////////////////////////////////////
-
-// Helper to produce an Axes struct containing averages
-Axes *axes_average(Axes *ax)
-{
-  // If axes are already null
-  if (ax == NULL)
-  {
-    // Return null
-    return NULL;
-  }
-  // Produce result with initially 0 values
-  Axes *res = malloc(sizeof(Axes));
-  // Initialise variable to keep count
-  int count = 0;
-  // Initialise long values to keep totals
-  long long int x = 0, y = 0, z = 0;
-  // While we have an ax
-  while (ax)
-  {
-    // Increment count
-    count++;
-    // Accumulate the axes
-    x += ax->x;
-    y += ax->y;
-    z += ax->z;
-    // Increment ax
-    ax = ax->next;
-  }
-  // Set the averages into the res struct
-  res->x = (short) (x / count);
-  res->y = (short) (y / count);
-  res->z = (short) (z / count);
-  // Return the result
-  return res;
-}
-
 ///////////////////////////////////////////////////////////////////////////////
 // DEALLOC
 ///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,158 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: dev_batch.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <time.h>
+#include "dev/shared/dev_sensor.h"
+#include "macros.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// SAMPLE BATCHES
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Draining a full fifo as an Axes list costs a malloc for every
+   frame, and consumers then chase pointers through the heap. A
+   batch instead holds each axis as an array, allocated once with
+   the batch itself and refilled on every read. Readers that run
+   for long, or in several threads, draw their batches from a pool
+   made up front, so nothing is allocated while streaming.
+*/
+
+// Malloc a batch able to hold capacity samples, the arrays sharing
+// the one allocation
+SampleBatch *batch_malloc(int capacity)                        // batch_malloc
+{
+  // The timestamps come first, keeping them aligned
+  SampleBatch *b = malloc(sizeof(SampleBatch) +
+                          capacity * (sizeof(uint64_t) + 3 * sizeof(int16_t)));
+  if (b == NULL)
+  {
+    ERR("Error mallocing new batch. Unrecoverable.\n\n");
+    exit(EXIT_FAILURE);
+  }
+  *b = (SampleBatch) { .type = GYRO, .capacity = capacity };
+  b->t_ns = (uint64_t *)(b + 1);
+  b->x = (int16_t *)(b->t_ns + capacity);
+  b->y = b->x + capacity;
+  b->z = b->y + capacity;
+  return b;
+}
+
+// Dealloc the batch and null up in stack
+void batch_dealloc(SampleBatch **b)                           // batch_dealloc
+{
+  free(*b);
+  *b = NULL;
+}
+
+// Stamp the samples of the batch as read just now, the last taken
+// now and each before it a sample period earlier
+void batch_stamp(Sensor *s, SampleBatch *b)                      // batch_stamp
+{
+  struct timespec t;
+  DevLoad load;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  uint64_t now = (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec,
+           period = 0;
+  // Without a rate every sample is stamped with the read
+  if (s->load && !s->load(s, &load) && (load.sample_hz > 0))
+  {
+    period = (uint64_t)(1e9 / load.sample_hz);
+  }
+  for (int i = 0; i < b->count; i++)
+  {
+    b->t_ns[i] = now - (b->count - 1 - i) * period;
+  }
+}
+
+// Calculate the averages of the samples held into avg. Returns 0,
+// else DEV_INVALID_HANDLE should the batch be empty.
+int batch_average(SampleBatch *b, Axes *avg)                  // batch_average
+{
+  if (!b->count)
+  {
+    return DEV_INVALID_HANDLE;
+  }
+  // Accumulate in longs, a full fifo would overflow a short
+  long long int x = 0, y = 0, z = 0;
+  for (int i = 0; i < b->count; i++)
+  {
+    x += b->x[i];
+    y += b->y[i];
+    z += b->z[i];
+  }
+  *avg = (Axes) { .type = b->type, .next = NULL };
+  avg->x = (short)(x / b->count);
+  avg->y = (short)(y / b->count);
+  avg->z = (short)(z / b->count);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// POOLS
+///////////////////////////////////////////////////////////////////////////////
+
+// Malloc a pool of batches, each able to hold capacity samples
+SamplePool *batch_pool_malloc(int batches,                 // batch_pool_malloc
+                              int capacity)
+{
+  SamplePool *p = malloc(sizeof(SamplePool));
+  if ((p == NULL) || !(p->free = malloc(batches * sizeof(SampleBatch*))))
+  {
+    ERR("Error mallocing new batch pool. Unrecoverable.\n\n");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&p->lock, NULL);
+  p->count = p->size = batches;
+  for (int i = 0; i < batches; i++)
+  {
+    p->free[i] = batch_malloc(capacity);
+  }
+  return p;
+}
+
+// Take an emptied batch from the pool, NULL should every batch
+// already be taken
+SampleBatch *batch_take(SamplePool *p)                           // batch_take
+{
+  SampleBatch *b = NULL;
+  pthread_mutex_lock(&p->lock);
+  if (p->count)
+  {
+    b = p->free[--p->count];
+    b->count = 0;
+  }
+  pthread_mutex_unlock(&p->lock);
+  return b;
+}
+
+// Give a batch taken from the pool back to it
+void batch_give(SamplePool *p, SampleBatch *b)                   // batch_give
+{
+  pthread_mutex_lock(&p->lock);
+  p->free[p->count++] = b;
+  pthread_mutex_unlock(&p->lock);
+}
+
+// Dealloc the pool and the batches in it, every batch having been
+// given back, and null up in stack
+void batch_pool_dealloc(SamplePool **p)                  // batch_pool_dealloc
+{
+  if ((*p)->count != (*p)->size)
+  {
+    ERR("Deallocing a pool with %d batches still taken.\n\n",
+        (*p)->size - (*p)->count);
+  }
+  for (int i = 0; i < (*p)->count; i++)
+  {
+    batch_dealloc(&(*p)->free[i]);
+  }
+  pthread_mutex_destroy(&(*p)->lock);
+  free((*p)->free);
+  free(*p);
+  *p = NULL;
+}
@@ -0,0 +1,95 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: dev_bench.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "dev/shared/dev_sensor.h"
+#include "macros.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// DECODE BENCHMARK
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Decodes the same fifo block over and over, once with the decoder
+   built in and once with the scalar loop, for fifo sizes from a
+   single frame to a full MPU fifo. The two are checked to agree.
+*/
+
+// Signature shared by both decoders
+typedef void (*Decoder)(SampleBatch *b, const uint8_t *data, int frames);
+
+// Nanoseconds between two timespecs
+static long ns_between(struct timespec *a, struct timespec *b)
+{
+  return (b->tv_sec - a->tv_sec) * 1000000000l + (b->tv_nsec - a->tv_nsec);
+}
+
+// Decode the block iterations times, returning frames per second
+static double bench_decoder(Decoder decode,
+                            SampleBatch *b,
+                            const uint8_t *block,
+                            int frames,
+                            int iterations)
+{
+  struct timespec start, end;
+  // Kept so the decoding cannot be optimised away
+  volatile int16_t seen = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < iterations; i++)
+  {
+    b->count = 0;
+    decode(b, block, frames);
+    seen += b->z[frames - 1];
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long ns = ns_between(&start, &end);
+  return ns ? (double)frames * iterations * 1e9 / ns : 0;
+}
+
+// Compare the decoder built in against the scalar one, for fifo
+// sizes from 6 to 1024 bytes
+void dev_bench_decode(int iterations)                      // dev_bench_decode
+{
+  int sizes[] = { 6, 48, 96, 192, 384, 768, 1024 };
+  uint8_t block[1024];
+  SampleBatch *vec = batch_malloc(DEV_BATCH_SAMPLES),
+              *ref = batch_malloc(DEV_BATCH_SAMPLES);
+  // Fill the fifo with something other than a pattern
+  uint32_t seed = 0x1234567;
+  for (int i = 0; i < sizeof(block); i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    block[i] = seed >> 16;
+  }
+  PRINTC(GREEN, "Benchmarking fifo decoding with %s (%d decodes each)...\n\n",
+         batch_decoder(), iterations);
+  printf("   +-------+--------+----------------+----------------+---------+\n");
+  printf("   | bytes | frames |  scalar fr/s   |  built in fr/s | speedup |\n");
+  printf("   +-------+--------+----------------+----------------+---------+\n");
+  for (int s = 0; s < sizeof(sizes) / sizeof(int); s++)
+  {
+    int frames = sizes[s] / 6;
+    double scalar = bench_decoder(&batch_decode_scalar, ref, block, frames,
+                                  iterations),
+           built = bench_decoder(&batch_decode, vec, block, frames,
+                                 iterations);
+    // Verify the decoders agree on every axis
+    if (memcmp(vec->x, ref->x, frames * sizeof(int16_t)) ||
+        memcmp(vec->y, ref->y, frames * sizeof(int16_t)) ||
+        memcmp(vec->z, ref->z, frames * sizeof(int16_t)))
+    {
+      ERR("The %s decoder disagrees with the scalar at %d bytes.\n\n",
+          batch_decoder(), sizes[s]);
+    }
+    printf("   | %5d | %6d | %14.0f | %14.0f | %6.2fx |\n", sizes[s], frames,
+           scalar, built, scalar ? built / scalar : 0);
+  }
+  printf("   +-------+--------+----------------+----------------+---------+\n\n");
+  batch_dealloc(&vec);
+  batch_dealloc(&ref);
+}
@@ -73,6 +73,138 @@ void yn_toggle(uint8_t *reg, int bit, char *yn)
   }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// REGISTER ACCESS
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Config helpers read a register, modify it and write it back. Should
+   the read fail (after the bus has retried) the value is meaningless,
+   so the failure is kept in s->io_error and no register is written
+   until it is cleared. dev_config clears it before applying settings
+   and reports it afterwards, so a flaky sensor fails its own config
+   rather than taking down the process.
+
+   Every configuration register is shadowed in the Sensor. A register
+   is read from the device only the first time it is fetched, and
+   every write goes through the shadow to the device, so applying a
+   config costs only the writes that change something. Writes that
+   fail are left dirty in the shadow and retried by dev_flush_regs.
+   Bits that clear themselves once written (FIFO resets and the like)
+   are never kept. Only configuration registers may be fetched this
+   way, never data or status registers.
+*/
+
+// Test, set and clear a register in a shadow bitmap
+#define REG_HAS(map, reg) ((map)[(reg) >> 3] & (1u << ((reg) & 7)))
+#define REG_SET(map, reg) ((map)[(reg) >> 3] |= (1u << ((reg) & 7)))
+#define REG_CLR(map, reg) ((map)[(reg) >> 3] &= ~(1u << ((reg) & 7)))
+
+// Read a register of the sensor, from the shadow if held there,
+// reading as 0 on failure
+uint8_t dev_fetch_reg(Sensor *s, short reg)
+{
+  uint8_t byte = 0;
+  int code;
+  reg &= 0xff;
+  // Use the shadow if it holds the register
+  if (REG_HAS(s->shadow_valid, reg))
+  {
+    return s->shadow[reg];
+  }
+  // Reach the device, the mux may have been left on another channel
+  // by a sensor since
+  if (s->mux && (code = s->mux->set_channel(s->mux, s->mux_channel)))
+  {
+    s->io_error = s->io_error ? s->io_error : code;
+    return byte;
+  }
+  if ((code = i2c_read_into(s->i2c, s->i2c_addr, reg, &byte, 1)))
+  {
+    ERR("Failed to read register 0x%02x of dev 0x%02x.\n\n", 
+        reg, s->i2c_addr);
+    // Keep the first error
+    s->io_error = s->io_error ? s->io_error : code;
+    return byte;
+  }
+  // Load the shadow
+  s->shadow[reg] = byte;
+  REG_SET(s->shadow_valid, reg);
+  return byte;
+}
+
+// Write a shadowed register through to the device
+static int write_through(Sensor *s, short reg)
+{
+  uint8_t val = s->shadow[reg];
+  int code = i2c_try_write_reg(s->i2c, s->i2c_addr, reg, &val, 1);
+  if (code)
+  {
+    return code;
+  }
+  // Written, so no longer dirty, and drop any bits the device
+  // will have cleared itself
+  REG_CLR(s->shadow_dirty, reg);
+  if (s->self_clearing)
+  {
+    s->shadow[reg] &= ~s->self_clearing[reg];
+  }
+  return 0;
+}
+
+// Write a register of the sensor, skipping the write should the
+// device already hold the value. Returns 0 on success, else the
+// error code that failed this or an earlier transfer.
+int dev_set_reg(Sensor *s, short reg, uint8_t val)
+{
+  int code;
+  reg &= 0xff;
+  // Never write a value derived from a failed read
+  if (s->io_error)
+  {
+    return s->io_error;
+  }
+  // Nothing to do if the device is known to hold the value
+  if (REG_HAS(s->shadow_valid, reg) && !REG_HAS(s->shadow_dirty, reg) &&
+      (s->shadow[reg] == val))
+  {
+    return 0;
+  }
+  // Update the shadow, dirty until the device has it
+  s->shadow[reg] = val;
+  REG_SET(s->shadow_valid, reg);
+  REG_SET(s->shadow_dirty, reg);
+  if ((code = write_through(s, reg)))
+  {
+    ERR("Failed to write register 0x%02x of dev 0x%02x.\n\n", 
+        reg, s->i2c_addr);
+    s->io_error = code;
+  }
+  return code;
+}
+
+// Retry the write of every dirty register. Returns 0 once all
+// have reached the device, else the first error.
+int dev_flush_regs(Sensor *s)
+{
+  int code;
+  for (int reg = 0; reg < 256; reg++)
+  {
+    if (REG_HAS(s->shadow_dirty, reg) && (code = write_through(s, reg)))
+    {
+      return code;
+    }
+  }
+  return 0;
+}
+
+// Forget everything in the shadow, to be called whenever the
+// device may have been reset behind our back
+void dev_shadow_invalidate(Sensor *s)
+{
+  memset(s->shadow_valid, 0, sizeof(s->shadow_valid));
+  memset(s->shadow_dirty, 0, sizeof(s->shadow_dirty));
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // DEVICE VERIFICATION
 ///////////////////////////////////////////////////////////////////////////////
@@ -87,9 +219,10 @@ int dev_fails_to_respond(i2c_bus *i2c, int i2c_addr, Mux *mux, int mux_channel)
     return DEV_INVALID_HANDLE;
   }
   // If mux exists, then configure for the address test
-  if (mux)
+  if (mux && mux->set_channel(mux, mux_channel))
   {
-    mux->set_channel(mux, mux_channel);
+    ERR("Mux did not respond, cannot reach `0x%02x`\n\n", i2c_addr);
+    return DEV_NOT_RESPOND;
   }
   // Verify the presense of the device on the bus
   if (!i2c_bus_addr_active(i2c, i2c_addr))
@@ -108,15 +241,18 @@ int dev_fails_to_respond(i2c_bus *i2c, int i2c_addr, Mux *mux, int mux_channel)
 // Given an array of KeyVal structs, iterate through all pairs and
 // if this setting is implemented, then call the appropriate helper.
 // Sensor *s is a pointer to the dev that should be configured.
-// Returns number of detected register changes made
+// Returns number of detected register changes made, or -1 should
+// any transfer to the device have failed
 int dev_config(Sensor *s, char *conf_str, ConfigFunctionMap *map)
 {
   // If there is a multiplexer, configure for access
-  if (s->mux)
+  if (s->mux && s->mux->set_channel(s->mux, s->mux_channel))
   {
-    // Set the channel
-    s->mux->set_channel(s->mux, s->mux_channel);
+    return -1;
   }
+  // Start afresh, so one glitch does not fail every later config,
+  // first retrying any writes that failed last time
+  s->io_error = dev_flush_regs(s);
   // Generate the keyval
   KeyVal *k = str_to_keyval(conf_str),
          *_k = k;
@@ -150,5 +286,12 @@ int dev_config(Sensor *s, char *conf_str, ConfigFunctionMap *map)
   }
   // Dealloc the keyval
   keyval_dealloc(&_k);
+  // Report failure should any transfer have failed
+  if (s->io_error)
+  {
+    ERR("Config of dev 0x%02x failed (error 0x%02x).\n\n", 
+        s->i2c_addr, s->io_error);
+    return -1;
+  }
   return applied;
 }
@@ -0,0 +1,213 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: dev_decode.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include "dev/shared/dev_sensor.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// FIFO FRAME DECODING
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Each fifo frame is x, y and z as big-endian 16 bit words, so every
+   value needs its bytes swapping and the three axes pulling apart
+   into the arrays of the batch. With many gyros at high rates this
+   is the cost paid on every sample, so where the core has vector
+   instructions eight or sixteen frames are decoded at a time, any
+   frames left over falling to the scalar loop.
+
+     NEON    vld3 deinterleaves the axes as it loads, vrev16 swaps
+             the bytes. Needs -mfpu=neon on the Pi 2 and later.
+     AVX2    As SSSE3, sixteen frames at a time, each 128 bit lane
+             taking eight. For replaying captures on a PC.
+     SSSE3   pshufb picks out and swaps the bytes of one axis from
+             each of three registers, which are or'd together.
+
+   The choice is made at compile time, see SIMD in App.Makefile.
+*/
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DECODER "neon"
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define DECODER "avx2"
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define DECODER "ssse3"
+#else
+#define DECODER "scalar"
+#endif
+
+// Decode frames one value at a time, the fallback for all
+static void decode_scalar(int16_t *x,
+                          int16_t *y,
+                          int16_t *z,
+                          const uint8_t *data,
+                          int frames)
+{
+  for (int i = 0; i < frames; i++, data += 6)
+  {
+    x[i] = (int16_t)((data[0] << 8) | data[1]);
+    y[i] = (int16_t)((data[2] << 8) | data[3]);
+    z[i] = (int16_t)((data[4] << 8) | data[5]);
+  }
+}
+
+#if defined(__SSSE3__)
+// For each axis, the bytes taken from each of three registers of
+// eight frames, low byte first, -1 leaving the byte zero
+static const int8_t masks[3][3][16] = {
+  { {  1,  0,  7,  6, 13, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { -1, -1, -1, -1, -1, -1,  3,  2,  9,  8, 15, 14, -1, -1, -1, -1 },
+    { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  5,  4, 11, 10 } },
+  { {  3,  2,  9,  8, 15, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { -1, -1, -1, -1, -1, -1,  5,  4, 11, 10, -1, -1, -1, -1, -1, -1 },
+    { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  1,  0,  7,  6, 13, 12 } },
+  { {  5,  4, 11, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { -1, -1, -1, -1,  1,  0,  7,  6, 13, 12, -1, -1, -1, -1, -1, -1 },
+    { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  3,  2,  9,  8, 15, 14 } }
+};
+
+// Load the mask for axis a from register r
+#define MASK(a, r) _mm_loadu_si128((const __m128i *)masks[a][r])
+
+// Pick out and swap the bytes of one axis from the three registers
+#define AXIS(shuffle, or, r0, r1, r2, m0, m1, m2) \
+  or(or(shuffle(r0, m0), shuffle(r1, m1)), shuffle(r2, m2))
+
+// Decode eight frames at a time, returning how many were decoded
+static int decode_ssse3(int16_t *x,
+                        int16_t *y,
+                        int16_t *z,
+                        const uint8_t *data,
+                        int frames)
+{
+  int i = 0;
+  // Too few frames to be worth loading the masks
+  if (frames < 8)
+  {
+    return 0;
+  }
+  const __m128i mx0 = MASK(0, 0), mx1 = MASK(0, 1), mx2 = MASK(0, 2),
+                my0 = MASK(1, 0), my1 = MASK(1, 1), my2 = MASK(1, 2),
+                mz0 = MASK(2, 0), mz1 = MASK(2, 1), mz2 = MASK(2, 2);
+  for (; i + 8 <= frames; i += 8, data += 48)
+  {
+    __m128i r0 = _mm_loadu_si128((const __m128i *)data),
+            r1 = _mm_loadu_si128((const __m128i *)(data + 16)),
+            r2 = _mm_loadu_si128((const __m128i *)(data + 32));
+    _mm_storeu_si128((__m128i *)(x + i), AXIS(_mm_shuffle_epi8,
+                     _mm_or_si128, r0, r1, r2, mx0, mx1, mx2));
+    _mm_storeu_si128((__m128i *)(y + i), AXIS(_mm_shuffle_epi8,
+                     _mm_or_si128, r0, r1, r2, my0, my1, my2));
+    _mm_storeu_si128((__m128i *)(z + i), AXIS(_mm_shuffle_epi8,
+                     _mm_or_si128, r0, r1, r2, mz0, mz1, mz2));
+  }
+  return i;
+}
+#endif
+
+#if defined(__AVX2__)
+// Load the mask for axis a from register r into both lanes
+#define MASK2(a, r) _mm256_broadcastsi128_si256(MASK(a, r))
+// Load the 16 bytes at p into the low lane, and 48 on into the high
+#define LOAD2(p) _mm256_inserti128_si256(_mm256_castsi128_si256(    \
+  _mm_loadu_si128((const __m128i *)(p))),                            \
+  _mm_loadu_si128((const __m128i *)((p) + 48)), 1)
+
+// Decode sixteen frames at a time, the low lane of each register
+// holding a third of the first eight, the high lane of the next
+static int decode_avx2(int16_t *x,
+                       int16_t *y,
+                       int16_t *z,
+                       const uint8_t *data,
+                       int frames)
+{
+  int i = 0;
+  if (frames < 16)
+  {
+    return decode_ssse3(x, y, z, data, frames);
+  }
+  const __m256i mx0 = MASK2(0, 0), mx1 = MASK2(0, 1), mx2 = MASK2(0, 2),
+                my0 = MASK2(1, 0), my1 = MASK2(1, 1), my2 = MASK2(1, 2),
+                mz0 = MASK2(2, 0), mz1 = MASK2(2, 1), mz2 = MASK2(2, 2);
+  for (; i + 16 <= frames; i += 16, data += 96)
+  {
+    __m256i r0 = LOAD2(data), r1 = LOAD2(data + 16), r2 = LOAD2(data + 32);
+    _mm256_storeu_si256((__m256i *)(x + i), AXIS(_mm256_shuffle_epi8,
+                        _mm256_or_si256, r0, r1, r2, mx0, mx1, mx2));
+    _mm256_storeu_si256((__m256i *)(y + i), AXIS(_mm256_shuffle_epi8,
+                        _mm256_or_si256, r0, r1, r2, my0, my1, my2));
+    _mm256_storeu_si256((__m256i *)(z + i), AXIS(_mm256_shuffle_epi8,
+                        _mm256_or_si256, r0, r1, r2, mz0, mz1, mz2));
+  }
+  // Eight left over go by SSSE3
+  return i + decode_ssse3(x + i, y + i, z + i, data, frames - i);
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+// Decode eight frames at a time, returning how many were decoded
+static int decode_neon(int16_t *x,
+                       int16_t *y,
+                       int16_t *z,
+                       const uint8_t *data,
+                       int frames)
+{
+  int i = 0;
+  for (; i + 8 <= frames; i += 8, data += 48)
+  {
+    // Each lane loads byte swapped, the Pi being little-endian
+    uint16x8x3_t v = vld3q_u16((const uint16_t *)data);
+    vst1q_s16(x + i, vreinterpretq_s16_u8(
+                       vrev16q_u8(vreinterpretq_u8_u16(v.val[0]))));
+    vst1q_s16(y + i, vreinterpretq_s16_u8(
+                       vrev16q_u8(vreinterpretq_u8_u16(v.val[1]))));
+    vst1q_s16(z + i, vreinterpretq_s16_u8(
+                       vrev16q_u8(vreinterpretq_u8_u16(v.val[2]))));
+  }
+  return i;
+}
+#endif
+
+// Decode big-endian xyz frames of 6 bytes into the batch, after any
+// samples it already holds. The caller keeps within capacity.
+void batch_decode(SampleBatch *b,                              // batch_decode
+                  const uint8_t *data,
+                  int frames)
+{
+  int16_t *x = b->x + b->count,
+          *y = b->y + b->count,
+          *z = b->z + b->count;
+  int done = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  done = decode_neon(x, y, z, data, frames);
+#elif defined(__AVX2__)
+  done = decode_avx2(x, y, z, data, frames);
+#elif defined(__SSSE3__)
+  done = decode_ssse3(x, y, z, data, frames);
+#endif
+  // The frames left over, or all of them without vectors
+  decode_scalar(x + done, y + done, z + done, data + 6 * done,
+                frames - done);
+  b->count += frames;
+}
+
+// As batch_decode, without vector instructions
+void batch_decode_scalar(SampleBatch *b,                // batch_decode_scalar
+                         const uint8_t *data,
+                         int frames)
+{
+  decode_scalar(b->x + b->count, b->y + b->count, b->z + b->count,
+                data, frames);
+  b->count += frames;
+}
+
+// Name of the decoder batch_decode was built with
+const char *batch_decoder(void)                               // batch_decoder
+{
+  return DECODER;
+}
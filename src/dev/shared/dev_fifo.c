@@ -0,0 +1,147 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: dev_fifo.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <time.h>
+#include "macros.h"
+#include "dev_sensor.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// FIFO DRAINING
+///////////////////////////////////////////////////////////////////////////////
+/*
+   The gyros push whole xyz frames into the fifo each sample, so left
+   alone the fifo ends on a frame boundary. Two things break this.
+
+   Reading an exact number of frames is not always possible, so the
+   whole count is read and any bytes past the last whole frame are
+   carried over to the next drain. They begin the frame whose rest
+   is at the head of the fifo.
+
+   On overflow the fifo drops its oldest bytes one at a time. A fifo
+   of 1024 or 512 bytes holds no whole number of frames, so the head
+   is left partway into a frame. INT_STATUS is read ahead of every
+   drain to catch this. The tail still ends on a frame boundary, so
+   the bytes of the count past a whole number of frames are skipped
+   at the head, and the carry is dropped. The frames overwritten are
+   estimated from the time since the last drain.
+
+   Some faults give a count that cannot be realigned: more than the
+   fifo holds, or an odd count when every reading is a 16 bit word.
+   These are recovered by resetting the fifo, which loses whatever
+   it held.
+*/
+
+// Bytes in a frame of xyz, as read_batch assumes
+#define FRAME 6
+
+// Monotonic clock in nanoseconds
+static uint64_t now_ns(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// Frames the sensor took since the last drain, or 0 if not known
+static unsigned long frames_since(Sensor *s, uint64_t now)
+{
+  DevLoad load;
+  if (!s->fifo_drained_ns || !s->load || s->load(s, &load) ||
+      (load.sample_hz <= 0))
+  {
+    return 0;
+  }
+  return (unsigned long)((now - s->fifo_drained_ns) * load.sample_hz / 1e9);
+}
+
+// Reset the fifo, forgetting any partial frame held. Returns 0, else
+// the error code of the failed transfer.
+int dev_fifo_reset(Sensor *s, const DevFifo *fifo)           // dev_fifo_reset
+{
+  // Only a failed fetch of the register stands in the way, not an
+  // earlier transfer error, else the fifo would never be reset again
+  int prior = s->io_error;
+  s->io_error = 0;
+  uint8_t user_ctrl = dev_fetch_reg(s, fifo->user_ctrl);
+  int err = s->io_error;
+  s->io_error = prior ? prior : err;
+  // The reset bit clears itself, and is never held in the shadow, so
+  // goes straight to the device
+  if (!err)
+  {
+    user_ctrl |= fifo->fifo_reset;
+    err = i2c_try_write_reg(s->i2c, s->i2c_addr, fifo->user_ctrl,
+                            &user_ctrl, 1);
+  }
+  s->fifo_carried = 0;
+  s->fifo_stats.resets++;
+  return err;
+}
+
+// Drain the fifo into the batch, after any samples it holds, as far
+// as it has room for whole frames. Overflows are realigned and
+// counted, a count that cannot be realigned resets the fifo. Returns
+// 0, else DEV_NOT_RESPOND should a transfer fail.
+int dev_fifo_drain(Sensor *s,                                // dev_fifo_drain
+                   const DevFifo *fifo,
+                   SampleBatch *b)
+{
+  uint8_t status, count[2];
+  // Status first, an overflow after the count is caught next drain
+  if (i2c_read_into(s->i2c, s->i2c_addr, fifo->int_status, &status, 1) ||
+      i2c_read_into(s->i2c, s->i2c_addr, fifo->count_h, count, 2))
+  {
+    return DEV_NOT_RESPOND;
+  }
+  uint64_t now = now_ns();
+  int bytes = ((fifo->count_h_mask & count[0]) << 8) | count[1],
+      skip = 0;
+  if (status & fifo->int_oflow)
+  {
+    // The head is partway into a frame, whatever was carried lost
+    s->fifo_stats.overflows++;
+    skip = bytes % FRAME;
+    s->fifo_carried = 0;
+    // Frames taken beyond those the fifo still holds were overwritten
+    unsigned long taken = frames_since(s, now), held = bytes / FRAME;
+    s->fifo_stats.frames_lost += (taken > held) ? taken - held : 1;
+  }
+  else if ((bytes > fifo->size) || ((s->fifo_carried + bytes) % 2))
+  {
+    // Beyond realigning, so start afresh
+    s->fifo_stats.frames_lost += (s->fifo_carried + bytes) / FRAME;
+    s->fifo_drained_ns = now;
+    return dev_fifo_reset(s, fifo) ? DEV_NOT_RESPOND : 0;
+  }
+  s->fifo_drained_ns = now;
+  // Read no more than the batch has room for, frames left behind
+  // being read next drain
+  int room = (b->capacity - b->count) * FRAME - s->fifo_carried;
+  bytes = (bytes - skip > room) ? skip + room : bytes;
+  if (bytes - skip <= 0)
+  {
+    return 0;
+  }
+  // The fifo is read in after room for a frame, the carry placed
+  // before it, decoding from the first byte aligned
+  uint8_t block[FRAME + fifo->size],
+          *start = block + FRAME - s->fifo_carried + skip;
+  memcpy(block + FRAME - s->fifo_carried, s->fifo_carry, s->fifo_carried);
+  if (i2c_read_into(s->i2c, s->i2c_addr, fifo->fifo_r, block + FRAME, bytes))
+  {
+    ERR("Failed to read fifo from 0x%02x.\n\n", s->i2c_addr);
+    return DEV_NOT_RESPOND;
+  }
+  int total = s->fifo_carried + bytes - skip,
+      frames = total / FRAME;
+  // Keep the bytes of a frame not yet whole for the next drain
+  s->fifo_carried = total % FRAME;
+  memcpy(s->fifo_carry, start + frames * FRAME, s->fifo_carried);
+  batch_decode(b, start, frames);
+  return 0;
+}
@@ -41,6 +41,22 @@ struct Mux {
   // the `fetch_channel` function, and is included
   // to avoid too frequent reads of the i2c muxes
   uint8_t channel;
+  // Set while channel is known to match the mux, so
+  // that selecting it again may be skipped
+  int cached;
+  // Read the channel back after this many selects,
+  // 0 never reading back
+  int verify_every;
+  // Another mux on the same bus, whose channels are
+  // disabled before any of this mux are selected
+  Mux *peer;
+  // Selections queued on the bus (I2C_TXN_MUX) as of
+  // the cache, any since leaving it stale
+  unsigned long queued;
+  // Selects asked of the mux, those skipped for the
+  // channel already being selected, writes made and
+  // those read back
+  unsigned long selects, skipped, writes, verifies;
   ///////////////////////////////////////////////
   // Function to fetch and update current channel
   ChannelGet get_channel;
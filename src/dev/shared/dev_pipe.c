@@ -7,96 +7,75 @@
 
 #include <unistd.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "macros.h"
 #include "dev_sensor.h"
 
-// Contains copied path string to allow unlinking
+// Bytes written to the pipe for each reading, the parity then xyz
+#define PIPE_FRAME      (sizeof(int) + 3 * sizeof(short))
+
+// Handed to the sink of the stream, kept until the pipe is closed
 struct PipeInfo {
+  // Copied path string to allow unlinking
   char *path;
-  Sensor *s;
+  // Handle to write to the fifo
+  int fd;
+  // Maintain a parity value
+  int par;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
-// IO READ LOOP
+// PIPE SINK
 ///////////////////////////////////////////////////////////////////////////////
 
-// Starts the thread that will pipe the readings
-void *dev_pipe_start(void *arg)
+// Writes each batch the stream drains into the fifo
+static void pipe_sink(Sensor *s, SampleBatch *b, void *arg)
 {
-  // Cast a sensor pointer from the given args
-  Sensor *s = ((struct PipeInfo*)arg)->s;
-  // Maintain a parity bit
-  int par = 0;
-  // Verify pointer
-  if (s == NULL)
+  struct PipeInfo *info = arg;
+  // The frames written out, at most a batch
+  uint8_t frames[DEV_BATCH_SAMPLES * PIPE_FRAME], *frame = frames;
+  // Lay out each reading as the parity then its three values
+  for (int j = 0; j < b->count; j++, frame += PIPE_FRAME)
   {
-    // Print error
-    ERR("Sensor pointer no longer valid.\n\n");
+    short vals[3] = {b->x[j], b->y[j], b->z[j]};
+    memcpy(frame, &info->par, sizeof(int));
+    memcpy(frame + sizeof(int), vals, sizeof(vals));
+    // Increment the parity value to preserve lockstep
+    info->par++;
   }
-  int i = 0;
-  // Start loop
-  while (s->pipe_running && i++ < 100)
+  // Write the readings into the fifo in one go
+  if (write(info->fd, frames, frame - frames) < 0)
   {
-    // If the sensor fifo buffer capacity is over 75%
-    if (s->fifo_capacity(s) > 0.75)
-    {
-      // Read from the fifo buffer
-      Axes *ax = s->read(s, FIFO),
-           *crrt = ax;
-      // Iterate through the axes
-      while (crrt)
-      {
-        // Write parity
-        write(s->wpipe, (void*)&(par), sizeof(int));
-        // Load next three values into array
-        short vals[3] = {crrt->x, crrt->y, crrt->z};
-        // Write the readings into the fifo
-        write(s->wpipe, (void*)vals, sizeof(short) * 3);
-        // Move to next reading
-        crrt = crrt->next;
-        // Increment the parity value to preserve lockstep
-        par++;
-      }
-      // Deallocate the axes struct
-      axes_dealloc(&ax);
-    }
-    // Pause the thread
-    nanosleep((struct timespec[]) {{0, 50000000}}, NULL);
+    // Nobody reading, or reading too slowly, loses the readings
   }
-  // Unlink the fifo
-  unlink(((struct PipeInfo*)arg)->path);
-  // Quit thread
-  pthread_exit(0);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // PIPE INITIALISATION
 ///////////////////////////////////////////////////////////////////////////////
 
-// Takes a Sensor struct pointer and creates a fifo access point
-int dev_pipe(Sensor *s, const char* _path)
+// Takes a Sensor struct pointer and creates a fifo access point, then
+// streams readings into it until dev_pipe_close. Returns 0 once the
+// stream has started, else an error code.
+int dev_pipe(Sensor *s, const char* path)                          // dev_pipe
+{
+  return dev_pipe_irq(s, path, NULL);
+}
+
+// As dev_pipe, draining as the INT line of the sensor signals data
+// ready when given one, else by time
+int dev_pipe_irq(Sensor *s,                                      // dev_pipe_irq
+                 const char* path,
+                 GpioEvent *line)
 {
-  // If the pipe is enabled
-  if (s->pipe_running)
+  // Close any pipe already running
+  if (s->stream)
   {
-    // Cancel the pipe if currently running
-    s->pipe_running = pthread_cancel(*(s->pipe_thread));
-    // Check cancellation was a success
-    if (s->pipe_running)
-    {
-      // Output error message
-      ERR("Thread failed to cancel. Pipe may still be running.\n\n");
-      // Exit from error
-      exit(EXIT_FAILURE);
-    }
+    dev_pipe_close(s);
   }
-  // Make a copy of the fifo path
-  char path[strlen(_path) + 1];
-  strcpy(path, _path);
   // Make the fifo page
   if (mkfifo(path, 0666))
   {
@@ -105,10 +84,10 @@ int dev_pipe(Sensor *s, const char* _path)
     // Exit with failure
     exit(EXIT_FAILURE);
   }
-  // Open the new fifo for write only
+  // Open the new fifo for read and write, so as not to block
   int fifo = open(path, O_RDWR);
   // Check successful open
-  if (!fifo)
+  if (fifo < 0)
   {
     // Print error message
     ERR("Unable to create fifo at `%s`\n\n", path);
@@ -117,25 +96,45 @@ int dev_pipe(Sensor *s, const char* _path)
   }
   // Use fcntl to make access non-blocking
   fcntl(fifo, F_SETFL, fcntl(fifo, F_GETFL) | O_NONBLOCK);
-  // Assign fifo handle to the sensor
-  s->wpipe = fifo;
-  // Start the new thread
-  int err = pthread_create( s->pipe_thread, 
-                            NULL, 
-                            &dev_pipe_start, 
-                            (void*)&((struct PipeInfo){path, s}) );
-  // If the error code is non-zero
-  if (err)
+  // Keep a copy of the path and the handle for the sink
+  struct PipeInfo *info = malloc(sizeof(struct PipeInfo));
+  if (!info || !(info->path = malloc(strlen(path) + 1)))
   {
-    // Print error
-    ERR("Thread creation failed with error (%d)\n\n", err);
-    // Exit with failure
+    ERR("Failed to allocate memory (malloc) for PipeInfo.\n\n");
     exit(EXIT_FAILURE);
   }
-  // Set pipe_running to true
-  s->pipe_running = !err;
-  // Run thread and wait for execution to finish
-  pthread_join(*(s->pipe_thread), 0);
-  // Return success
+  strcpy(info->path, path);
+  info->fd = fifo;
+  info->par = 0;
+  // Start streaming into the fifo
+  int err = line
+    ? dev_stream_start_irq(s, line, DEV_STREAM_FILL, &pipe_sink, info)
+    : dev_stream_start(s, DEV_STREAM_FILL, &pipe_sink, info);
+  if (err)
+  {
+    close(fifo);
+    unlink(info->path);
+    free(info->path);
+    free(info);
+  }
+  return err;
+}
+
+// Stop streaming into the fifo, then close and remove it. Returns 0,
+// or DEV_INVALID_HANDLE if not piping.
+int dev_pipe_close(Sensor *s)                                  // dev_pipe_close
+{
+  // The sink of a pipe always has its PipeInfo
+  if (!s->stream || (s->stream->sink != &pipe_sink))
+  {
+    return DEV_INVALID_HANDLE;
+  }
+  struct PipeInfo *info = s->stream->arg;
+  // Stop the stream first, the sink writing to the fifo
+  dev_stream_stop(s);
+  close(info->fd);
+  unlink(info->path);
+  free(info->path);
+  free(info);
   return 0;
 }
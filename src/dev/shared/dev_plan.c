@@ -0,0 +1,180 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: dev_plan.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include "macros.h"
+#include "dev_sensor.h"
+#include "dev_mux.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// BUS BANDWIDTH PLANNING
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Sensors streaming through their fifos share the bus, and past a
+   point the bus cannot drain them as fast as they fill. That point
+   is known from the configuration alone, so rather than finding out
+   from overflowed fifos the plan is made before streaming starts.
+
+   Each drain of a sensor costs the mux selection, the interrupt
+   status read (for overflows), the fifo count read, and the
+   register write ahead of the data, whatever the data. The mux
+   keeps the channel selected (see pca_conf.c), so the selection
+   costs only the read back made once every verify_every selects
+   where every sensor planned shares a channel. Otherwise each drain
+   is also taken to switch channel, with a write to any peer mux. On
+   top of that comes the data itself, 9 bits on the wire for each
+   byte. Draining every T seconds then takes the bus for
+
+       A + B.T    where A is the fixed cost and B the share of the
+                  bus the data takes
+
+   so the utilisation is A/T + B, and the bus keeps up for any T
+   above A/(1 - B). A fifo fills in F seconds, and may take up fill
+   of that between drains, including the drain cycle itself, so T
+   may be no longer than (fill.F - A)/(1 + B).
+
+   Each transfer also pays for the software around it (queueing, the
+   status polls or the syscall), allowed for as a fixed gap.
+*/
+
+// Time allowed between transfers for the software driving them
+#define PLAN_GAP_S    25e-6
+// Utilisation above which a plan is warned against
+#define PLAN_WARN     0.7
+
+// Seconds on the wire for a transfer of w bytes written then r read
+// (by repeated start), at hz
+static double txn_s(unsigned hz, int w, int r)
+{
+  // The start, address byte and each byte, then the stop
+  unsigned bits = 1 + 9 + 9 * (w + r) + 1;
+  // A read after a write goes as another start and address
+  if (w && r)
+  {
+    bits += 1 + 9;
+  }
+  return (double)bits / hz + PLAN_GAP_S;
+}
+
+// Plan the draining of the count sensors' fifos every interval_s,
+// with fill the share of a fifo that may fill between drains.
+// Returns DEV_OVER_CAPACITY should the bus not keep up, else 0.
+int dev_plan(Sensor **s,                                            // dev_plan
+             int count,
+             double interval_s,
+             double fill,
+             DevPlan *plan)
+{
+  // Shortest time for any fifo to fill, in seconds
+  double fill_s = 0;
+  // Whether the sensors are spread over more than one mux channel
+  int switching = 0;
+  for (int i = 1; i < count; i++)
+  {
+    switching |= (s[i]->mux != s[0]->mux) ||
+                 (s[i]->mux && (s[i]->mux_channel != s[0]->mux_channel));
+  }
+  *plan = (DevPlan) { .interval_s = interval_s };
+  for (int i = 0; i < count; i++)
+  {
+    DevLoad load;
+    // Select the sensor's channel to fetch its configuration
+    if (s[i]->mux && s[i]->mux->set_channel(s[i]->mux, s[i]->mux_channel))
+    {
+      return DEV_NOT_RESPOND;
+    }
+    if (!s[i]->load || s[i]->load(s[i], &load))
+    {
+      ERR("Failed to fetch the configuration of 0x%02x.\n\n",
+          s[i]->i2c_addr);
+      return DEV_NOT_RESPOND;
+    }
+    unsigned hz = i2c_get_dev_clock(s[i]->i2c, s[i]->i2c_addr);
+    // The mux selection, should the channel change between drains
+    Mux *m = s[i]->mux;
+    if (m)
+    {
+      unsigned mux_hz = i2c_get_dev_clock(s[i]->i2c, m->i2c_addr);
+      if (switching)
+      {
+        plan->fixed_s += txn_s(mux_hz, 1, 0) * (m->peer ? 2 : 1);
+      }
+      // The read back, made every verify_every selects whether or
+      // not the channel changes
+      if (m->verify_every)
+      {
+        plan->fixed_s += txn_s(mux_hz, 0, 1) / m->verify_every;
+      }
+    }
+    // The interrupt status read, the fifo count read, and the
+    // register write before the data
+    plan->fixed_s += txn_s(hz, 1, 1) + txn_s(hz, 1, 2) + txn_s(hz, 1, 0);
+    // A disabled fifo puts no data on the bus
+    double bytes_hz = load.sample_hz * load.frame_bytes;
+    if (bytes_hz > 0)
+    {
+      plan->data_share += 9 * bytes_hz / hz;
+      double f = load.fifo_bytes / bytes_hz;
+      fill_s = (fill_s && (fill_s < f)) ? fill_s : f;
+    }
+  }
+  // Whether the bus can keep up at all
+  plan->min_interval_s = (plan->data_share < 1)
+    ? plan->fixed_s / (1 - plan->data_share) : -1;
+  // Without data no fifo fills, so any interval will do
+  plan->max_interval_s = fill_s
+    ? (fill * fill_s - plan->fixed_s) / (1 + plan->data_share) : -1;
+  if (fill_s && (plan->max_interval_s < 0))
+  {
+    plan->max_interval_s = 0;
+  }
+  plan->utilisation = plan->fixed_s / interval_s + plan->data_share;
+  // Over capacity should the bus be saturated, or a fifo overflow
+  plan->over = (plan->min_interval_s < 0) || (plan->utilisation >= 1) ||
+               (fill_s && (interval_s > plan->max_interval_s));
+  plan->warn = !plan->over && (plan->utilisation > PLAN_WARN);
+  return plan->over ? DEV_OVER_CAPACITY : 0;
+}
+
+// Print the plan to stdout
+void dev_plan_print(DevPlan *plan)                            // dev_plan_print
+{
+  printf("  Fixed cost per drain : %8.1f us\n", plan->fixed_s * 1e6);
+  printf("  Bus share of data    : %8.1f %%\n", plan->data_share * 100);
+  printf("  Drain interval       : %8.1f ms\n", plan->interval_s * 1e3);
+  printf("  Bus utilisation      : %8.1f %%\n", plan->utilisation * 100);
+  // Negative bounds stand for none
+  if (plan->min_interval_s < 0)
+  {
+    printf("  Shortest interval    :     none\n");
+  }
+  else
+  {
+    printf("  Shortest interval    : %8.1f ms\n", plan->min_interval_s * 1e3);
+  }
+  if (plan->max_interval_s < 0)
+  {
+    printf("  Longest interval     :      any\n\n");
+  }
+  else
+  {
+    printf("  Longest interval     : %8.1f ms\n\n",
+           plan->max_interval_s * 1e3);
+  }
+  if (plan->over)
+  {
+    ERR("The bus cannot drain the fifos at this rate.\n\n");
+  }
+  else if (plan->warn)
+  {
+    printf("Warning: the bus is close to capacity.\n\n");
+  }
+  else
+  {
+    PRINTC(GREEN, "The bus has capacity to spare.\n\n");
+  }
+}
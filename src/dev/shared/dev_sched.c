@@ -0,0 +1,431 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: dev_sched.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "macros.h"
+#include "dev_sensor.h"
+#include "dev_mux.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// BOARD SCHEDULING
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Each fifo reaches the target fill at a time set by its own rate,
+   its deadline. Rather than draining every sensor each interval, a
+   thread for each bus drains whichever sensor's deadline falls
+   first, sleeping until then (earliest deadline first). A sensor
+   drained is next due once its fifo has filled to the target again.
+
+   Switching a mux channel costs a transfer. So once a sensor is
+   drained, others on the same channel are drained alongside it, if
+   they would be due within half their fill time. Where deadlines
+   tie, the channel already selected goes first.
+
+   The samples drained are stamped (see batch_stamp) and held for
+   each sensor. A frame is made for every period of the slowest
+   sensor, once every sensor has a sample at or past its time. Each
+   sensor gives the sample nearest that time. A sensor that falls
+   behind, as one failing to respond would, holds frames back only
+   for twice the longest fill time. After that the frame is made
+   with its last sample, and counted as late. One that has given no
+   sample at all is marked missing from the frame.
+*/
+
+// Monotonic clock in nanoseconds
+static uint64_t now_ns(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// Nanoseconds for the fifo to fill to fill, half a second if unknown.
+// Sets the sample period, 0 if unknown.
+static long fill_ns(Sensor *s, double fill, long *period_ns)
+{
+  DevLoad load;
+  *period_ns = 0;
+  if (!s->load || s->load(s, &load) || (load.sample_hz <= 0) ||
+      !load.frame_bytes || !load.fifo_bytes)
+  {
+    return 500000000;
+  }
+  *period_ns = (long)(1e9 / load.sample_hz);
+  double ns = 1e9 * fill * load.fifo_bytes /
+              (load.sample_hz * load.frame_bytes);
+  // No sooner than a sample is taken
+  return (ns > *period_ns) ? (long)ns : *period_ns;
+}
+
+// Identifies the mux channel of the sensor, -1 if not behind a mux
+static int channel_of(Sensor *s)
+{
+  return s->mux ? ((s->mux->i2c_addr << 8) | s->mux_channel) : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ALIGNMENT
+///////////////////////////////////////////////////////////////////////////////
+
+// Hold the samples of the batch for the sensor, dropping the oldest
+// should there be no room. Called with the schedule locked.
+static void hold(DevSchedSensor *d, SampleBatch *b)
+{
+  for (int i = 0; i < b->count; i++)
+  {
+    if (d->held == DEV_SCHED_HISTORY)
+    {
+      d->head = (d->head + 1) % DEV_SCHED_HISTORY;
+      d->held--;
+    }
+    int k = (d->head + d->held++) % DEV_SCHED_HISTORY;
+    d->t_ns[k] = b->t_ns[i];
+    d->x[k] = b->x[i];
+    d->y[k] = b->y[i];
+    d->z[k] = b->z[i];
+  }
+}
+
+// Time of the nth sample held by the sensor
+#define HELD_T(d, n) ((d)->t_ns[((d)->head + (n)) % DEV_SCHED_HISTORY])
+
+// Take the sample nearest t into the frame, forgetting those before
+// it. A sensor holding no samples is marked missing.
+static void take_nearest(DevSchedSensor *d, uint64_t t, DevFrame *f, int i)
+{
+  int n = 0;
+  f->missing[i] = !d->held;
+  if (!d->held)
+  {
+    f->x[i] = f->y[i] = f->z[i] = 0;
+    return;
+  }
+  while ((n + 1 < d->held) && (HELD_T(d, n + 1) <= t))
+  {
+    n++;
+  }
+  // The sample after may be nearer
+  if ((n + 1 < d->held) && (HELD_T(d, n) <= t) &&
+      (HELD_T(d, n + 1) - t < t - HELD_T(d, n)))
+  {
+    n++;
+  }
+  d->head = (d->head + n) % DEV_SCHED_HISTORY;
+  d->held -= n;
+  f->x[i] = d->x[d->head];
+  f->y[i] = d->y[d->head];
+  f->z[i] = d->z[d->head];
+}
+
+// Make every frame the samples held allow. Called with the schedule
+// locked.
+static void align(DevSched *sched)
+{
+  DevFrame f;
+  uint64_t now = now_ns(), oldest = 0, earliest = UINT64_MAX,
+           newest = UINT64_MAX;
+  long lag_ns = 0;
+  for (int i = 0; i < sched->count; i++)
+  {
+    DevSchedSensor *d = &sched->sensors[i];
+    lag_ns = (d->fill_ns > lag_ns) ? d->fill_ns : lag_ns;
+    // A sensor without samples leaves every frame waiting on it
+    if (!d->held)
+    {
+      newest = 0;
+      continue;
+    }
+    uint64_t first = HELD_T(d, 0), last = HELD_T(d, d->held - 1);
+    oldest = (first > oldest) ? first : oldest;
+    earliest = (first < earliest) ? first : earliest;
+    newest = (last < newest) ? last : newest;
+  }
+  // Nothing to align until a sensor has a sample
+  if (!oldest)
+  {
+    return;
+  }
+  // The first frame at the latest first sample, once all have one or
+  // those without have been waited on long enough
+  if (!sched->next_ns)
+  {
+    if (!newest && (earliest + 2 * lag_ns >= now))
+    {
+      return;
+    }
+    sched->next_ns = oldest;
+  }
+  // Frames for which every sensor has a sample at or past, or which
+  // have waited long enough on those that have not
+  while ((sched->next_ns <= newest) || (sched->next_ns + 2 * lag_ns < now))
+  {
+    f.t_ns = sched->next_ns;
+    f.seq = sched->frames++;
+    f.count = sched->count;
+    sched->late += (sched->next_ns > newest);
+    for (int i = 0; i < sched->count; i++)
+    {
+      take_nearest(&sched->sensors[i], f.t_ns, &f, i);
+    }
+    if (sched->sink)
+    {
+      sched->sink(&f, sched->arg);
+    }
+    sched->next_ns += sched->frame_ns;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// EARLIEST DEADLINE FIRST
+///////////////////////////////////////////////////////////////////////////////
+
+// Drain the sensor, holding its samples to be aligned, and set when
+// it is next due
+static void drain(DevSchedBus *bus, DevSchedSensor *d, int *channel)
+{
+  DevSched *sched = bus->sched;
+  long period;
+  int c = channel_of(d->s);
+  if (c != *channel)
+  {
+    // The first selection is not a switch
+    bus->switches += (*channel != -2);
+    *channel = c;
+  }
+  int err = d->s->read_batch(d->s, FIFO, bus->batch);
+  // Worked out before taking the lock, as it may read the sensor
+  long fill = fill_ns(d->s, sched->fill, &period);
+  pthread_mutex_lock(&sched->lock);
+  if (!err && bus->batch->count)
+  {
+    hold(d, bus->batch);
+  }
+  // Set under the lock, align reading them from every bus thread
+  d->fill_ns = fill;
+  d->due_ns = now_ns() + fill;
+  align(sched);
+  pthread_mutex_unlock(&sched->lock);
+  d->drains++;
+  bus->drains++;
+}
+
+// Thread draining the sensors of one bus, earliest deadline first
+static void *sched_bus(void *arg)
+{
+  DevSchedBus *bus = arg;
+  DevSched *sched = bus->sched;
+  uint64_t end = now_ns() + (uint64_t)(sched->seconds * 1e9);
+  // The channel last selected, -2 for none yet
+  int channel = -2;
+  while (1)
+  {
+    // The earliest deadline, ties going to the channel selected
+    DevSchedSensor *d = NULL;
+    for (int i = 0; i < bus->count; i++)
+    {
+      DevSchedSensor *o = &sched->sensors[bus->sensors[i]];
+      if (!d || (o->due_ns < d->due_ns) ||
+          ((o->due_ns == d->due_ns) && (channel_of(o->s) == channel)))
+      {
+        d = o;
+      }
+    }
+    if (d->due_ns >= end)
+    {
+      // Drain what every fifo has left, for the frames up to the end
+      for (int i = 0; i < bus->count; i++)
+      {
+        drain(bus, &sched->sensors[bus->sensors[i]], &channel);
+      }
+      break;
+    }
+    struct timespec until = { d->due_ns / 1000000000ull,
+                              d->due_ns % 1000000000ull };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL));
+    drain(bus, d, &channel);
+    // Drain those on the channel due soon, while it is selected
+    uint64_t now = now_ns();
+    for (int i = 0; i < bus->count; i++)
+    {
+      DevSchedSensor *o = &sched->sensors[bus->sensors[i]];
+      if ((o != d) && (channel_of(o->s) == channel) &&
+          (o->due_ns < now + o->fill_ns / 2))
+      {
+        drain(bus, o, &channel);
+        o->grouped++;
+      }
+    }
+  }
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SCHEDULES
+///////////////////////////////////////////////////////////////////////////////
+
+// Malloc a schedule that lets each fifo fill to fill between drains,
+// runs for seconds and hands each frame aligned to the sink
+DevSched *dev_sched_malloc(double fill,                    // dev_sched_malloc
+                           double seconds,
+                           DevFrameSink sink,
+                           void *arg)
+{
+  DevSched *sched = calloc(1, sizeof(DevSched));
+  if (!sched)
+  {
+    ERR("Failed to allocate memory (malloc) for DevSched.\n\n");
+    exit(EXIT_FAILURE);
+  }
+  sched->fill = fill;
+  sched->seconds = seconds;
+  sched->sink = sink;
+  sched->arg = arg;
+  pthread_mutex_init(&sched->lock, NULL);
+  return sched;
+}
+
+// Dealloc the schedule and null up in stack
+void dev_sched_dealloc(DevSched **sched)                  // dev_sched_dealloc
+{
+  pthread_mutex_destroy(&(*sched)->lock);
+  free(*sched);
+  *sched = NULL;
+}
+
+// Add the sensor to the schedule, on the bus it shares with any
+// added before. Returns 0, else DEV_INVALID_HANDLE should there be
+// more sensors or buses than a schedule can take.
+int dev_sched_add(DevSched *sched, Sensor *s)                 // dev_sched_add
+{
+  int b = 0;
+  while ((b < sched->buses) && (sched->bus[b].i2c != s->i2c))
+  {
+    b++;
+  }
+  if (b == DEV_ACQ_BUSES)
+  {
+    ERR("Cannot schedule more than %d buses.\n\n", DEV_ACQ_BUSES);
+    return DEV_INVALID_HANDLE;
+  }
+  DevSchedBus *bus = &sched->bus[b];
+  if ((b < sched->buses) && (bus->count == DEV_ACQ_SENSORS))
+  {
+    ERR("Cannot schedule more than %d sensors on a bus.\n\n",
+        DEV_ACQ_SENSORS);
+    return DEV_INVALID_HANDLE;
+  }
+  if (b == sched->buses)
+  {
+    *bus = (DevSchedBus) { .i2c = s->i2c, .sched = sched };
+    sched->buses++;
+  }
+  bus->sensors[bus->count++] = sched->count;
+  sched->sensors[sched->count++] = (DevSchedSensor) { .s = s };
+  return 0;
+}
+
+// Plan the schedule, refusing it should any bus be unable to keep
+// its fifos from overflowing. Returns 0, else DEV_OVER_CAPACITY or
+// DEV_NOT_RESPOND, having printed the plan refused.
+int dev_sched_plan(DevSched *sched)                          // dev_sched_plan
+{
+  int err = 0;
+  long period, slowest = 0;
+  // Every sensor is due at once, to empty its fifo of stale samples
+  uint64_t now = now_ns();
+  for (int i = 0; i < sched->count; i++)
+  {
+    DevSchedSensor *d = &sched->sensors[i];
+    d->fill_ns = fill_ns(d->s, sched->fill, &period);
+    d->due_ns = now;
+    slowest = (period > slowest) ? period : slowest;
+  }
+  // A frame for each sample of the slowest sensor
+  sched->frame_ns = slowest ? slowest : 1000000;
+  // Refuse should any bus be unable to keep its fifos from overflowing,
+  // taking the shortest fill time on it as the interval
+  for (int b = 0; b < sched->buses; b++)
+  {
+    DevPlan plan;
+    DevSchedBus *bus = &sched->bus[b];
+    Sensor *sensors[DEV_ACQ_SENSORS];
+    long interval = 0;
+    for (int i = 0; i < bus->count; i++)
+    {
+      DevSchedSensor *d = &sched->sensors[bus->sensors[i]];
+      sensors[i] = d->s;
+      interval = (!interval || (d->fill_ns < interval)) ? d->fill_ns
+                                                        : interval;
+    }
+    if ((err = dev_plan(sensors, bus->count, interval / 1e9, 1, &plan)))
+    {
+      dev_plan_print(&plan);
+      return err;
+    }
+  }
+  return 0;
+}
+
+// Drain the sensors for the seconds of the schedule, a thread for
+// each bus, emitting frames as they are aligned. Returns 0 once done,
+// else an error code should the schedule be refused.
+int dev_sched_run(DevSched *sched)                            // dev_sched_run
+{
+  int err = dev_sched_plan(sched);
+  if (err)
+  {
+    return err;
+  }
+  // Start the thread of each bus, then wait on them all
+  int started = 0;
+  for (; started < sched->buses; started++)
+  {
+    DevSchedBus *bus = &sched->bus[started];
+    bus->batch = batch_malloc(DEV_BATCH_SAMPLES);
+    if ((err = pthread_create(&bus->thread, NULL, &sched_bus, bus)))
+    {
+      ERR("Thread creation failed with error (%d)\n\n", err);
+      batch_dealloc(&bus->batch);
+      break;
+    }
+  }
+  for (int b = 0; b < started; b++)
+  {
+    pthread_join(sched->bus[b].thread, NULL);
+    batch_dealloc(&sched->bus[b].batch);
+  }
+  return err;
+}
+
+// Print what each sensor and bus of the schedule did
+void dev_sched_print(DevSched *sched)                       // dev_sched_print
+{
+  printf("  Sensor | Bus | Mux  | Chan | Addr | Drains | Grouped | Lost\n");
+  for (int b = 0; b < sched->buses; b++)
+  {
+    DevSchedBus *bus = &sched->bus[b];
+    for (int i = 0; i < bus->count; i++)
+    {
+      DevSchedSensor *d = &sched->sensors[bus->sensors[i]];
+      Sensor *s = d->s;
+      printf("  %-6d | %3d | 0x%02x | %4d | 0x%02x | %6lu | %7lu | %4lu\n",
+             bus->sensors[i], b, s->mux ? s->mux->i2c_addr : 0,
+             s->mux ? s->mux_channel : -1, s->i2c_addr, d->drains,
+             d->grouped, s->fifo_stats.frames_lost);
+    }
+  }
+  printf("\n");
+  for (int b = 0; b < sched->buses; b++)
+  {
+    printf("  Bus %d : %lu drains, %lu channel switches\n", b,
+           sched->bus[b].drains, sched->bus[b].switches);
+  }
+  printf("\n  %lu frames every %.2fms, %lu late\n\n", sched->frames,
+         sched->frame_ns / 1e6, sched->late);
+}
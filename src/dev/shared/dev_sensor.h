@@ -33,14 +33,16 @@ typedef void          (*DeallocSensor)(Sensor**);
 typedef int           (*SensorConfigure)(Sensor*, char*);
 // Typedef for a device reset function
 typedef void          (*SensorReset)(Sensor*);
-// Typedef for a device read burst function
-typedef Axes*         (*ReadBurst)(Sensor*);
+// Function to fill a batch with readings from the given target
+typedef int           (*ReadBatch)(Sensor*, target_t, SampleBatch*);
 // Typedef for a selftest function
 typedef int           (*Selftest)(Sensor*, int);
 // Sensor pipe
 typedef int           (*SensorPipe)(Sensor*, const char*);
 // Get's current fifo capacity
 typedef float         (*SensorFifoCapcity)(Sensor*);
+// Fills the load the sensor's fifo puts on the bus
+typedef int           (*SensorLoad)(Sensor*, DevLoad*);
 
 /////////////////////////////////////////////////////////////
 // Struct Typedefs   ////////////////////////////////////////
@@ -70,13 +72,28 @@ struct Sensor {                                           // Sensor
   Mux *mux;
   // Specifies the i2c channel
   short mux_channel;
+  // Code of the first failed transfer since last cleared, else 0
+  int io_error;
   ///////////////////////////////////////////////
-  // The handle to write to the pipe file
-  int wpipe;
-  // A status int for whether the thread is active
-  int pipe_running;
-  // Keeps a pointer to the pipe thread
-  pthread_t *pipe_thread;
+  // Shadow of the configuration registers, written through
+  uint8_t shadow[256];
+  // Bitmaps of the registers held in the shadow, and of those
+  // whose write has not yet reached the device
+  uint8_t shadow_valid[32], shadow_dirty[32];
+  // Bits of each register that clear themselves once written,
+  // and so are never kept in the shadow
+  const uint8_t *self_clearing;
+  ///////////////////////////////////////////////
+  // Bytes of a frame read from the fifo, the rest still to come
+  uint8_t fifo_carry[6];
+  int fifo_carried;
+  // When the fifo was last drained, in monotonic nanoseconds
+  uint64_t fifo_drained_ns;
+  // What has gone wrong draining the fifo
+  DevFifoStats fifo_stats;
+  ///////////////////////////////////////////////
+  // The stream draining the sensor, NULL unless streaming
+  DevStream *stream;
   ///////////////////////////////////////////////
   // Function to reset the default config
   SensorReset reset;                                      // RESET
@@ -84,6 +101,8 @@ struct Sensor {                                           // Sensor
   SensorBypass i2c_bypass;                                // I2C_BYPASS
   // Function to read axes data from given target
   ReadAxes read;                                          // READ
+  // Function to read into a batch from given target
+  ReadBatch read_batch;                                   // READ_BATCH
   // Function to configure sensor
   SensorConfigure config;                                 // CONFIG
   // Function for selftesting
@@ -92,6 +111,8 @@ struct Sensor {                                           // Sensor
   SensorPipe pipe;                                        // PIPE
   // Function to determine current fifo capacity
   SensorFifoCapcity fifo_capacity;                        // FIFO_CAPACITY
+  // Function to fetch the load on the bus as configured
+  SensorLoad load;                                        // LOAD
   // Dealloc function
   DeallocSensor dealloc;                                  // DEALLOC
 };
@@ -0,0 +1,354 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: dev_stream.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include "macros.h"
+#include "dev_sensor.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// STREAMING
+///////////////////////////////////////////////////////////////////////////////
+/*
+   A stream drains a sensor's fifo from a thread of its own until
+   stopped, handing each batch to a sink. Rather than polling the
+   fifo level, the thread sleeps for as long as the fifo takes to
+   reach the target fill at the configured rate, worked out afresh
+   from the configuration (held in the register shadow) before each
+   sleep, so a change of sample rate mid stream is followed. Should
+   a drain fill the batch, more may be waiting and the fifo is
+   drained again straight away.
+
+   The thread waits on a condition rather than sleeping, so that a
+   stop wakes it at once and it returns of its own accord, leaving
+   nothing half done as pthread_cancel might.
+
+   Given the INT line of the sensor, a stream instead blocks in poll
+   on the line, and on a pipe written to stop it. With data ready
+   enabled the sensor pulses the line once a sample, so counting the
+   edges counts the frames in the fifo without asking the bus, and
+   the fifo is drained only once they reach the target fill. A fill
+   of 0 drains on every sample, for the least latency. Should edges
+   go missing (sysfs merges those it is too slow to report) the fifo
+   is drained all the same, once it would be midway between the
+   target fill and full.
+*/
+
+// Monotonic clock in nanoseconds
+static uint64_t now_ns(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// Nanoseconds for the fifo to reach fill as configured, within the
+// bounds of a stream. Sets the load, with no fifo bytes if unknown.
+static long fill_interval(DevStream *st, double fill, DevLoad *load)
+{
+  Sensor *s = st->s;
+  // Without a rate, or a fifo, look again at the longest interval
+  if (!s->load || s->load(s, load) ||
+      (load->sample_hz <= 0) || !load->frame_bytes || !load->fifo_bytes)
+  {
+    load->fifo_bytes = 0;
+    return DEV_STREAM_MAX_NS;
+  }
+  double ns = 1e9 * fill * load->fifo_bytes /
+              (load->sample_hz * load->frame_bytes);
+  return (ns < DEV_STREAM_MIN_NS) ? DEV_STREAM_MIN_NS :
+         (ns > DEV_STREAM_MAX_NS) ? DEV_STREAM_MAX_NS : (long)ns;
+}
+
+// Drain the fifo into the sink, then work out when it will next be
+// at the target fill. Returns 1 should frames have been left behind.
+// Called, and returns, with the stream locked.
+static int drain(DevStream *st, DevLoad *load, long *interval)
+{
+  Sensor *s = st->s;
+  SampleBatch *b = st->batch;
+  pthread_mutex_unlock(&st->lock);
+  int err = s->read_batch(s, FIFO, b);
+  *interval = fill_interval(st, st->fill, load);
+  if (!err && b->count && st->sink)
+  {
+    st->sink(s, b, st->arg);
+  }
+  pthread_mutex_lock(&st->lock);
+  st->stats.fifo = s->fifo_stats;
+  st->stats.drains++;
+  st->stats.interval_ns = *interval;
+  if (err)
+  {
+    st->stats.failures++;
+  }
+  else if (!b->count)
+  {
+    st->stats.empty++;
+  }
+  else
+  {
+    st->stats.samples += b->count;
+    // Frames are 6 bytes, as read_batch assumes
+    double fill = load->fifo_bytes ? 6.0 * b->count / load->fifo_bytes : 0;
+    st->stats.peak_fill = (fill > st->stats.peak_fill)
+      ? fill : st->stats.peak_fill;
+  }
+  // A full batch may have left frames behind
+  return !err && (b->count == b->capacity);
+}
+
+// Thread draining the fifo of the stream's sensor each interval
+// until stopped
+static void *stream_run(void *arg)
+{
+  DevStream *st = arg;
+  DevLoad load;
+  long interval;
+  uint64_t next = now_ns();
+  pthread_mutex_lock(&st->lock);
+  while (st->running)
+  {
+    // Drain again at once should frames have been left behind
+    if (drain(st, &load, &interval))
+    {
+      next = now_ns();
+      continue;
+    }
+    // Sleep until due, or until stopped
+    next += interval;
+    struct timespec until = { next / 1000000000ull, next % 1000000000ull };
+    while (st->running &&
+           (pthread_cond_timedwait(&st->wake, &st->lock, &until) !=
+            ETIMEDOUT));
+    st->stats.wakeups++;
+    // Having fallen behind, start afresh from now
+    uint64_t now = now_ns();
+    next = (next + interval < now) ? now : next;
+  }
+  pthread_mutex_unlock(&st->lock);
+  return NULL;
+}
+
+// Thread draining the fifo of the stream's sensor as its interrupt
+// line counts the target fill, until stopped
+static void *stream_run_irq(void *arg)
+{
+  DevStream *st = arg;
+  DevLoad load, backstop;
+  long interval;
+  struct pollfd fds[2];
+  fds[0].fd = gpio_event_poll_fd(st->line, &fds[0].events);
+  fds[1] = (struct pollfd) { .fd = st->stop[0], .events = POLLIN };
+  // Frames the edges say are waiting in the fifo, and when the fifo
+  // is drained regardless
+  unsigned long pending = 0;
+  uint64_t due = 0;
+  pthread_mutex_lock(&st->lock);
+  while (st->running)
+  {
+    uint64_t now = now_ns();
+    // Drain on the backstop, the first time round emptying the fifo
+    // of whatever it held before the stream
+    if (now < due)
+    {
+      pthread_mutex_unlock(&st->lock);
+      int edges = 0,
+          ready = poll(fds, 2, (int)((due - now + 999999) / 1000000));
+      // Count the edges, unless woken to stop
+      if ((ready > 0) && fds[0].revents && !fds[1].revents)
+      {
+        edges = gpio_event_clear(st->line);
+      }
+      pthread_mutex_lock(&st->lock);
+      st->stats.wakeups++;
+      // A line in error is left to the backstop
+      if (edges > 0)
+      {
+        st->stats.edges += edges;
+        pending += edges;
+      }
+      // Wait on for edges to fill the fifo to the target
+      if (!pending ||
+          (pending * load.frame_bytes < st->fill * load.fifo_bytes))
+      {
+        continue;
+      }
+    }
+    // Drain, again at once should frames have been left behind
+    while (drain(st, &load, &interval) && st->running);
+    pending = 0;
+    // Backstop midway between the target and a full fifo, in case
+    // edges go missing
+    due = now_ns() + fill_interval(st, (1 + st->fill) / 2, &backstop);
+  }
+  pthread_mutex_unlock(&st->lock);
+  return NULL;
+}
+
+// Start the stream, driven by time or, given one, the interrupt line
+static int stream_start(Sensor *s,
+                        GpioEvent *line,
+                        double fill,
+                        DevSink sink,
+                        void *arg)
+{
+  DevPlan plan;
+  DevLoad load;
+  pthread_condattr_t attr;
+  if (s->stream)
+  {
+    ERR("Already streaming from 0x%02x.\n\n", s->i2c_addr);
+    return DEV_INVALID_HANDLE;
+  }
+  DevStream *st = calloc(1, sizeof(DevStream));
+  if (!st)
+  {
+    ERR("Failed to allocate memory (malloc) for DevStream.\n\n");
+    exit(EXIT_FAILURE);
+  }
+  *st = (DevStream) { .s = s, .sink = sink, .arg = arg, .fill = fill,
+                      .line = line, .stop = { -1, -1 }, .running = 1 };
+  // Refuse should the bus be unable to drain the fifo before it
+  // overflows, draining at the target fill taking time of its own
+  long interval = fill_interval(st, fill, &load);
+  int err = dev_plan(&s, 1, interval / 1e9, 1, &plan);
+  if (err)
+  {
+    dev_plan_print(&plan);
+    ERR("Not streaming from 0x%02x, reduce the sample rate.\n\n",
+        s->i2c_addr);
+    free(st);
+    return err;
+  }
+  if (plan.warn)
+  {
+    dev_plan_print(&plan);
+  }
+  // The thread waiting on the line is stopped through a pipe
+  if (line && pipe(st->stop))
+  {
+    ERR("Failed to create the pipe to stop the stream.\n\n");
+    free(st);
+    return DEV_INVALID_HANDLE;
+  }
+  st->stats.interval_ns = interval;
+  st->batch = batch_malloc(DEV_BATCH_SAMPLES);
+  // Timed waits on the monotonic clock, immune to changes of time
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&st->wake, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_mutex_init(&st->lock, NULL);
+  s->stream = st;
+  if ((err = pthread_create(&st->thread, NULL,
+                            line ? &stream_run_irq : &stream_run, st)))
+  {
+    ERR("Thread creation failed with error (%d)\n\n", err);
+    s->stream = NULL;
+    pthread_cond_destroy(&st->wake);
+    pthread_mutex_destroy(&st->lock);
+    batch_dealloc(&st->batch);
+    if (line)
+    {
+      close(st->stop[0]);
+      close(st->stop[1]);
+    }
+    free(st);
+  }
+  return err;
+}
+
+// Start streaming from the sensor, handing each batch drained to
+// the sink. The fifo is drained as it reaches fill of its capacity.
+// Returns 0 once started, else an error code.
+int dev_stream_start(Sensor *s,                            // dev_stream_start
+                     double fill,
+                     DevSink sink,
+                     void *arg)
+{
+  return stream_start(s, NULL, fill, sink, arg);
+}
+
+// Start streaming from the sensor as dev_stream_start, but waiting
+// on the edges of its INT line, data ready being enabled, rather
+// than on time. The line stays the caller's to close, once stopped.
+int dev_stream_start_irq(Sensor *s,                    // dev_stream_start_irq
+                         GpioEvent *line,
+                         double fill,
+                         DevSink sink,
+                         void *arg)
+{
+  return stream_start(s, line, fill, sink, arg);
+}
+
+// Stop streaming from the sensor, returning once the thread has
+// finished. Returns 0, or DEV_INVALID_HANDLE if not streaming.
+int dev_stream_stop(Sensor *s)                              // dev_stream_stop
+{
+  DevStream *st = s->stream;
+  if (!st)
+  {
+    return DEV_INVALID_HANDLE;
+  }
+  // Wake the thread, which sees it is no longer running
+  pthread_mutex_lock(&st->lock);
+  st->running = 0;
+  pthread_cond_signal(&st->wake);
+  pthread_mutex_unlock(&st->lock);
+  if (st->line && (write(st->stop[1], "", 1) != 1))
+  {
+    ERR("Failed to wake the stream from 0x%02x.\n\n", s->i2c_addr);
+  }
+  pthread_join(st->thread, NULL);
+  s->stream = NULL;
+  if (st->line)
+  {
+    close(st->stop[0]);
+    close(st->stop[1]);
+  }
+  pthread_cond_destroy(&st->wake);
+  pthread_mutex_destroy(&st->lock);
+  batch_dealloc(&st->batch);
+  free(st);
+  return 0;
+}
+
+// Copy the statistics of the sensor's stream. Returns 0, or
+// DEV_INVALID_HANDLE if not streaming.
+int dev_stream_stats(Sensor *s, DevStreamStats *stats)     // dev_stream_stats
+{
+  DevStream *st = s->stream;
+  if (!st)
+  {
+    return DEV_INVALID_HANDLE;
+  }
+  pthread_mutex_lock(&st->lock);
+  *stats = st->stats;
+  pthread_mutex_unlock(&st->lock);
+  return 0;
+}
+
+// Print the statistics of a stream to stdout
+void dev_stream_print(DevStreamStats *stats)               // dev_stream_print
+{
+  printf("  Wakeups              : %8lu\n", stats->wakeups);
+  printf("  Interrupt edges      : %8lu\n", stats->edges);
+  printf("  Drains               : %8lu\n", stats->drains);
+  printf("  Found empty          : %8lu\n", stats->empty);
+  printf("  Failed               : %8lu\n", stats->failures);
+  printf("  Samples              : %8lu\n", stats->samples);
+  printf("  Peak fifo fill       : %8.1f %%\n", stats->peak_fill * 100);
+  printf("  Fifo overflows       : %8lu\n", stats->fifo.overflows);
+  printf("  Fifo resets          : %8lu\n", stats->fifo.resets);
+  printf("  Frames lost          : %8lu\n", stats->fifo.frames_lost);
+  printf("  Drain interval       : %8.1f ms\n\n", stats->interval_ns / 1e6);
+}
@@ -21,6 +21,8 @@ typedef volatile unsigned gpio_bus;
 typedef struct Pin Pin;
 // Define the Chip struct
 typedef struct Chip Chip;
+// Define the GpioEvent struct
+typedef struct GpioEvent GpioEvent;
 
 ///////////////////////////////////////////////////////////////////////////////
 // GPIO INTERFACE
@@ -56,4 +58,13 @@ void                printHeader();
 void                printPin(Pin *pin);
 void                printAll();
 
+/////////////////////////////////////////////////////////////
+// GPIO Edge Events /////////////////////////////////////////
+GpioEvent           *gpio_event_open(int gpio, const char *edge);
+GpioEvent           *gpio_event_fd(int fd);
+int                 gpio_event_wait(GpioEvent *e, int timeout_ms);
+int                 gpio_event_clear(GpioEvent *e);
+int                 gpio_event_poll_fd(GpioEvent *e, short *events);
+void                gpio_event_close(GpioEvent **e);
+
 #endif
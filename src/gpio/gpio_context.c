@@ -10,6 +10,9 @@
 #include <sys/mman.h>
 #include "raspi_peri.h"
 #include "macros.h"
+#ifdef TARGET_SIM
+#include "sim.h"
+#endif
 
 // Configure the memory access required to alter
 // the GPIO pins. Will request memory access from the system,
@@ -17,6 +20,10 @@
 // Based on example at http://elinux.org/RPi_Low-level_peripherals
 volatile unsigned* get_mmap(int base)                              // get_mmap
 {
+#ifdef TARGET_SIM
+  // Simulated builds never touch the hardware
+  return sim_mmap(base);
+#endif
   // Open system /dev/mem location for direct mem access
   int devmem = open("/dev/mem", O_RDWR|O_SYNC);
   // Verify mem access successful
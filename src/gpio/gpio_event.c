@@ -0,0 +1,182 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: gpio_event.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include "gpio_private.h"
+#include "macros.h"
+#ifdef TARGET_SIM
+#include "sim.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// GPIO EDGE EVENTS
+///////////////////////////////////////////////////////////////////////////////
+/*
+   The memory mapped registers can only be polled, so to sleep until
+   a line rises the kernel is asked to watch it through sysfs. Once
+   exported with an edge set, the value file of the line reports
+   POLLPRI on each edge, and is read back from the start to clear it.
+
+   Anything else able to hand over a file descriptor may stand in for
+   a line, an eventfd most usefully. Each write to it counts as that
+   many edges, and POLLIN is reported until it is read.
+
+   Should a line change several times before it is waited on, sysfs
+   reports a single edge. An eventfd reports every one.
+   Simulated builds have no sysfs, so opening a line hands over the
+   eventfd of the gyro model wired to it, raised once per sample.
+*/
+
+#ifndef TARGET_SIM
+// Where the kernel exposes the gpio lines
+#define SYSFS_GPIO "/sys/class/gpio"
+
+// Write the string to the sysfs file at path, returning 0 on success
+static int sysfs_write(const char *path, const char *str)
+{
+  int fd = open(path, O_WRONLY);
+  if (fd < 0)
+  {
+    return -1;
+  }
+  int written = write(fd, str, strlen(str));
+  close(fd);
+  return (written == (int)strlen(str)) ? 0 : -1;
+}
+#endif
+
+// Malloc an event around the file descriptor
+static GpioEvent *event_malloc(int fd, int gpio, int events)
+{
+  GpioEvent *e = malloc(sizeof(GpioEvent));
+  if (!e)
+  {
+    ERR("Memory allocation failed (malloc) of gpio event.\n\n");
+    exit(EXIT_FAILURE);
+  }
+  *e = (GpioEvent) { .fd = fd, .gpio = gpio, .events = events };
+  return e;
+}
+
+// Export the line gpio (as numbered by the BCM2835, not the header)
+// as an input, and watch it for edges - "rising", "falling" or
+// "both". Returns NULL should the kernel refuse.
+GpioEvent *gpio_event_open(int gpio, const char *edge)     // gpio_event_open
+{
+#ifdef TARGET_SIM
+  // Every edge a model raises is a rising one, whatever is asked
+  (void)edge;
+  int sim_fd = sim_gyro_int_fd(gpio);
+  if (sim_fd < 0)
+  {
+    ERR("No simulated gyro is wired to gpio %d.\n\n", gpio);
+    return NULL;
+  }
+  return gpio_event_fd(sim_fd);
+#else
+  char path[64], num[8];
+  snprintf(num, sizeof(num), "%d", gpio);
+  snprintf(path, sizeof(path), SYSFS_GPIO "/gpio%d/value", gpio);
+  // Export unless already exported, by us or another
+  if (access(path, F_OK) && sysfs_write(SYSFS_GPIO "/export", num))
+  {
+    ERR("Failed to export gpio %d.\n\n", gpio);
+    return NULL;
+  }
+  snprintf(path, sizeof(path), SYSFS_GPIO "/gpio%d/direction", gpio);
+  if (sysfs_write(path, "in"))
+  {
+    ERR("Failed to make gpio %d an input.\n\n", gpio);
+    return NULL;
+  }
+  snprintf(path, sizeof(path), SYSFS_GPIO "/gpio%d/edge", gpio);
+  if (sysfs_write(path, edge))
+  {
+    ERR("Failed to watch gpio %d for `%s` edges.\n\n", gpio, edge);
+    return NULL;
+  }
+  snprintf(path, sizeof(path), SYSFS_GPIO "/gpio%d/value", gpio);
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    ERR("Failed to open the value of gpio %d.\n\n", gpio);
+    return NULL;
+  }
+  // Clear the level as it stands, so only edges to come are seen
+  char level[4];
+  if (read(fd, level, sizeof(level)) < 0)
+  {
+    ERR("Failed to read the value of gpio %d.\n\n", gpio);
+  }
+  return event_malloc(fd, gpio, POLLPRI | POLLERR);
+#endif
+}
+
+// Take the file descriptor, an eventfd, as a stand-in for a line.
+// Writes to it are taken as edges, and it is closed with the event.
+GpioEvent *gpio_event_fd(int fd)                             // gpio_event_fd
+{
+  return event_malloc(fd, -1, POLLIN);
+}
+
+// Wait up to timeout_ms (forever if negative) for an edge. Returns
+// the edges seen, 0 on timeout, or -1 on error.
+int gpio_event_wait(GpioEvent *e, int timeout_ms)          // gpio_event_wait
+{
+  struct pollfd p = { .fd = e->fd, .events = e->events };
+  int ready = poll(&p, 1, timeout_ms);
+  if (ready <= 0)
+  {
+    return ready;
+  }
+  return gpio_event_clear(e);
+}
+
+// Clear any edges pending, returning how many there were, or -1 on
+// error. A stand-in cleared without an edge pending blocks.
+int gpio_event_clear(GpioEvent *e)                        // gpio_event_clear
+{
+  // An eventfd reads as the count of writes since the last read
+  if (e->gpio < 0)
+  {
+    uint64_t count;
+    return (read(e->fd, &count, sizeof(count)) == sizeof(count))
+      ? (int)count : -1;
+  }
+  // A line is read back from the start to acknowledge the edge
+  char level[4];
+  if ((lseek(e->fd, 0, SEEK_SET) < 0) || (read(e->fd, level, 4) < 0))
+  {
+    return -1;
+  }
+  return 1;
+}
+
+// The file descriptor to poll for the edges of the event, with the
+// poll events that signal one
+int gpio_event_poll_fd(GpioEvent *e, short *events)    // gpio_event_poll_fd
+{
+  *events = e->events;
+  return e->fd;
+}
+
+// Stop watching the line and free the event, null up in stack. The
+// line is left exported, other processes may be watching it.
+void gpio_event_close(GpioEvent **e)                      // gpio_event_close
+{
+  if (*e)
+  {
+    close((*e)->fd);
+    free(*e);
+    *e = NULL;
+  }
+}
@@ -9,6 +9,9 @@
 #include "gpio_private.h"
 #include "../../tools/src/macros.h"
 
+// Define the chip state, once for the module
+Chip *chip;
+
 ///////////////////////////////////////////////////////////////////////////////
 // MALLOC
 ///////////////////////////////////////////////////////////////////////////////
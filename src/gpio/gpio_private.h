@@ -32,10 +32,20 @@ struct Chip {
   Pin* pins[NO_OF_PINS];
 };
 
+// Define the GpioEvent struct, a line watched for edges
+struct GpioEvent {
+  // The value file of the line, or the stand-in
+  int fd;
+  // The line (BCM2835 numbering), -1 for a stand-in
+  int gpio;
+  // The poll events that signal an edge
+  short events;
+};
+
 // Define the entry point for gpios
 extern volatile unsigned *gpio;
 // Define the chip state
-Chip* chip;
+extern Chip* chip;
 
 ///////////////////////////////////////////////////////////////////////////////
 // PRIVATE MODULE METHOD STUBS
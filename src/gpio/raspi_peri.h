@@ -28,17 +28,24 @@
 // Macros to prep pins for accessing
 // INP_GPIO must be used prior to OUT and SET
 ///////////////////////////////////////////////////////////////////////////////
+// Simulated builds (TARGET=SIM) hand every access to the GPIO model
+#ifdef TARGET_SIM
+#include "sim.h"
+#define GPIO_REG(w) (*sim_reg(gpio, (w)))
+#else
+#define GPIO_REG(w) (*(gpio + (w)))
+#endif
 // General macros to supply the set clear and value words
-#define SET_WORD    *(gpio +  7)
-#define CLR_WORD    *(gpio + 10)
-#define VAL_WORD    *(gpio + (0x34 >> 2))
+#define SET_WORD    GPIO_REG(7)
+#define CLR_WORD    GPIO_REG(10)
+#define VAL_WORD    GPIO_REG(0x34 >> 2)
 // Given g, the physical memory index of a pin, return the
 // shift required to bring the pins control word to
 // the pin control value being it's three least significant bits
 #define PIN_SHIFT(g) 3*(g%10)
 // Given g, a pins memory index, find the control word value
 // for that specific pin.
-#define PIN_CONTROL_WORD(g) *(gpio + (g/10))
+#define PIN_CONTROL_WORD(g) GPIO_REG((g)/10)
 // Modify the pin control word to represent the given pin
 // in input mode, 000. Pin specific bits found at input code 
 // left shifted by the pin number modulo 10, multiplied by 3
@@ -17,6 +17,16 @@
 // Alias for i2c buses
 typedef volatile unsigned i2c_bus;
 
+// Ways a bus may be driven
+//   MMAP   - the BSC registers directly, through /dev/mem (root)
+//   KERNEL - the kernel driver, through /dev/i2c-N
+//   BROKER - requests to the process serving the bus (i2c serve)
+//   REPLAY - a recording made with i2c_record_start, no bus at all
+typedef enum { I2C_BACKEND_MMAP,
+               I2C_BACKEND_KERNEL,
+               I2C_BACKEND_BROKER,
+               I2C_BACKEND_REPLAY } i2c_backend;
+
 // Define an i2c device type and struct
 typedef struct i2c_dev i2c_dev;
 struct i2c_dev {
@@ -24,6 +34,120 @@ struct i2c_dev {
   i2c_dev *next;
 }; 
 
+// A set of bus addresses, one bit for each of the 128
+typedef struct i2c_map i2c_map;
+struct i2c_map {
+  uint32_t bits[4];
+};
+
+// Test, add and remove an address in an i2c_map
+#define I2C_MAP_HAS(map, addr) \
+  ((map).bits[(addr) >> 5] & (1u << ((addr) & 31)))
+#define I2C_MAP_ADD(map, addr) \
+  ((map).bits[(addr) >> 5] |= (1u << ((addr) & 31)))
+#define I2C_MAP_DEL(map, addr) \
+  ((map).bits[(addr) >> 5] &= ~(1u << ((addr) & 31)))
+
+// Policies for waiting on the BSC status register
+//   SLEEP    - nanosleep between every poll
+//   SPIN     - busy-poll until the status is raised
+//   ADAPTIVE - sleep through long transfers, spin near completion
+typedef enum { I2C_WAIT_SLEEP, 
+               I2C_WAIT_SPIN, 
+               I2C_WAIT_ADAPTIVE } i2c_wait_policy;
+
+// Statistics accumulated over every call to a wait function
+typedef struct i2c_wait_stats i2c_wait_stats;
+struct i2c_wait_stats {
+  // Number of waits, status polls and sleeps made
+  unsigned long calls, polls, sleeps;
+  // Number of waits that timed out
+  unsigned long timeouts;
+  // Total time waited, and total expected from the byte counts
+  unsigned long long ns_total, ns_expected;
+  // Duration of the last wait, and the longest wait
+  long ns_last, ns_max;
+};
+
+// How failed transfers are retried, with separate limits for
+// each kind of error. The pause between attempts starts at
+// backoff_ns and doubles with each retry.
+typedef struct i2c_retry_policy i2c_retry_policy;
+struct i2c_retry_policy {
+  // Retries after a NACK, clock stretch timeout, or fifo timeout
+  int nack_retries, clkt_retries, timeout_retries;
+  // Pause before the first retry
+  long backoff_ns;
+};
+
+// Errors counted for a single device address
+typedef struct i2c_dev_errors i2c_dev_errors;
+struct i2c_dev_errors {
+  // Failed attempts, by kind
+  unsigned long nacks, clkts, timeouts;
+  // Attempts that were retried, and transfers that failed
+  // even after every retry
+  unsigned long retries, failures;
+};
+
+// Kinds of transaction that may be queued on a bus
+//   READ  - read len bytes from reg into buf
+//   WRITE - write len bytes from buf to reg
+//   MUX   - select mux channel reg (-1 for none) on the mux at addr
+//   READ_BYTE - read a single byte from addr into buf
+//   PROBE - check addr acknowledges, failing with I2C_DEV_DEAD
+typedef enum { I2C_TXN_READ, 
+               I2C_TXN_WRITE, 
+               I2C_TXN_MUX,
+               I2C_TXN_READ_BYTE,
+               I2C_TXN_PROBE } i2c_txn_type;
+
+// Queue priorities, all URGENT transactions run before any
+// NORMAL, and all NORMAL before any BULK
+typedef enum { I2C_PRIO_URGENT,
+               I2C_PRIO_NORMAL,
+               I2C_PRIO_BULK } i2c_txn_prio;
+
+// A transaction to be run by the bus thread
+typedef struct i2c_txn i2c_txn;
+struct i2c_txn {
+  i2c_txn_type type;
+  i2c_txn_prio prio;
+  // Device address and register
+  short addr, reg;
+  // Data to write, or space to read into
+  uint8_t *buf;
+  int len;
+  // Set on completion, 0 or an error code from i2c_err.h
+  int result;
+  // Called on the bus thread once complete, if not NULL
+  void (*done)(i2c_txn *txn);
+  // For the use of the submitter
+  void *arg;
+  // Used by the queue
+  i2c_txn *next;
+};
+
+// Kinds of transfer recorded in the trace ring
+typedef enum { I2C_TRACE_READ,
+               I2C_TRACE_WRITE,
+               I2C_TRACE_PROBE } i2c_trace_dir;
+
+// A single transfer attempt, as recorded in the trace ring
+typedef struct i2c_trace_rec i2c_trace_rec;
+struct i2c_trace_rec {
+  // Monotonic clock at the start and end of the attempt
+  uint64_t start_ns, end_ns;
+  // Position in the ring plus one, 0 while being written
+  uint32_t seq;
+  // BSC_S at the end of the attempt, and status polls made
+  uint32_t status, polls;
+  // Bytes in the transfer
+  uint16_t len;
+  // Device address, register and i2c_trace_dir
+  uint8_t addr, reg, dir;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // I2C INTERFACE
 ///////////////////////////////////////////////////////////////////////////////
@@ -32,6 +156,10 @@ struct i2c_dev {
 // I2C Initialization   /////////////////////////////////////
 // Initialise the bus, returns an i2c_bus handle
 i2c_bus             *i2c_init            (  int bus  );
+// Selects the backend used by buses initialised from now on.
+// Unless set, taken from the I2C_BACKEND environment variable
+// (mmap, kernel, broker or replay), else I2C_BACKEND_MMAP
+void                i2c_set_backend     (  i2c_backend backend  );
 
 /////////////////////////////////////////////////////////////
 // I2C System Functions /////////////////////////////////////
@@ -40,8 +168,21 @@ void                i2c_wait_done       (  i2c_bus *i2c  );
 // Verifies that the addr is active and responding
 int                 i2c_bus_addr_active (  i2c_bus *i2c, 
                                            short   addr  );
+// Verifies that the addr is active, trusting the presence
+// cache and only probing the bus if the addr is unknown
+int                 i2c_dev_present     (  i2c_bus *i2c,
+                                           short   addr  );
+// Forgets every device in the presence cache of the bus
+void                i2c_presence_invalidate(  i2c_bus *i2c  );
 // Detects all the active devices on the given i2c_bus
 i2c_dev             *i2c_dev_detect     (  i2c_bus *i2c  );
+// Probes the count candidate addresses (or every address if
+// candidates is NULL), returning the set that responded
+i2c_map             i2c_dev_scan        (  i2c_bus     *i2c,
+                                           const short *candidates,
+                                           int         count  );
+// Builds a list of devs (after a dummy at addr 0) from a map
+i2c_dev             *i2c_map_to_devs    (  i2c_map map  );
 // Prints to stdout the given devices
 void                i2c_print_bus       (  i2c_dev *dev  );
 // Appends an i2c device struct with the given address onto
@@ -49,6 +190,64 @@ void                i2c_print_bus       (  i2c_dev *dev  );
 void                i2c_dev_append      (  i2c_dev *dev, 
                                            short addr  );
 
+/////////////////////////////////////////////////////////////
+// I2C Clock ////////////////////////////////////////////////
+// Sets the default clock of the bus, in hz
+void                i2c_set_clock       (  i2c_bus  *i2c,
+                                           unsigned hz  );
+// Fetches the clock the bus is currently running at
+unsigned            i2c_get_clock       (  i2c_bus  *i2c  );
+// Fetches the clock transfers to addr are made at, its own
+// profile if it has one, else the bus default
+unsigned            i2c_get_dev_clock   (  i2c_bus  *i2c,
+                                           short    addr  );
+// Sets the clock used for all transfers to the given addr,
+// switched to only when the addressed device changes. A hz
+// of 0 returns the device to the bus default.
+void                i2c_set_dev_clock   (  i2c_bus  *i2c,
+                                           short    addr,
+                                           unsigned hz  );
+
+/////////////////////////////////////////////////////////////
+// I2C Errors ///////////////////////////////////////////////
+// Sets the retry policy for all transfers on the bus
+void                i2c_set_retry_policy(  i2c_bus *i2c,
+                                           const i2c_retry_policy *policy  );
+// Copies the error counters for the device at addr
+void                i2c_get_dev_errors  (  i2c_bus *i2c,
+                                           short   addr,
+                                           i2c_dev_errors *errors  );
+// Zeroes the error counters for the device at addr
+void                i2c_reset_dev_errors(  i2c_bus *i2c,
+                                           short   addr  );
+
+/////////////////////////////////////////////////////////////
+// I2C Wait Policy //////////////////////////////////////////
+// Selects the policy used by all subsequent waits
+void                i2c_set_wait_policy (  i2c_wait_policy policy  );
+// Copies the wait statistics of every bus, added together
+void                i2c_get_wait_stats  (  i2c_wait_stats *stats  );
+// Copies the wait statistics of the one bus
+void                i2c_get_bus_wait_stats(  i2c_bus *i2c,
+                                             i2c_wait_stats *stats  );
+// Zeroes the wait statistics of every bus
+void                i2c_reset_wait_stats(  void  );
+// Compares the wait policies against a simulated BSC and
+// prints the results to stdout
+void                i2c_bench_wait      (  int iterations  );
+
+/////////////////////////////////////////////////////////////
+// I2C Trace ////////////////////////////////////////////////
+// Only records when built with I2C_TRACE (make I2C_TRACE=1)
+// Writes the trace ring and latency histograms to path,
+// returns 0 on success
+int                 i2c_trace_save      (  const char *path  );
+// Prints a saved trace to stdout as text, or as csv
+int                 i2c_trace_print     (  const char *path,
+                                           int csv  );
+// Empties the trace ring and latency histograms
+void                i2c_trace_reset     (  void  );
+
 /////////////////////////////////////////////////////////////
 // I2C Read /////////////////////////////////////////////////
 // Reads a byte from the given address
@@ -59,11 +258,30 @@ uint8_t             i2c_read_reg        (  i2c_bus *i2c,
                                            short addr, 
                                            short reg  );
 // Reads bytes from an i2c device sequentially, starting
-// at the register on the device at the given address
+// at the register on the device at the given address.
+// Returns NULL should the read fail.
 uint8_t             *i2c_read_block     (  i2c_bus *i2c, 
                                            short addr, 
                                            short reg, 
                                            int   block_size  );
+// Reads a byte from the given address into byte. Returns 0
+// on success, else an error code from i2c_err.h
+int                 i2c_read_byte_into  (  i2c_bus *i2c,
+                                           short   addr,
+                                           uint8_t *byte  );
+// Reads len bytes into the caller's buf, starting at the
+// register on the device at the given address. Never
+// allocates. Failures are retried under the bus policy.
+// Returns 0 on success, else an error code from i2c_err.h
+int                 i2c_read_into       (  i2c_bus *i2c,
+                                           short   addr,
+                                           short   reg,
+                                           uint8_t *buf,
+                                           int     len  );
+// Selects whether register reads send the register and read
+// back in one transaction with a repeated start (default), or
+// as a write and a read each ending in a STOP
+void                i2c_set_repeated_start(  int enable  );
 
 /////////////////////////////////////////////////////////////
 // I2C Write ////////////////////////////////////////////////
@@ -73,7 +291,9 @@ uint32_t            i2c_write_byte      (  i2c_bus *i2c,
                                            short addr,
                                            uint8_t byte  );
 // Writes bytes to the i2c device at the given address,
-// on the supplied bus. Writes to the given register.
+// on the supplied bus. Writes to the given register. Any
+// length goes out as one transaction, so auto-increment
+// bursts need not be split.
 uint32_t            i2c_write_reg       (  i2c_bus *i2c, 
                                            short addr, 
                                            short reg, 
@@ -85,6 +305,75 @@ uint32_t            i2c_write_block     (  i2c_bus *i2c,
                                            short addr, 
                                            short size, 
                                            uint8_t *content  );
+// As i2c_write_reg and i2c_write_block, but returning 0 on
+// success, else an error code from i2c_err.h once the bus
+// retry policy is exhausted
+int                 i2c_try_write_reg   (  i2c_bus *i2c, 
+                                           short addr, 
+                                           short reg, 
+                                           uint8_t *bytes, 
+                                           short size  );
+int                 i2c_try_write_block (  i2c_bus *i2c, 
+                                           short addr, 
+                                           short size, 
+                                           uint8_t *content  );
+/////////////////////////////////////////////////////////////
+// I2C Transaction Queue ////////////////////////////////////
+// Starts a thread to own the bus and run queued transactions
+int                 i2c_queue_start     (  i2c_bus *i2c  );
+// Stops the bus thread, once the queue has been emptied
+void                i2c_queue_stop      (  i2c_bus *i2c  );
+// Queues a transaction, which must stay valid until complete
+int                 i2c_submit          (  i2c_bus *i2c,
+                                           i2c_txn *txn  );
+// Counts the channel selections queued for the mux at addr,
+// so that a cached channel may be known to be stale
+unsigned long       i2c_mux_selects     (  i2c_bus *i2c,
+                                           short   addr  );
+// Takes the next completed transaction without a callback,
+// waiting for one if block is set
+i2c_txn             *i2c_complete_next  (  i2c_bus *i2c,
+                                           int     block  );
+// Runs count transactions straight away, storing the result of
+// each. Backends that can (the kernel) hand them to the driver
+// as a single message set. Returns the number that failed.
+int                 i2c_run_batch       (  i2c_bus *i2c,
+                                           i2c_txn **txns,
+                                           int     count  );
+// Compares reads of len bytes from reg at addr through the BSC
+// registers, the kernel one at a time, and the kernel batched,
+// printing the results to stdout
+void                i2c_bench_backend   (  int   bus,
+                                           short addr,
+                                           short reg,
+                                           int   len,
+                                           int   iterations  );
+
+/////////////////////////////////////////////////////////////
+// I2C Broker ///////////////////////////////////////////////
+// Serves the bus to other processes (I2C_BACKEND_BROKER) over
+// a unix socket, driving it through the current backend.
+// Returns only should the socket fail.
+int                 i2c_broker_serve    (  int bus  );
+
+/////////////////////////////////////////////////////////////
+// I2C Record / Replay //////////////////////////////////////
+// Records every transfer attempt on the bus, and the bytes
+// read or written, to path. Returns 0 on success. Set
+// I2C_RECORD to a path to record every bus from i2c_init, a
+// %d in the path standing for the bus number.
+int                 i2c_record_start    (  i2c_bus    *i2c,
+                                           const char *path  );
+// Stops recording the bus, returns 0 if the recording is whole
+int                 i2c_record_stop     (  i2c_bus *i2c  );
+// Selects the replay backend for buses initialised from now on,
+// playing back the recording at path (%d for the bus number).
+// If timed, each transfer takes as long as it did when recorded,
+// else it returns straight away. Unless set, taken from the
+// I2C_REPLAY and I2C_REPLAY_TIMED environment variables.
+void                i2c_set_replay      (  const char *path,
+                                           int        timed  );
+
 /////////////////////////////////////////////////////////////
 // I2C Memory Management ////////////////////////////////////
 // Frees all of the chained devs
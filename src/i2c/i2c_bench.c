@@ -0,0 +1,244 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: i2c_bench.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include "i2c_private.h"
+#include "i2c_res.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// SIMULATED BSC
+///////////////////////////////////////////////////////////////////////////////
+/*
+   A bare register block standing in for a BSC controller. A thread
+   is kicked whenever a transfer is started, raises TA, sleeps for
+   as long as the real controller would take to move DLEN bytes at
+   the configured divider, then raises DONE. The thread sleeps rather
+   than polls so that it does not steal cycles from the policy under
+   test on a single core Pi.
+
+   Unlike the hardware, writing to BSC_S does not clear bits, so the
+   bench clears DONE itself before starting each transfer.
+*/
+
+// The simulated register block
+static volatile unsigned sim[8];
+// Set to 0 to stop the simulator thread
+static volatile int sim_running;
+// Posted to kick the simulator once a transfer is started
+static sem_t sim_kick;
+// When the simulator last raised DONE
+static struct timespec sim_done_at;
+
+// Nanoseconds between two timespecs
+static long ns_between(struct timespec *a, struct timespec *b)
+{
+  return (b->tv_sec - a->tv_sec) * 1000000000l + (b->tv_nsec - a->tv_nsec);
+}
+
+// Simulator thread, emulates the transfer timing of the BSC
+static void *sim_start(void *arg)
+{
+  i2c_bus *i2c = sim;
+  struct timespec end;
+  // Wait for a transfer to be started
+  while (!sem_wait(&sim_kick) && sim_running)
+  {
+    // Latch the transfer
+    BSC_C &= ~BSC_C_ST;
+    BSC_S |= BSC_S_TA;
+    // Work out when the transfer would complete
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_nsec += i2c_transfer_ns(i2c, BSC_DATA_LEN);
+    end.tv_sec += end.tv_nsec / 1000000000l;
+    end.tv_nsec %= 1000000000l;
+    // Hold the bus for the length of the transfer
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &end, NULL));
+    // Finish the transfer
+    clock_gettime(CLOCK_MONOTONIC, &sim_done_at);
+    __sync_synchronize();
+    BSC_S = (BSC_S & ~BSC_S_TA) | BSC_S_DONE;
+  }
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// BENCHMARK
+///////////////////////////////////////////////////////////////////////////////
+
+static const char *policy_names[] = { "sleep", "spin", "adaptive" };
+
+// Run `iterations` transfers of `bytes` under the given policy
+// and print a row of averaged results
+static void bench_policy(i2c_wait_policy policy, int bytes, int iterations)
+{
+  i2c_bus *i2c = sim;
+  struct timespec cpu_start, cpu_end, returned;
+  long long late = 0, cpu = 0;
+  i2c_wait_stats stats;
+  // Apply the policy and start from clean statistics
+  i2c_set_wait_policy(policy);
+  i2c_reset_wait_stats();
+  for (int i = 0; i < iterations; i++)
+  {
+    // Set up and start the transfer
+    BSC_S = 0;
+    BSC_DATA_LEN = bytes;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+    BSC_C = START_WRITE;
+    sem_post(&sim_kick);
+    // Wait as any transfer would
+    i2c_wait_done(i2c);
+    clock_gettime(CLOCK_MONOTONIC, &returned);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    __sync_synchronize();
+    // Accumulate how late we noticed DONE and the cpu spent
+    late += ns_between(&sim_done_at, &returned);
+    cpu += ns_between(&cpu_start, &cpu_end);
+  }
+  i2c_get_wait_stats(&stats);
+  printf("   | %-8s | %5d | %9.1f | %9.1f | %9.1f | %9.0f | %6.2f |\n",
+         policy_names[policy], bytes,
+         stats.ns_total / 1000.0 / iterations,
+         late / 1000.0 / iterations,
+         cpu / 1000.0 / iterations,
+         (double)stats.polls / iterations,
+         (double)stats.sleeps / iterations);
+}
+
+// Compare each of the wait policies against the simulated BSC,
+// for a range of transfer sizes at the default 100khz clock
+void i2c_bench_wait(int iterations)                          // i2c_bench_wait
+{
+  i2c_bus *i2c = sim;
+  pthread_t thread;
+  int sizes[] = { 1, 6, 16 };
+  // Default divider gives 100khz
+  BSC_CLOCK_DIV = 1500;
+  // Start the simulator
+  sim_running = 1;
+  sem_init(&sim_kick, 0, 0);
+  if (pthread_create(&thread, NULL, &sim_start, NULL))
+  {
+    ERR("Failed to start the BSC simulator thread.\n\n");
+    return;
+  }
+  PRINTC(GREEN, "Benchmarking wait policies (%d transfers each)...\n\n",
+         iterations);
+  printf("   +----------+-------+-----------+-----------+-----------+-----------+--------+\n");
+  printf("   | policy   | bytes |  wait us  |  late us  |  cpu us   |   polls   | sleeps |\n");
+  printf("   +----------+-------+-----------+-----------+-----------+-----------+--------+\n");
+  for (int s = 0; s < sizeof(sizes) / sizeof(int); s++)
+  {
+    for (int p = I2C_WAIT_SLEEP; p <= I2C_WAIT_ADAPTIVE; p++)
+    {
+      bench_policy(p, sizes[s], iterations);
+    }
+  }
+  printf("   +----------+-------+-----------+-----------+-----------+-----------+--------+\n");
+  // Stop the simulator and restore the default policy
+  sim_running = 0;
+  sem_post(&sim_kick);
+  pthread_join(thread, NULL);
+  sem_destroy(&sim_kick);
+  i2c_set_wait_policy(I2C_WAIT_ADAPTIVE);
+  PRINTC(GREEN, "\n...done.\n\n");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// BACKEND BENCHMARK
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Runs the same register reads against a real (or TARGET=SIM) bus
+   through each backend in turn. Reads are made in sets of
+   BENCH_SET, so that the kernel backend may batch a set into one
+   message set. On the Pi, the mmap pass reprograms the pins and the
+   divider (to the same 100khz) from under the kernel driver.
+*/
+
+// Reads made together, as a batch where the backend allows
+#define BENCH_SET   8
+// Largest read benchmarked
+#define BENCH_MAX   32
+
+static const char *backend_names[] = { "mmap", "kernel" };
+
+// Run `iterations` sets of reads on the bus, batched or not, and
+// print a row of per read results
+static void bench_reads(i2c_bus *i2c, i2c_backend backend, int batched,
+                        short addr, short reg, int len, int iterations)
+{
+  static uint8_t bufs[BENCH_SET][BENCH_MAX];
+  i2c_txn txns[BENCH_SET], *set[BENCH_SET];
+  struct timespec start, end, cpu_start, cpu_end;
+  long failed = 0;
+  for (int i = 0; i < BENCH_SET; i++)
+  {
+    txns[i] = (i2c_txn) { I2C_TXN_READ, I2C_PRIO_NORMAL,
+                          addr, reg, bufs[i], len };
+    set[i] = &txns[i];
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+  for (int n = 0; n < iterations; n++)
+  {
+    if (batched)
+    {
+      failed += i2c_run_batch(i2c, set, BENCH_SET);
+      continue;
+    }
+    for (int i = 0; i < BENCH_SET; i++)
+    {
+      failed += !!i2c_read_into(i2c, addr, reg, bufs[i], len);
+    }
+  }
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double reads = (double)iterations * BENCH_SET;
+  printf("   | %-8s | %9d | %9.1f | %9.1f | %8ld |\n",
+         backend_names[backend], batched ? BENCH_SET : 1,
+         ns_between(&start, &end) / 1000.0 / reads,
+         ns_between(&cpu_start, &cpu_end) / 1000.0 / reads,
+         failed);
+}
+
+// Compare reads of len bytes from reg at addr through the BSC
+// registers against the same reads through the kernel driver, one
+// at a time and batched
+void i2c_bench_backend(int   bus,                         // i2c_bench_backend
+                       short addr,
+                       short reg,
+                       int   len,
+                       int   iterations)
+{
+  // Verify the read fits the bench buffers
+  if ((len < 1) || (len > BENCH_MAX))
+  {
+    ERR("Can only benchmark reads of 1 to %d bytes.\n\n", BENCH_MAX);
+    return;
+  }
+  PRINTC(GREEN, "Benchmarking backends on bus %d, %d byte reads of "
+         "0x%02x at 0x%02x (%d sets of %d)...\n\n",
+         bus, len, reg, addr, iterations, BENCH_SET);
+  printf("   +----------+-----------+-----------+-----------+----------+\n");
+  printf("   | backend  | reads/set |  wall us  |  cpu us   |  failed  |\n");
+  printf("   +----------+-----------+-----------+-----------+----------+\n");
+  // Registers first, then the kernel
+  i2c_set_backend(I2C_BACKEND_MMAP);
+  i2c_bus *regs = i2c_init(bus);
+  bench_reads(regs, I2C_BACKEND_MMAP, 0, addr, reg, len, iterations);
+  i2c_set_backend(I2C_BACKEND_KERNEL);
+  i2c_bus *kernel = i2c_init(bus);
+  bench_reads(kernel, I2C_BACKEND_KERNEL, 0, addr, reg, len, iterations);
+  bench_reads(kernel, I2C_BACKEND_KERNEL, 1, addr, reg, len, iterations);
+  printf("   +----------+-----------+-----------+-----------+----------+\n");
+  i2c_set_backend(I2C_BACKEND_MMAP);
+  PRINTC(GREEN, "\n...done.\n\n");
+}
@@ -0,0 +1,185 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: i2c_broker.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "i2c_private.h"
+#include "i2c_res.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// BROKER BACKEND (CLIENT)
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Two processes driving the same BSC corrupt each other's transfers,
+   so where several may share a bus (the web server alongside a
+   capture, or scripts calling the imu tool) one process owns it with
+   i2c serve and the rest use this backend. Each transfer attempt is
+   sent to the broker as a request and waits on the reply, so every
+   call in i2c.h works unchanged.
+
+   The broker retries under its own policy, so clients make a single
+   attempt. A one byte write to a mux address (0x70-0x77) is taken as
+   a channel selection and sent with every later request, so that
+   the broker can put the mux back should another client have moved
+   it in between.
+
+   A handle is shared by every thread of the process, each request
+   and reply being made under the lock.
+*/
+
+// Clients leave retrying to the broker
+static const i2c_retry_policy no_retry = { 0, 0, 0, 0 };
+
+// Held for the length of each request and reply
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Bytes of a request or reply ahead of its data
+#define REQ_HEADER  offsetof(i2cd_req, data)
+#define REP_HEADER  offsetof(i2cd_rep, data)
+
+// Make the request of the broker, reading up to len bytes of reply
+// into out. Returns the result of the request.
+static int request(i2c_bus *i2c, i2cd_req *req, uint8_t *out, int len)
+{
+  i2c_state *state = i2c_state_of(i2c);
+  i2cd_rep rep;
+  ssize_t got = -1;
+  // Send the data written, if any
+  size_t bytes = REQ_HEADER + (req->op == I2CD_WRITE ? req->len : 0);
+  req->mux_addr = state->mux_addr;
+  req->mux_byte = state->mux_byte;
+  pthread_mutex_lock(&lock);
+  if (send(state->fd, req, bytes, MSG_NOSIGNAL) == (ssize_t)bytes)
+  {
+    got = recv(state->fd, &rep, sizeof(rep), 0);
+  }
+  pthread_mutex_unlock(&lock);
+  // Without a reply there is nothing to go on
+  if (got < (ssize_t)REP_HEADER)
+  {
+    ERR("Lost the i2c broker, is `i2c serve` still running?\n\n");
+    BSC_S = 0;
+    return FIFO_ERR;
+  }
+  // Take on the outcome as the broker saw it
+  BSC_S = rep.status;
+  i2c_presence_update(i2c, req->addr, rep.status);
+  if (!rep.result && out)
+  {
+    // A read replied to short has nothing behind the header to copy
+    if (got < (ssize_t)(REP_HEADER + len))
+    {
+      ERR("The i2c broker replied with %d of %d bytes read.\n\n",
+          (int)(got - REP_HEADER), len);
+      return FIFO_ERR;
+    }
+    memcpy(out, rep.data, len);
+  }
+  return rep.result;
+}
+
+// A register read
+static int broker_read(i2c_bus *i2c,
+                       short   addr,
+                       short   reg,
+                       uint8_t *buf,
+                       int     len)
+{
+  if (len > I2CD_MAX_DATA)
+  {
+    ERR("Cannot read more than %d bytes through the broker.\n\n",
+        I2CD_MAX_DATA);
+    return FIFO_ERR;
+  }
+  i2cd_req req = { .op = I2CD_READ, .addr = addr, .reg = reg, .len = len };
+  return request(i2c, &req, buf, len);
+}
+
+// A single byte read
+static int broker_read_byte(i2c_bus *i2c, short addr, uint8_t *byte)
+{
+  i2cd_req req = { .op = I2CD_READ_BYTE, .addr = addr, .len = 1 };
+  return request(i2c, &req, byte, 1);
+}
+
+// A write of size bytes of content, noting any mux selection
+static int broker_write(i2c_bus *i2c,
+                        short   addr,
+                        short   size,
+                        uint8_t *content)
+{
+  i2c_state *state = i2c_state_of(i2c);
+  if ((size < 1) || (size > I2CD_MAX_DATA))
+  {
+    ERR("Can only write 1 to %d bytes through the broker.\n\n",
+        I2CD_MAX_DATA);
+    return FIFO_ERR;
+  }
+  i2cd_req req = { .op = I2CD_WRITE, .addr = addr, .len = size };
+  memcpy(req.data, content, size);
+  int code = request(i2c, &req, NULL, 0);
+  // Remember the channel selected, to be kept by the broker
+  if (!code && (size == 1) && I2CD_IS_MUX(addr))
+  {
+    state->mux_addr = addr;
+    state->mux_byte = content[0];
+  }
+  return code;
+}
+
+// A probe
+static int broker_probe(i2c_bus *i2c, short addr)
+{
+  i2cd_req req = { .op = I2CD_PROBE, .addr = addr };
+  return !request(i2c, &req, NULL, 0);
+}
+
+// Transfers made through the broker, which batches for itself
+const i2c_ops i2c_broker_ops = {
+  /* read */      &broker_read,
+  /* read_byte */ &broker_read_byte,
+  /* write */     &broker_write,
+  /* probe */     &broker_probe,
+  /* batch */     NULL
+};
+
+// Connect to the broker serving the bus and return a handle for it
+i2c_bus *i2c_broker_init(int bus)                            // i2c_broker_init
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  snprintf(addr.sun_path, sizeof(addr.sun_path), I2CD_SOCKET_FMT, bus);
+  // Connect to the broker
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if ((fd < 0) ||
+      connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+  {
+    ERR("Failed to connect to the i2c broker at %s - "
+        "is `i2c serve` running?\n\n", addr.sun_path);
+    exit(EXIT_FAILURE);
+  }
+  // The handle is a register block of our own, holding BSC_S
+  i2c_bus *i2c = calloc(8, sizeof(unsigned));
+  if (!i2c)
+  {
+    ERR("Failed to allocate memory (malloc) for i2c_bus.\n\n");
+    exit(EXIT_FAILURE);
+  }
+  // Claim the bus state, starting with an empty presence cache
+  i2c_state *state = i2c_state_of(i2c);
+  state->ops = &i2c_broker_ops;
+  state->fd = fd;
+  state->retry = no_retry;
+  i2c_presence_invalidate(i2c);
+  // Assume the broker runs the bus in standard mode, for timing only
+  BSC_CLOCK_DIV = (unsigned)(BSC_CORE_CLK_HZ / I2C_DEFAULT_HZ);
+  return i2c;
+}
@@ -0,0 +1,115 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: i2c_clock.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include "i2c_private.h"
+#include "i2c_res.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// BUS CLOCK
+///////////////////////////////////////////////////////////////////////////////
+/*
+   SCL is the 150Mhz core clock divided by BSC_CLOCK_DIV, which the
+   hardware rounds down to an even number. The data delays and the
+   clock stretch timeout are scaled along with it, much as the kernel
+   driver does.
+
+   Each bus has a default clock, and any address may be given its own
+   profile (such as 400khz for devices that support fast mode). The
+   divider is reprogrammed before a transfer only when the addressed
+   device wants a different clock to the one currently set, so runs of
+   transfers to the same device cost nothing extra.
+*/
+
+// Longest a slave may stretch the clock before CLKT, in ms
+#define CLOCK_STRETCH_MS  35
+
+// Program the divider, data delays and stretch timeout for hz
+static void program_clock(i2c_bus *i2c, unsigned hz)
+{
+  // Round the divider up to even, so as never to exceed hz
+  unsigned cdiv = (unsigned)((BSC_CORE_CLK_HZ + hz - 1) / hz);
+  cdiv = (cdiv + 1) & ~1u;
+  // Clamp to what the register can hold, 0 meaning 32768
+  if (cdiv > 0xfffe)
+  {
+    cdiv = 0xfffe;
+  }
+  BSC_CLOCK_DIV = cdiv;
+  // Sample and drive data a fraction of a clock from each edge
+  unsigned fedl = cdiv / 16 ? cdiv / 16 : 1,
+           redl = cdiv / 4 ? cdiv / 4 : 1;
+  BSC_DATA_DELAY = (fedl << 16) | redl;
+  // Express the stretch timeout in SCL cycles
+  unsigned clkt = (hz / 1000) * CLOCK_STRETCH_MS;
+  BSC_CLOCK_STRETCH = clkt > 0xffff ? 0xffff : clkt;
+  i2c_state_of(i2c)->active_hz = hz;
+}
+
+// Set the default clock for the bus, taking effect immediately
+void i2c_set_clock(i2c_bus *i2c, unsigned hz)                  // i2c_set_clock
+{
+  if (!hz)
+  {
+    ERR("Cannot set an i2c clock of 0hz.\n\n");
+    return;
+  }
+  i2c_state_of(i2c)->default_hz = hz;
+  program_clock(i2c, hz);
+}
+
+// Fetch the clock rate the divider is currently set for
+unsigned i2c_get_clock(i2c_bus *i2c)                           // i2c_get_clock
+{
+  // A divider of 0 is treated by the hardware as 32768
+  unsigned cdiv = BSC_CLOCK_DIV & 0xfffeu;
+  return (unsigned)(BSC_CORE_CLK_HZ / (cdiv ? cdiv : 32768));
+}
+
+// Give the device at addr its own clock profile, or return it to
+// the bus default if hz is 0
+void i2c_set_dev_clock(i2c_bus *i2c,                       // i2c_set_dev_clock
+                       short   addr,
+                       unsigned hz)
+{
+  i2c_state_of(i2c)->dev_hz[addr & 0x7f] = hz;
+}
+
+// Fetch the clock transfers to addr are made at, falling back to the
+// bus default and then whatever the divider is set to. Only the BSC
+// backend honours profiles, the others run at a single clock.
+unsigned i2c_get_dev_clock(i2c_bus *i2c, short addr)       // i2c_get_dev_clock
+{
+  i2c_state *state = i2c_state_of(i2c);
+  if (state->ops != &i2c_bsc_ops)
+  {
+    return i2c_get_clock(i2c);
+  }
+  unsigned hz = state->dev_hz[addr & 0x7f];
+  if (!hz)
+  {
+    hz = state->default_hz;
+  }
+  return hz ? hz : i2c_get_clock(i2c);
+}
+
+// Ready the bus for a transfer to addr, switching the divider only
+// if the device's profile differs from the active clock
+void i2c_clock_select(i2c_bus *i2c, short addr)             // i2c_clock_select
+{
+  i2c_state *state = i2c_state_of(i2c);
+  unsigned hz = state->dev_hz[addr & 0x7f];
+  // Fall back to the bus default
+  if (!hz)
+  {
+    hz = state->default_hz;
+  }
+  // Leave buses with no clock set (such as simulations) alone
+  if (hz && (hz != state->active_hz))
+  {
+    program_clock(i2c, hz);
+  }
+}
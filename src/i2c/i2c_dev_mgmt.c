@@ -5,6 +5,7 @@
 // PA Consulting - Lawrence Jones
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <string.h>
 #include "i2c_res.h"
 #include "i2c_private.h"
 
@@ -12,10 +13,29 @@
 // I2C DEVICE MANAGEMENT
 ///////////////////////////////////////////////////////////////////////////////
 
+// A probe made by a scan is given this many times its expected
+// wire time before the address is taken to be empty. Kept short,
+// as a scan of the bus is made of nothing but probes. Any other
+// probe is given as long as a transfer.
+#define PROBE_TIMEOUT_FACTOR 4
+
 // Given an i2c_bus and an address, ping the dev at
 // the addr and verify that there is a response
 int i2c_bus_addr_active(i2c_bus *i2c, short addr)        // i2c_bus_addr_active
 {
+  i2c_bus_lock(i2c);
+  TRACE_START(mark);
+  int active = i2c_state_of(i2c)->ops->probe(i2c, addr);
+  TRACE_STOP(mark, addr, 0, 1, I2C_TRACE_PROBE, BSC_S);
+  i2c_bus_unlock(i2c);
+  return active;
+}
+
+// Probe the addr through the BSC with a single byte read
+int i2c_bsc_probe(i2c_bus *i2c, short addr)                    // i2c_bsc_probe
+{
+  // Switch to the clock profile of the device
+  i2c_clock_select(i2c, addr);
   // Set new slave address
   BSC_SLAVE_ADDR = addr;
   // Clear current bus status
@@ -24,31 +44,148 @@ int i2c_bus_addr_active(i2c_bus *i2c, short addr)        // i2c_bus_addr_active
   BSC_DATA_LEN = 1;
   // Initiate read using bus control
   BSC_C = START_READ;
-  // Wait for bus to clear
-  i2c_wait_done(i2c);
-  return !(BSC_S & BSC_S_ERR);
+  // Wait for bus to clear, only briefly should this be a scan
+  uint32_t status = i2c_wait_status(i2c, BSC_S_DONE, 1,
+      i2c_state_of(i2c)->scanning
+        ? PROBE_TIMEOUT_FACTOR * i2c_transfer_ns(i2c, 1)
+        : i2c_timeout_ns(i2c, 1));
+  // Abort a probe that has not finished, nothing answered, so the
+  // cache no longer holds the address either
+  if (!status)
+  {
+    BSC_C = BSC_C_CLEAR;
+    I2C_MAP_DEL(i2c_state_of(i2c)->present, addr);
+    return 0;
+  }
+  // Record the outcome in the presence cache
+  i2c_presence_update(i2c, addr, status);
+  return !(status & BSC_S_ERR);
 }
 
-// Detect all devices on the current bus and return a
-// pointer to an i2c_dev struct linked to all discovered devices
-i2c_dev *i2c_dev_detect(i2c_bus *i2c)                         // i2c_dev_detect
+///////////////////////////////////////////////////////////////////////////////
+// PRESENCE CACHE
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Probing an address costs a full 1 byte read, so each bus keeps a
+   bitmap of addresses that have recently acknowledged. It is filled
+   by i2c_dev_detect and by every transfer that completes cleanly,
+   and an address is dropped as soon as it fails to acknowledge. A
+   clock stretch timeout drops the whole bus, as a wedged slave may
+   have hidden anything behind it.
+
+   Entries are not dropped when a mux switches channel. A stale entry
+   costs no more than the probe it replaces - the transfer NACKs,
+   BSC_S_ERR is raised and the entry is dropped.
+*/
+
+// Given the status at the end of a transfer to addr, mark the
+// addr present or absent in the cache for the bus
+void i2c_presence_update(i2c_bus  *i2c,                  // i2c_presence_update
+                         short    addr,
+                         uint32_t status)
+{
+  i2c_state *state = i2c_state_of(i2c);
+  // A clock stretch timeout leaves the whole bus in doubt
+  if (status & BSC_S_CLKT)
+  {
+    memset(&state->present, 0, sizeof(i2c_map));
+  }
+  // No acknowledgement, so the device is gone
+  else if (status & BSC_S_ERR)
+  {
+    I2C_MAP_DEL(state->present, addr);
+  }
+  // Only a completed transfer proves the device is there
+  else if (status & BSC_S_DONE)
+  {
+    I2C_MAP_ADD(state->present, addr);
+  }
+}
+
+// Verify that the addr is present, from the cache if possible,
+// else by probing the bus
+int i2c_dev_present(i2c_bus *i2c, short addr)                // i2c_dev_present
+{
+  // Trust the cache if it has seen the device
+  if (I2C_MAP_HAS(i2c_state_of(i2c)->present, addr))
+  {
+    return 1;
+  }
+  // Else probe, which fills the cache should it respond
+  return i2c_bus_addr_active(i2c, addr);
+}
+
+// Drop every address from the presence cache of the bus
+void i2c_presence_invalidate(i2c_bus *i2c)       // i2c_presence_invalidate
+{
+  i2c_state *state = i2c_state_of(i2c);
+  memset(&state->present, 0, sizeof(i2c_map));
+}
+
+// Probe each of the count candidate addresses, or every address
+// from 1 to 127 if candidates is NULL, and return the set of those
+// that responded
+i2c_map i2c_dev_scan(i2c_bus     *i2c,                          // i2c_dev_scan
+                     const short *candidates,
+                     int         count)
+{
+  i2c_map found = {{0}};
+  i2c_state *state = i2c_state_of(i2c);
+  // Hold the bus for the whole scan, so that only its probes are cut
+  // short
+  i2c_bus_lock(i2c);
+  state->scanning = 1;
+  // Scan the whole bus if not given candidates
+  if (!candidates)
+  {
+    // Start the cache afresh, the probes below will refill it
+    i2c_presence_invalidate(i2c);
+    for (short addr = 1; addr < 128; addr++)
+    {
+      if (i2c_bus_addr_active(i2c, addr))
+      {
+        I2C_MAP_ADD(found, addr);
+      }
+    }
+  }
+  // Else probe just the candidates
+  for (int i = 0; candidates && (i < count); i++)
+  {
+    if (i2c_bus_addr_active(i2c, candidates[i] & 0x7f))
+    {
+      I2C_MAP_ADD(found, candidates[i] & 0x7f);
+    }
+  }
+  state->scanning = 0;
+  i2c_bus_unlock(i2c);
+  return found;
+}
+
+// Build a list of devs from the map, in address order, after a
+// dummy dev at addr 0
+i2c_dev *i2c_map_to_devs(i2c_map map)                        // i2c_map_to_devs
 {
   // Create new dummy dev at addr 0
-  i2c_dev *dev = i2c_dev_malloc(0);
-  // For all of the available addresses
+  i2c_dev *dev = i2c_dev_malloc(0),
+          *tail = dev;
+  // Append each address in the map
   for (short addr = 1; addr < 128; addr++)
   {
-    // If the i2c addr is active
-    if (i2c_bus_addr_active(i2c, addr))
+    if (I2C_MAP_HAS(map, addr))
     {
-      // Add the current address to the chain of devs
-      i2c_dev_append(dev, addr);
+      tail = tail->next = i2c_dev_malloc(addr);
     }
   }
-  // Return the initial i2c_dev pointer
   return dev;
 }
 
+// Detect all devices on the current bus and return a
+// pointer to an i2c_dev struct linked to all discovered devices
+i2c_dev *i2c_dev_detect(i2c_bus *i2c)                         // i2c_dev_detect
+{
+  return i2c_map_to_devs(i2c_dev_scan(i2c, NULL, 0));
+}
+
 // Add an i2c device to an existing i2c_dev list
 void i2c_dev_append(i2c_dev *dev, short addr)                 // i2c_dev_append
 {
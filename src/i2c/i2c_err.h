@@ -12,8 +12,12 @@
 // DEFINE ERROR CODES
 ///////////////////////////////////////////////////////////////////////////////
 
-// Signifies i2c device not active
+// Signifies i2c device not active (did not acknowledge)
 #define I2C_DEV_DEAD  0xa0
+// Signifies a device held the clock past the stretch timeout
+#define I2C_CLK_STRETCH 0xa1
+// Signifies that the bus has no running transaction queue
+#define I2C_QUEUE_STOPPED 0xb0
 
 // Signifies that after the given timeout period, the i2c
 // fifo buffer has not become full nor has the transfer ended
@@ -6,6 +6,7 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include <stdlib.h>
+#include <string.h>
 #include "i2c_private.h"
 #include "i2c_res.h"
 #include "gpio/raspi_peri.h"
@@ -15,9 +16,44 @@
 // INITIALISATION
 ///////////////////////////////////////////////////////////////////////////////
 
+// Backend given to buses as they are initialised, -1 until chosen
+static int backend = -1;
+
+// Select the backend for buses initialised from now on. The kernel
+// backend needs no root, only access to /dev/i2c-N, and leaves the
+// pins and clock to the kernel driver. The broker backend needs
+// nothing but a broker (i2c serve) to be running for the bus.
+void i2c_set_backend(i2c_backend chosen)                     // i2c_set_backend
+{
+  backend = chosen;
+}
+
+// The backend chosen, else that named by I2C_BACKEND, else mmap
+static i2c_backend chosen_backend(void)
+{
+  const char *name = getenv("I2C_BACKEND");
+  if (backend >= 0)
+  {
+    return backend;
+  }
+  if (name && !strcmp(name, "kernel"))
+  {
+    return I2C_BACKEND_KERNEL;
+  }
+  if (name && !strcmp(name, "broker"))
+  {
+    return I2C_BACKEND_BROKER;
+  }
+  if (name && !strcmp(name, "replay"))
+  {
+    return I2C_BACKEND_REPLAY;
+  }
+  return I2C_BACKEND_MMAP;
+}
+
 // TODO - Set macros to auto fix pins for various board revisions
 // Initialises pins to prepare for the I2C protocol
-volatile unsigned* i2c_init(int bus)                                // i2c_init
+static volatile unsigned* mmap_init(int bus)
 {
   // If gpio isn't init'd, attempt an init
   volatile unsigned *gpio = init_gpio_access();
@@ -52,6 +88,34 @@ volatile unsigned* i2c_init(int bus)                                // i2c_init
   INP_GPIO(clk);
   // Set gpio clk pin to alternate state, SCL0
   SET_GPIO_ALT(clk, 0);
+  // Claim the bus state, starting with an empty presence cache
+  i2c_presence_invalidate(i2c);
+  // Start out in standard mode, devices may ask for faster
+  i2c_set_clock(i2c, I2C_DEFAULT_HZ);
   // Return the i2c pointer
   return i2c;
 }
+
+// Initialises the bus through the chosen backend, recording it
+// should I2C_RECORD ask
+volatile unsigned* i2c_init(int bus)                                // i2c_init
+{
+  volatile unsigned *i2c;
+  switch (chosen_backend())
+  {
+    case I2C_BACKEND_KERNEL:
+      i2c = i2c_kernel_init(bus);
+      break;
+    case I2C_BACKEND_BROKER:
+      i2c = i2c_broker_init(bus);
+      break;
+    // A replay is only ever played back
+    case I2C_BACKEND_REPLAY:
+      return i2c_replay_init(bus);
+    default:
+      i2c = mmap_init(bus);
+      break;
+  }
+  i2c_record_from_env(i2c, bus);
+  return i2c;
+}
@@ -0,0 +1,285 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: i2c_kernel.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "i2c_private.h"
+#include "i2c_res.h"
+#ifdef TARGET_SIM
+#include "sim.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// KERNEL BACKEND
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Rather than driving the BSC registers through /dev/mem, a bus may
+   be handed to the kernel's own driver through /dev/i2c-N. This
+   needs no root (only membership of the i2c group) and so sits
+   happily alongside anything else using the kernel driver.
+
+   Each transfer becomes one I2C_RDWR message set - a register read
+   is the register write and the read, joined by a repeated start.
+   A batch of reads goes to the kernel as one set, costing a single
+   syscall and a single wakeup rather than one per read. The bcm2835
+   driver only takes a read as the last message of a set, refusing
+   anything else with EOPNOTSUPP, so once refused a bus falls back to
+   a set for each read.
+
+   The handle is a register block of our own, never mapped, in which
+   the backend leaves a BSC_S standing for the outcome of the last
+   transfer. That keeps the retry, presence and trace code (and any
+   caller reading back the status) working as it does on the BSC.
+   The clock is set by the kernel (the i2c_arm_baudrate dtparam), so
+   clock profiles have no effect on these buses.
+*/
+
+// Simulated builds talk to the simulated bus in place of the kernel
+#ifdef TARGET_SIM
+#define DEV_OPEN(path)          sim_i2cdev_open(path)
+#define DEV_IOCTL(fd, req, arg) sim_i2cdev_ioctl(fd, req, arg)
+#else
+#define DEV_OPEN(path)          open(path, O_RDWR)
+#define DEV_IOCTL(fd, req, arg) ioctl(fd, req, arg)
+#endif
+
+// Largest message set the kernel accepts, and so the most reads
+// that may be batched into one
+#define MAX_MSGS  I2C_RDWR_IOCTL_MAX_MSGS
+#define MAX_READS (MAX_MSGS / 2)
+
+// Hand count messages to the driver as one set. Returns 0 on
+// success, else -1 with errno set.
+static int rdwr(i2c_bus *i2c, struct i2c_msg *msgs, int count)
+{
+  struct i2c_rdwr_ioctl_data set = { msgs, count };
+  return DEV_IOCTL(i2c_state_of(i2c)->fd, I2C_RDWR, &set) < 0 ? -1 : 0;
+}
+
+// Convert the outcome of a message set to addr into an error code,
+// leaving the BSC status it stands for in BSC_S
+static int outcome(i2c_bus *i2c, short addr, int failed)
+{
+  uint32_t status = BSC_S_DONE;
+  int code = 0;
+  if (failed)
+  {
+    switch (errno)
+    {
+      // No acknowledgement
+      case ENXIO:
+      case EREMOTEIO:
+        status |= BSC_S_ERR;
+        code = I2C_DEV_DEAD;
+        break;
+      // How the bcm2835 driver reports a clock stretch timeout
+      case EIO:
+        status |= BSC_S_CLKT;
+        code = I2C_CLK_STRETCH;
+        break;
+      // The transfer never finished
+      case ETIMEDOUT:
+        status = 0;
+        code = FIFO_TIMEOUT;
+        break;
+      default:
+        status = 0;
+        code = FIFO_ERR;
+        break;
+    }
+  }
+  BSC_S = status;
+  // Keep the presence cache in step with the outcome
+  i2c_presence_update(i2c, addr, status);
+  return code;
+}
+
+// A register read, as the register write and a read
+static int kernel_read(i2c_bus *i2c,
+                       short   addr,
+                       short   reg,
+                       uint8_t *buf,
+                       int     len)
+{
+  uint8_t r = reg;
+  struct i2c_msg msgs[2] = {
+    { addr, 0,        1,   &r  },
+    { addr, I2C_M_RD, len, buf }
+  };
+  return outcome(i2c, addr, rdwr(i2c, msgs, 2));
+}
+
+// A single byte read
+static int kernel_read_byte(i2c_bus *i2c, short addr, uint8_t *byte)
+{
+  struct i2c_msg msg = { addr, I2C_M_RD, 1, byte };
+  return outcome(i2c, addr, rdwr(i2c, &msg, 1));
+}
+
+// A write of size bytes of content
+static int kernel_write(i2c_bus *i2c,
+                        short   addr,
+                        short   size,
+                        uint8_t *content)
+{
+  struct i2c_msg msg = { addr, 0, size, content };
+  return outcome(i2c, addr, rdwr(i2c, &msg, 1));
+}
+
+// A probe, as a single byte read just like the BSC
+static int kernel_probe(i2c_bus *i2c, short addr)
+{
+  uint8_t byte;
+  return !kernel_read_byte(i2c, addr, &byte);
+}
+
+// Run the count reads as one message set, falling back to running
+// each on its own (with retries) should the set fail
+static void run_reads(i2c_bus *i2c, i2c_txn **txns, int count)
+{
+  i2c_state *state = i2c_state_of(i2c);
+  struct i2c_msg msgs[MAX_MSGS];
+  uint8_t regs[MAX_READS];
+  // Each read is the register write then the read
+  for (int i = 0; i < count; i++)
+  {
+    regs[i] = txns[i]->reg;
+    msgs[2 * i] = (struct i2c_msg) { txns[i]->addr, 0, 1, &regs[i] };
+    msgs[2 * i + 1] = (struct i2c_msg) {
+      txns[i]->addr, I2C_M_RD, txns[i]->len, txns[i]->buf };
+  }
+  TRACE_START(mark);
+  if (rdwr(i2c, msgs, 2 * count))
+  {
+    // The driver refuses reads anywhere but last, so stop asking
+    if (errno == EOPNOTSUPP)
+    {
+      state->read_last = 1;
+    }
+    // Any error fails the whole set without saying which read it
+    // belonged to, so find out by running each alone
+    for (int i = 0; i < count; i++)
+    {
+      i2c_run_txn(i2c, txns[i]);
+    }
+    return;
+  }
+  // Every read completed, each is traced as taking the whole set
+  BSC_S = BSC_S_DONE;
+  for (int i = 0; i < count; i++)
+  {
+    TRACE_STOP(mark, txns[i]->addr, txns[i]->reg, txns[i]->len,
+               I2C_TRACE_READ, BSC_S_DONE);
+    i2c_presence_update(i2c, txns[i]->addr, BSC_S_DONE);
+    txns[i]->result = 0;
+  }
+}
+
+// Run the transactions in order, sending each run of reads as one
+// message set. Writes and mux selects run on their own, as a mux
+// only switches channel at a STOP.
+static void kernel_batch(i2c_bus *i2c, i2c_txn **txns, int count)
+{
+  i2c_state *state = i2c_state_of(i2c);
+  int i = 0;
+  while (i < count)
+  {
+    // Gather the run of reads from here
+    int run = 0;
+    while ((i + run < count) && (run < MAX_READS) &&
+           (txns[i + run]->type == I2C_TXN_READ))
+    {
+      run++;
+    }
+    // Batch the run, unless the driver will not have it
+    if ((run > 1) && !state->read_last)
+    {
+      run_reads(i2c, txns + i, run);
+      i += run;
+    }
+    else
+    {
+      i2c_run_txn(i2c, txns[i++]);
+    }
+  }
+}
+
+// Transfers made through the kernel driver
+const i2c_ops i2c_kernel_ops = {
+  /* read */      &kernel_read,
+  /* read_byte */ &kernel_read_byte,
+  /* write */     &kernel_write,
+  /* probe */     &kernel_probe,
+  /* batch */     &kernel_batch
+};
+
+// Fetch the clock the kernel runs the bus at from the device tree,
+// or assume standard mode if it does not say
+static unsigned kernel_clock(int bus)
+{
+  unsigned hz = I2C_DEFAULT_HZ;
+#ifndef TARGET_SIM
+  char path[64];
+  uint8_t be[4];
+  snprintf(path, sizeof(path),
+           "/sys/class/i2c-adapter/i2c-%d/of_node/clock-frequency", bus);
+  FILE *f = fopen(path, "rb");
+  if (f)
+  {
+    // Device tree cells are big-endian
+    if (fread(be, 1, 4, f) == 4)
+    {
+      hz = (be[0] << 24) | (be[1] << 16) | (be[2] << 8) | be[3];
+    }
+    fclose(f);
+  }
+#endif
+  return hz ? hz : I2C_DEFAULT_HZ;
+}
+
+// Open /dev/i2c-bus and return a handle for it, driven through the
+// kernel. The pins are left as the kernel has them.
+i2c_bus *i2c_kernel_init(int bus)                            // i2c_kernel_init
+{
+  char path[32];
+  unsigned long funcs = 0;
+  snprintf(path, sizeof(path), "/dev/i2c-%d", bus);
+  // Open the bus through the kernel
+  int fd = DEV_OPEN(path);
+  if (fd < 0)
+  {
+    ERR("Failed to open %s - verify i2c-dev is loaded and "
+        "the user is in the i2c group?\n\n", path);
+    exit(EXIT_FAILURE);
+  }
+  // Verify the driver takes raw message sets
+  if ((DEV_IOCTL(fd, I2C_FUNCS, &funcs) < 0) || !(funcs & I2C_FUNC_I2C))
+  {
+    ERR("The driver for %s does not support I2C_RDWR.\n\n", path);
+    exit(EXIT_FAILURE);
+  }
+  // The handle is a register block of our own, holding BSC_S
+  i2c_bus *i2c = calloc(8, sizeof(unsigned));
+  if (!i2c)
+  {
+    ERR("Failed to allocate memory (malloc) for i2c_bus.\n\n");
+    exit(EXIT_FAILURE);
+  }
+  // Claim the bus state, starting with an empty presence cache
+  i2c_state *state = i2c_state_of(i2c);
+  state->ops = &i2c_kernel_ops;
+  state->fd = fd;
+  i2c_presence_invalidate(i2c);
+  // Record the divider the kernel will have set, for timing only
+  BSC_CLOCK_DIV = (unsigned)(BSC_CORE_CLK_HZ / kernel_clock(bus)) & ~1u;
+  return i2c;
+}
@@ -8,17 +8,259 @@
 #ifndef I2C_PRIVATE_HEADER_INC
 #define I2C_PRIVATE_HEADER_INC
 
+#include <stdio.h>
+#include <pthread.h>
 #include "i2c.h"
 #include "i2c_err.h"
 #include "macros.h"
 
+///////////////////////////////////////////////////////////////////////////////
+// PER BUS STATE
+///////////////////////////////////////////////////////////////////////////////
+
+// Most buses that will be in use at once (two BSCs plus simulations)
+#define I2C_MAX_BUSES 8
+// The BSC dividers are fed from the 150Mhz core clock
+#define BSC_CORE_CLK_HZ   150000000ull
+// Standard mode clock, set on every bus at init
+#define I2C_DEFAULT_HZ    100000
+
+// Transaction queue and the thread that runs it
+typedef struct i2c_queue i2c_queue;
+struct i2c_queue {
+  // Guards everything below
+  pthread_mutex_t lock;
+  // Signalled on submission, and on completion
+  pthread_cond_t work, finished;
+  // Pending transactions, a list per priority
+  i2c_txn *head[I2C_PRIO_BULK + 1], *tail[I2C_PRIO_BULK + 1];
+  // Completed transactions that have no callback
+  i2c_txn *done_head, *done_tail;
+  // The bus thread, and whether it should keep running
+  pthread_t thread;
+  int running;
+};
+
+// A single attempt at each kind of transfer, as made by a backend.
+// Each leaves a BSC style status in BSC_S of the handle, and returns
+// 0 on success or an error code from i2c_err.h - except probe, which
+// returns 1 if the address acknowledged.
+typedef struct i2c_ops i2c_ops;
+struct i2c_ops {
+  int (*read)(i2c_bus *i2c, short addr, short reg, uint8_t *buf, int len);
+  int (*read_byte)(i2c_bus *i2c, short addr, uint8_t *byte);
+  int (*write)(i2c_bus *i2c, short addr, short size, uint8_t *content);
+  int (*probe)(i2c_bus *i2c, short addr);
+  // Runs the transactions together, may be NULL if the backend
+  // gains nothing over running them one at a time
+  void (*batch)(i2c_bus *i2c, i2c_txn **txns, int count);
+};
+
+// State kept for each bus alongside its register block
+typedef struct i2c_state i2c_state;
+struct i2c_state {
+  // The register block this state belongs to
+  i2c_bus *regs;
+  // Held for the length of each transfer and its retries, so
+  // that threads sharing the bus take turns. Taken again by the
+  // thread holding it, as batches fall back on single transfers.
+  pthread_mutex_t lock;
+  // Statistics of every wait made on the bus
+  i2c_wait_stats waits;
+  // The backend that carries out transfers
+  const i2c_ops *ops;
+  // The /dev/i2c-N file of the kernel backend (or the socket of
+  // the broker backend), and whether its driver only allows a
+  // read as the last message of a set
+  int fd, read_last;
+  // The mux selection last written through the broker backend,
+  // sent along with every request (mux_addr 0 if none)
+  uint8_t mux_addr, mux_byte;
+  // The backend wrapped while recording, and the file recorded to
+  // (or, for the replay backend, replayed from)
+  const i2c_ops *recorded;
+  FILE *rec;
+  // Attempts being recorded, so that a probe the backend makes
+  // within one is left to it rather than recorded on its own
+  int rec_depth;
+  // Addresses known to respond
+  i2c_map present;
+  // Set while i2c_dev_scan holds the bus, giving probes less time
+  int scanning;
+  // Clock for devices without a profile, and the clock the
+  // divider is currently programmed for (0 if never set)
+  unsigned default_hz, active_hz;
+  // Clock profile for each address, 0 for the bus default
+  unsigned dev_hz[128];
+  // Queue of transactions for the bus thread
+  i2c_queue queue;
+  // Channel selections run as I2C_TXN_MUX on each of the mux
+  // addresses 0x70-0x77, so that a mux caching its channel can
+  // tell it has been changed behind its back
+  unsigned long mux_selects[8];
+  // How failed transfers are retried
+  i2c_retry_policy retry;
+  // Errors seen for each address
+  i2c_dev_errors errors[128];
+};
+
+// Retry policy given to every bus on creation
+extern const i2c_retry_policy i2c_default_retry;
+// The backends, the BSC registers, the kernel driver, the broker,
+// and a recording played back
+extern const i2c_ops i2c_bsc_ops, i2c_kernel_ops, i2c_broker_ops,
+                     i2c_replay_ops;
+
+///////////////////////////////////////////////////////////////////////////////
+// BROKER PROTOCOL
+///////////////////////////////////////////////////////////////////////////////
+
+// Socket the broker of each bus listens on
+#define I2CD_SOCKET_FMT   "/tmp/i2cd-%d.sock"
+// Most bytes read or written by a single request
+#define I2CD_MAX_DATA     1024
+// Addresses a PCA9548A may be strapped to
+#define I2CD_IS_MUX(addr) (((addr) & 0x78) == 0x70)
+
+// Kinds of request, one for each of the backend ops
+typedef enum { I2CD_READ,
+               I2CD_READ_BYTE,
+               I2CD_WRITE,
+               I2CD_PROBE } i2cd_op;
+
+// A request of the broker, sent as one packet of up to len data
+typedef struct i2cd_req i2cd_req;
+struct i2cd_req {
+  // The i2cd_op, and the client's mux selection (mux_addr 0 for
+  // none) to be made before the request should it differ
+  uint8_t op, mux_addr, mux_byte;
+  // Device address and register
+  int16_t addr, reg;
+  // Bytes to read, or to write from data
+  uint16_t len;
+  uint8_t data[I2CD_MAX_DATA];
+};
+
+// The reply, sent as one packet of up to the len read
+typedef struct i2cd_rep i2cd_rep;
+struct i2cd_rep {
+  // 0 or an error code from i2c_err.h, and BSC_S at the end
+  int32_t result;
+  uint32_t status;
+  uint8_t data[I2CD_MAX_DATA];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// RECORDINGS
+///////////////////////////////////////////////////////////////////////////////
+
+// Identifies a recording, and the version of its layout
+#define I2C_REC_MAGIC     0x52433249u
+#define I2C_REC_VERSION   1
+
+// Kinds of attempt recorded, one for each of the backend ops
+typedef enum { I2C_REC_READ,
+               I2C_REC_READ_BYTE,
+               I2C_REC_WRITE,
+               I2C_REC_PROBE } i2c_rec_op;
+
+// Header at the start of a recording, followed by the attempts
+typedef struct i2c_rec_header i2c_rec_header;
+struct i2c_rec_header {
+  uint32_t magic, version;
+  // Clock the bus ran at
+  uint32_t hz;
+};
+
+// A single attempt, followed by the bytes read or written (len of
+// them, or 1 for a single byte read, or none for a probe)
+typedef struct i2c_rec_entry i2c_rec_entry;
+struct i2c_rec_entry {
+  // Time the attempt took, and BSC_S at its end
+  uint32_t ns, status;
+  // What the op returned, and the register (-1 for none)
+  int16_t result, reg;
+  uint16_t len;
+  // The i2c_rec_op, and device address
+  uint8_t op, addr;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// TRACING
+///////////////////////////////////////////////////////////////////////////////
+
+// Taken at the start of a traced transfer
+typedef struct i2c_trace_mark i2c_trace_mark;
+struct i2c_trace_mark {
+  i2c_bus *i2c;
+  uint64_t start_ns;
+  unsigned long polls;
+};
+
+// Bracket a transfer attempt on the bus i2c with TRACE_START and
+// TRACE_STOP. Without I2C_TRACE both expand to nothing, and cost
+// nothing.
+#ifdef I2C_TRACE
+#define TRACE_START(mark) \
+  i2c_trace_mark mark; i2c_trace_begin(i2c, &mark)
+#define TRACE_STOP(mark, addr, reg, len, dir, status) \
+  i2c_trace_end(&mark, addr, reg, len, dir, status)
+#else
+#define TRACE_START(mark)
+#define TRACE_STOP(mark, addr, reg, len, dir, status)
+#endif
+
+// Marks the start of a transfer attempt on the bus
+void i2c_trace_begin(i2c_bus *i2c, i2c_trace_mark *mark);
+// Records a finished transfer attempt in the ring and histograms
+void i2c_trace_end(i2c_trace_mark *mark, short addr, short reg,
+                   int len, i2c_trace_dir dir, uint32_t status);
+
 ///////////////////////////////////////////////////////////////////////////////
 // PRIVATE FUNCTION STUBS
 ///////////////////////////////////////////////////////////////////////////////
 
 // mallocs an i2c_dev struct and returns the pointer
 i2c_dev* i2c_dev_malloc(short addr);
-// Waits for the fifo to be filled
-int i2c_wait_fifo(i2c_bus *i2c);
+// Waits for any of the status bits in mask, under the wait policy
+uint32_t i2c_wait_status(i2c_bus *i2c, uint32_t mask, int bytes, long timeout);
+// Total status polls made by every wait on the bus so far
+unsigned long i2c_wait_polls(i2c_bus *i2c);
+// Estimates the wire time in nanoseconds for a transfer of bytes
+long i2c_transfer_ns(i2c_bus *i2c, int bytes);
+// Time to allow a transfer of bytes at the active clock before
+// declaring it timed out, covering the stretch window of CLKT
+long i2c_timeout_ns(i2c_bus *i2c, int bytes);
+// Switches the bus clock to the profile of addr, if different
+void i2c_clock_select(i2c_bus *i2c, short addr);
+// Converts the status at the end of a transfer into an error code
+int i2c_status_code(uint32_t status);
+// Counts a failed attempt, resets the controller, and backs off
+// returning 1 if the transfer should be tried again
+int i2c_should_retry(i2c_bus *i2c, short addr, int code, int attempt);
+// Fetches the state for the given bus, creating it if required
+i2c_state *i2c_state_of(i2c_bus *i2c);
+// Fetches the states of every bus seen, setting count
+i2c_state *i2c_states(int *count);
+// Takes and releases the bus for a transfer, may be nested
+void i2c_bus_lock(i2c_bus *i2c);
+void i2c_bus_unlock(i2c_bus *i2c);
+// Updates the presence cache from the status at the end of a transfer
+void i2c_presence_update(i2c_bus *i2c, short addr, uint32_t status);
+// Runs a single transaction on its own, storing the result
+void i2c_run_txn(i2c_bus *i2c, i2c_txn *txn);
+// Opens /dev/i2c-bus and returns a handle for it
+i2c_bus *i2c_kernel_init(int bus);
+// Connects to the broker of the bus and returns a handle for it
+i2c_bus *i2c_broker_init(int bus);
+// Opens the recording chosen for the bus and returns a handle for it
+i2c_bus *i2c_replay_init(int bus);
+// Starts recording the bus should I2C_RECORD ask for it
+void i2c_record_from_env(i2c_bus *i2c, int bus);
+// Single attempts at each transfer through the BSC registers
+int i2c_bsc_read(i2c_bus *i2c, short addr, short reg, uint8_t *buf, int len);
+int i2c_bsc_read_byte(i2c_bus *i2c, short addr, uint8_t *byte);
+int i2c_bsc_write(i2c_bus *i2c, short addr, short size, uint8_t *content);
+int i2c_bsc_probe(i2c_bus *i2c, short addr);
 
 #endif
@@ -0,0 +1,293 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: i2c_queue.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <pthread.h>
+#include "i2c_private.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// TRANSACTION QUEUE
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Rather than every caller blocking its own thread for the length of
+   a transfer, transactions may be submitted to a queue owned by the
+   bus. A single thread per bus runs them back to back, taking the
+   most urgent first so that a FIFO drain never waits behind a run of
+   configuration writes or a bus scan.
+
+   Each transaction is either handed to its callback on the bus thread
+   once complete, or, if it has none, appended to the completion queue
+   for the submitter to collect. Transactions are owned by the caller
+   and must stay valid until then.
+
+   While a queue is running, the bus thread owns the registers, so all
+   traffic for that bus should go through the queue (callbacks may use
+   the blocking functions, being on the bus thread).
+
+   Where the backend can run several transactions for the price of
+   one (the kernel's I2C_RDWR), the bus thread takes up to
+   I2C_BATCH_MAX of the most urgent at a time and runs them as a
+   batch, completing each once the whole batch is done.
+*/
+
+// Most transactions taken off the queue at once for a batch
+#define I2C_BATCH_MAX 16
+
+// Take the most urgent transaction from the queue, or NULL if empty.
+// Called with the lock held.
+static i2c_txn *pop_txn(i2c_queue *q)
+{
+  for (int p = I2C_PRIO_URGENT; p <= I2C_PRIO_BULK; p++)
+  {
+    i2c_txn *txn = q->head[p];
+    if (txn)
+    {
+      // Unlink from the head of the list
+      if (!(q->head[p] = txn->next))
+      {
+        q->tail[p] = NULL;
+      }
+      txn->next = NULL;
+      return txn;
+    }
+  }
+  return NULL;
+}
+
+// Run a single transaction against the bus, storing the result
+void i2c_run_txn(i2c_bus *i2c, i2c_txn *txn)                     // i2c_run_txn
+{
+  uint8_t channel;
+  unsigned long *selects;
+  switch (txn->type)
+  {
+    // Register read into the caller's buffer
+    case I2C_TXN_READ:
+      txn->result = i2c_read_into(i2c, txn->addr, txn->reg,
+                                  txn->buf, txn->len);
+      break;
+    // Register write from the caller's buffer
+    case I2C_TXN_WRITE:
+      txn->result = i2c_try_write_reg(i2c, txn->addr, txn->reg,
+                                      txn->buf, txn->len);
+      break;
+    // Select a mux channel, -1 for none
+    case I2C_TXN_MUX:
+      channel = txn->reg < 0 ? 0 : 1 << txn->reg;
+      txn->result = i2c_try_write_block(i2c, txn->addr, 1, &channel);
+      // Taken or not, the channel a Mux has cached is now in doubt
+      selects = &i2c_state_of(i2c)->mux_selects[txn->addr & 7];
+      __sync_fetch_and_add(selects, 1);
+      break;
+    // Single byte read into the caller's buffer
+    case I2C_TXN_READ_BYTE:
+      txn->result = i2c_read_byte_into(i2c, txn->addr, txn->buf);
+      break;
+    // Check for an acknowledgement
+    case I2C_TXN_PROBE:
+      txn->result = i2c_bus_addr_active(i2c, txn->addr) ? 0 : I2C_DEV_DEAD;
+      break;
+  }
+}
+
+// Run the count transactions, as a single batch if the backend is
+// able. Returns the number that failed.
+int i2c_run_batch(i2c_bus *i2c,                                // i2c_run_batch
+                  i2c_txn **txns,
+                  int     count)
+{
+  const i2c_ops *ops = i2c_state_of(i2c)->ops;
+  int failed = 0;
+  // Hold the bus for the whole batch
+  i2c_bus_lock(i2c);
+  if (ops->batch && (count > 1))
+  {
+    ops->batch(i2c, txns, count);
+  }
+  else
+  {
+    for (int i = 0; i < count; i++)
+    {
+      i2c_run_txn(i2c, txns[i]);
+    }
+  }
+  i2c_bus_unlock(i2c);
+  // Count the failures
+  for (int i = 0; i < count; i++)
+  {
+    failed += !!txns[i]->result;
+  }
+  return failed;
+}
+
+// Hand back a completed transaction, through its callback or the
+// completion queue. Called without the lock held.
+static void complete_txn(i2c_queue *q, i2c_txn *txn)
+{
+  // The callback now owns the txn
+  if (txn->done)
+  {
+    txn->done(txn);
+    return;
+  }
+  // Else add to the completion queue
+  pthread_mutex_lock(&q->lock);
+  if (q->done_tail)
+  {
+    q->done_tail->next = txn;
+  }
+  else
+  {
+    q->done_head = txn;
+  }
+  q->done_tail = txn;
+  pthread_cond_broadcast(&q->finished);
+  pthread_mutex_unlock(&q->lock);
+}
+
+// Bus thread, runs transactions until stopped and the queue empty
+static void *bus_thread(void *arg)
+{
+  i2c_state *state = arg;
+  i2c_queue *q = &state->queue;
+  i2c_txn *batch[I2C_BATCH_MAX];
+  // Take one at a time unless the backend batches
+  int most = state->ops->batch ? I2C_BATCH_MAX : 1;
+  pthread_mutex_lock(&q->lock);
+  while (1)
+  {
+    int count = 0;
+    while ((count < most) && (batch[count] = pop_txn(q)))
+    {
+      count++;
+    }
+    // Nothing to do, so either finish or sleep until submitted
+    if (!count)
+    {
+      if (!q->running)
+      {
+        break;
+      }
+      pthread_cond_wait(&q->work, &q->lock);
+      continue;
+    }
+    // Run the transfers without holding up submitters
+    pthread_mutex_unlock(&q->lock);
+    i2c_run_batch(state->regs, batch, count);
+    for (int i = 0; i < count; i++)
+    {
+      complete_txn(q, batch[i]);
+    }
+    pthread_mutex_lock(&q->lock);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+// Start the thread that owns the bus. Returns 0 on success.
+int i2c_queue_start(i2c_bus *i2c)                            // i2c_queue_start
+{
+  i2c_queue *q = &i2c_state_of(i2c)->queue;
+  pthread_mutex_lock(&q->lock);
+  // Verify not already running
+  if (q->running)
+  {
+    pthread_mutex_unlock(&q->lock);
+    ERR("I2C queue is already running.\n\n");
+    return I2C_QUEUE_STOPPED;
+  }
+  q->running = 1;
+  pthread_mutex_unlock(&q->lock);
+  if (pthread_create(&q->thread, NULL, &bus_thread, i2c_state_of(i2c)))
+  {
+    ERR("Failed to start the i2c bus thread.\n\n");
+    pthread_mutex_lock(&q->lock);
+    q->running = 0;
+    pthread_mutex_unlock(&q->lock);
+    return I2C_QUEUE_STOPPED;
+  }
+  return 0;
+}
+
+// Stop the bus thread once all submitted transactions have run
+void i2c_queue_stop(i2c_bus *i2c)                             // i2c_queue_stop
+{
+  i2c_queue *q = &i2c_state_of(i2c)->queue;
+  pthread_mutex_lock(&q->lock);
+  if (!q->running)
+  {
+    pthread_mutex_unlock(&q->lock);
+    return;
+  }
+  q->running = 0;
+  pthread_cond_signal(&q->work);
+  pthread_mutex_unlock(&q->lock);
+  pthread_join(q->thread, NULL);
+  // Wake anyone still waiting on completions
+  pthread_mutex_lock(&q->lock);
+  pthread_cond_broadcast(&q->finished);
+  pthread_mutex_unlock(&q->lock);
+}
+
+// Submit a transaction to run on the bus thread. Returns 0 once
+// queued, or I2C_QUEUE_STOPPED if the bus has no running queue.
+int i2c_submit(i2c_bus *i2c, i2c_txn *txn)                        // i2c_submit
+{
+  i2c_queue *q = &i2c_state_of(i2c)->queue;
+  pthread_mutex_lock(&q->lock);
+  // Checked under the lock, so the bus thread is yet to see the queue
+  // empty and exit
+  if (!q->running)
+  {
+    pthread_mutex_unlock(&q->lock);
+    return I2C_QUEUE_STOPPED;
+  }
+  // Append to the list for its priority
+  txn->next = NULL;
+  if (q->tail[txn->prio])
+  {
+    q->tail[txn->prio]->next = txn;
+  }
+  else
+  {
+    q->head[txn->prio] = txn;
+  }
+  q->tail[txn->prio] = txn;
+  pthread_cond_signal(&q->work);
+  pthread_mutex_unlock(&q->lock);
+  return 0;
+}
+
+// Count the channel selections made of the mux at addr through the
+// queue, as I2C_TXN_MUX transactions
+unsigned long i2c_mux_selects(i2c_bus *i2c, short addr)      // i2c_mux_selects
+{
+  return __sync_fetch_and_add(&i2c_state_of(i2c)->mux_selects[addr & 7], 0);
+}
+
+// Take the oldest completed transaction (without a callback) off the
+// completion queue. If block is set, waits for one to complete.
+// Returns NULL if there is none, or the queue has stopped.
+i2c_txn *i2c_complete_next(i2c_bus *i2c, int block)       // i2c_complete_next
+{
+  i2c_queue *q = &i2c_state_of(i2c)->queue;
+  pthread_mutex_lock(&q->lock);
+  while (block && !q->done_head && q->running)
+  {
+    pthread_cond_wait(&q->finished, &q->lock);
+  }
+  i2c_txn *txn = q->done_head;
+  if (txn)
+  {
+    if (!(q->done_head = txn->next))
+    {
+      q->done_tail = NULL;
+    }
+    txn->next = NULL;
+  }
+  pthread_mutex_unlock(&q->lock);
+  return txn;
+}
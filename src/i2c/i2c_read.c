@@ -13,61 +13,273 @@
 // I2C Read
 ///////////////////////////////////////////////////////////////////////////////
 
-// Read a single byte from the given addr on the given bus
-uint8_t i2c_read_byte(i2c_bus *i2c, short addr)                // i2c_read_byte
+// Whether register reads use a repeated start (default) or a
+// separate write and read, each ending in a STOP
+static int repeated_start = 1;
+
+// Select combined (repeated start) or split register reads, so that
+// the two can be compared through the wait statistics
+void i2c_set_repeated_start(int enable)           // i2c_set_repeated_start
+{
+  repeated_start = enable;
+}
+
+// Print the reason for a failed read. Used by the functions that
+// return the data read, which have no other means to report errors.
+static void report_failed_read(int code)
+{
+  // If the fifo has timed out
+  if (code == FIFO_TIMEOUT)
+  {
+    ERR("%s%s%s", 
+        "Fifo has timed out.",
+      "\nThis means the fifo did not fill, ",
+        "nor did the transfer complete.\n\n");
+  }
+  // Or if the device did not acknowledge
+  else if (code == I2C_DEV_DEAD)
+  {
+    ERR("Device did not acknowledge the read.\n\n");
+  }
+  // Or if the clock was held too long
+  else if (code == I2C_CLK_STRETCH)
+  {
+    ERR("Clock stretch timeout during the read.\n\n");
+  }
+  // Or if an unknown error
+  else
+  {
+    ERR("Unknown fifo error.\n\n");
+  }
+}
+
+// A single attempt at reading a byte from addr, through the BSC
+int i2c_bsc_read_byte(i2c_bus *i2c,                        // i2c_bsc_read_byte
+                      short   addr,
+                      uint8_t *byte)
 {
   // Clear the fifo
   BSC_C = BSC_C_CLEAR;
+  // Switch to the clock profile of the device
+  i2c_clock_select(i2c, addr);
   // Set new address
   BSC_SLAVE_ADDR = addr;
+  // Only wish to read a single byte
+  BSC_DATA_LEN = 1;
   // Clear the bus status
   BSC_S = CLEAR_STATUS;
   // Start the bus read
   BSC_C = START_READ;
   // Wait for the bus to clear
   i2c_wait_done(i2c);
+  // Keep the presence cache in step with the outcome
+  uint32_t status = BSC_S;
+  i2c_presence_update(i2c, addr, status);
+  // If the device did not acknowledge, or the transfer failed
+  int code = i2c_status_code(status);
+  if (code)
+  {
+    return code;
+  }
+  // Pull the result from the fifo
+  *byte = (uint8_t)BSC_FIFO;
+  return 0;
+}
+
+// Read a single byte from the given addr on the given bus into
+// the byte pointer, retrying under the bus policy. Returns 0 on
+// success, else an error code from i2c_err.h.
+int i2c_read_byte_into(i2c_bus *i2c,                      // i2c_read_byte_into
+                       short   addr,
+                       uint8_t *byte)
+{
+  const i2c_ops *ops = i2c_state_of(i2c)->ops;
+  int code, attempt = 0;
+  i2c_bus_lock(i2c);
+  do
+  {
+    TRACE_START(mark);
+    code = ops->read_byte(i2c, addr, byte);
+    TRACE_STOP(mark, addr, 0, 1, I2C_TRACE_READ, BSC_S);
+  } while (code && i2c_should_retry(i2c, addr, code, attempt++));
+  i2c_bus_unlock(i2c);
+  return code;
+}
+
+// Read a single byte from the given addr on the given bus
+uint8_t i2c_read_byte(i2c_bus *i2c, short addr)                // i2c_read_byte
+{
+  uint8_t byte = 0;
+  // Read into the stack byte, a dead device reads as 0
+  i2c_read_byte_into(i2c, addr, &byte);
   // Return the result in the fifo
-  return (uint8_t)BSC_FIFO;
+  return byte;
 }
 
 // Read a single byte from the given register at the given
-// addresss, on i2c_bus*
+// addresss, on i2c_bus*. Reads as 0 should the read fail.
 uint8_t i2c_read_reg(i2c_bus *i2c, short addr, short reg)       // i2c_read_reg
 {
-  // Read block of 1 byte
-  uint8_t *result = i2c_read_block(i2c, addr, reg, 1),
-          byte = result[0];
-  // Free the result pointer
-  free(result);
+  uint8_t byte = 0;
+  int code;
+  // Read block of 1 byte into the stack
+  if ((code = i2c_read_into(i2c, addr, reg, &byte, 1)))
+  {
+    report_failed_read(code);
+  }
   // Return the literal uint8_t byte
   return byte;
 }
 
-// Given an i2c bus, an array of bytes for storing the fifo
-// contents and the number of bytes left to store, pull the
-// sixteen bytes from the fifo buffer into data.
-static void flush_fifo_cache( i2c_bus *i2c,
-                              uint8_t *data,
-                              int *bytes_left )
+// Bytes in the fifo when the controller raises RXR (3/4 full)
+#define RXR_BYTES     12
+
+// A single attempt at a register read through the BSC, see
+// i2c_read_into
+int i2c_bsc_read(i2c_bus *i2c,                                  // i2c_bsc_read
+                 short   addr,
+                 short   reg,
+                 uint8_t *buf,
+                 int     len)
 {
-  // Initialise a count variable
-  int count = 16;
-  // While bytes_left does not equal 0, copy the next fifo
-  // byte into data
-  while ((*bytes_left != 0) && count--)
+  // Prep the bus ////////////////////////////////////////////
+  // Clear the fifo
+  BSC_C = BSC_C_CLEAR;
+  // Switch to the clock profile of the device
+  i2c_clock_select(i2c, addr);
+  // Set new address
+  BSC_SLAVE_ADDR = addr;
+  // Set size of transfer
+  BSC_DATA_LEN = 1;
+  // Write the register to the fifo
+  BSC_FIFO = reg;
+  // Clear status
+  BSC_S = CLEAR_STATUS;
+  // Initiate the transfer
+  BSC_C = START_WRITE;
+  if (repeated_start)
+  {
+    // Wait until the controller has taken the write, expecting no
+    // bytes so that the wait spins rather than sleeping through the
+    // window. Once TA is raised, a read queued now follows the
+    // register byte with a repeated start rather than a STOP.
+    uint32_t status = i2c_wait_status(i2c, BSC_S_TA|BSC_S_DONE, 0,
+                                      i2c_timeout_ns(i2c, 1));
+    if (!status)
+    {
+      // The controller never started, so stop it before giving up
+      BSC_C = 0;
+      return FIFO_TIMEOUT;
+    }
+    // Set length to block size
+    BSC_DATA_LEN = len;
+    if (status & BSC_S_DONE)
+    {
+      // The window has been missed and the write has ended. DONE is
+      // only cleared by writing it, starting a transfer leaves it
+      // raised, so check and clear the status as a split read does
+      // and send the read as its own transaction.
+      int code = i2c_status_code(status);
+      if (code)
+      {
+        i2c_presence_update(i2c, addr, status);
+        return code;
+      }
+      BSC_S = CLEAR_STATUS;
+      BSC_C = START_READ;
+    }
+    else
+    {
+      // Queue the read, keeping the register byte in the fifo
+      BSC_C = START_READ_RS;
+    }
+  }
+  else
+  {
+    // Wait for acknowledgement
+    i2c_wait_done(i2c);
+    // Give up now should the register write have failed
+    int code = i2c_status_code(BSC_S);
+    if (code)
+    {
+      i2c_presence_update(i2c, addr, BSC_S);
+      return code;
+    }
+    // Set length to block size
+    BSC_DATA_LEN = len;
+    // Clear the bus status
+    BSC_S = CLEAR_STATUS;
+    // Start the bus read
+    BSC_C = START_READ;
+  }
+
+  // Read block //////////////////////////////////////////////
+  // Drain the fifo as soon as bytes are available rather than
+  // once it is full, so the controller never has to stall with
+  // a full fifo while we sleep. Between drains, wait for the
+  // fifo to reach 3/4 full, leaving 4 bytes of slack for wakeup.
+  uint8_t *end = buf + len;
+  while (buf < end)
   {
-    // Get next byte
-    *data = BSC_FIFO;
-    // Increment the pointer
-    data++;
-    // Decrement the number of bytes left
-    (*bytes_left)--;
+    // Take everything currently in the fifo
+    while ((buf < end) && (BSC_S & BSC_S_RXD))
+    {
+      *buf++ = BSC_FIFO;
+    }
+    // Stop if filled, or if the transfer has ended short
+    if ((buf == end) || ((BSC_S & (BSC_S_DONE|BSC_S_RXD)) == BSC_S_DONE))
+    {
+      break;
+    }
+    // Wait for the next batch, expecting the bytes still to come
+    // up to the RXR threshold
+    int pending = (end - buf) < RXR_BYTES ? (end - buf) : RXR_BYTES;
+    if (!i2c_wait_status(i2c, BSC_S_RXR|BSC_S_DONE, pending, 
+                         i2c_timeout_ns(i2c, pending)))
+    {
+      return FIFO_TIMEOUT;
+    }
   }
+  // Keep the presence cache in step with the outcome. A NACK of
+  // either the write or the read leaves ERR raised.
+  uint32_t status = BSC_S;
+  i2c_presence_update(i2c, addr, status);
+  if (status & (BSC_S_ERR|BSC_S_CLKT))
+  {
+    return i2c_status_code(status);
+  }
+  // Return success, unless the transfer ended short
+  return (buf == end) ? 0 : FIFO_ERR;
+}
+
+// Reads len bytes from an i2c device sequentially into the
+// caller supplied buf, starting at the register on the device at
+// the given address, retrying under the bus policy. Never
+// allocates. Returns 0 on success, else I2C_DEV_DEAD,
+// I2C_CLK_STRETCH, FIFO_TIMEOUT or FIFO_ERR should it fail.
+int i2c_read_into(i2c_bus *i2c,                                // i2c_read_into
+                  short   addr,
+                  short   reg,
+                  uint8_t *buf,
+                  int     len)
+{
+  const i2c_ops *ops = i2c_state_of(i2c)->ops;
+  int code, attempt = 0;
+  i2c_bus_lock(i2c);
+  do
+  {
+    TRACE_START(mark);
+    code = ops->read(i2c, addr, reg, buf, len);
+    TRACE_STOP(mark, addr, reg, len, I2C_TRACE_READ, BSC_S);
+  } while (code && i2c_should_retry(i2c, addr, code, attempt++));
+  i2c_bus_unlock(i2c);
+  return code;
 }
 
 // Same as the read byte, just allows specification of block
 // size to read. Returns an array of uint32_t in the heap
-// that contains all the information read out of the FIFO reg
+// that contains all the information read out of the FIFO reg,
+// or NULL should the read fail
 uint8_t *i2c_read_block(i2c_bus *i2c,                         // i2c_read_block
                         short addr, 
                         short reg,
@@ -75,72 +287,20 @@ uint8_t *i2c_read_block(i2c_bus *i2c,                         // i2c_read_block
 {
   // Declare result array
   uint8_t *result = malloc(sizeof(uint8_t) * block_size);
+  int code;
   // Verify successful malloc
   if (!result)
   {
     ERR("Error allocating memory (malloc). Read failed.\n\n");
     exit(EXIT_FAILURE);
   }
-  // Prep the bus ////////////////////////////////////////////
-  // Clear the fifo
-  BSC_C = BSC_C_CLEAR;
-  // Set new address
-  BSC_SLAVE_ADDR = addr;
-  // Set size of transfer
-  BSC_DATA_LEN = 1;
-  // Write the register to the fifo
-  BSC_FIFO = reg;
-  // Clear status
-  BSC_S = CLEAR_STATUS;
-  // Initiate the transfer
-  BSC_C = START_WRITE;
-  // Wait for acknowledgement
-  i2c_wait_done(i2c);
-  // Set length to block size
-  BSC_DATA_LEN = block_size;
-  // Clear the bus status
-  BSC_S = CLEAR_STATUS;
-
-  // Read block //////////////////////////////////////////////
-  // TODO - Setup error checking for the reg transfer
-  // Start the bus read
-  BSC_C = START_READ;
-  // Initialise a count of how many times fifo has been flushed
-  // Keep track of the bytes left to transfer
-  int count = 0,
-      bytes_left = block_size,
-      code = 0;
-  // While there are bytes left
-  while (bytes_left > 0) {
-    // Wait for the fifo buffer to fill
-    switch ((code = i2c_wait_fifo(i2c)))
-    {
-      // If the transfer has complete
-      case FIFO_DONE:
-      // Or the first in first out is full
-      case FIFO_FULL:
-        // Flush the fifo cache into the next result chunk of 16 bytes
-        flush_fifo_cache( i2c, 
-                          (result + (16 * count++)), 
-                          &bytes_left );
-        // Break from the switch
-        break;
-      // Or is the fifo has timed out
-      case FIFO_TIMEOUT:
-        ERR("%s%s%s", 
-            "Fifo has timed out.",
-          "\nThis means the fifo did not fill, ",
-            "nor did the transfer complete.\n\n");
-        exit(EXIT_FAILURE);
-        break;
-      // Or if an unknown error
-      case FIFO_ERR:
-        ERR("Unknown fifo error.\n\n");
-        exit(EXIT_FAILURE);
-        break;
-    }
-  };
-  
+  // Read into the new array
+  if ((code = i2c_read_into(i2c, addr, reg, result, block_size)))
+  {
+    report_failed_read(code);
+    free(result);
+    return NULL;
+  }
   // Return the result
   // NOTE - Memory responsibility passed to calling function
   return result;
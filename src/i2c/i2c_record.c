@@ -0,0 +1,385 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: i2c_record.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "i2c_private.h"
+#include "i2c_res.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// RECORD AND REPLAY
+///////////////////////////////////////////////////////////////////////////////
+/*
+   A recording holds every transfer attempt made on a bus, with the
+   bytes read or written and how long it took, so that a run on the
+   Pi can be played back anywhere. Played back, the drivers and
+   everything above them see the same bytes in the same order, which
+   makes the cost of decoding and processing measurable on its own,
+   free of the bus.
+
+   Recording wraps the backend of the bus, so works on any of them.
+   Attempts are recorded as the backend makes them, retries and all,
+   and a wrapped backend runs batches one transaction at a time. A
+   probe the backend makes of its own accord within an attempt is
+   not recorded, as the replay makes no such probe. Attempts are
+   made holding the bus, so one thread records at a time.
+
+   The replay backend hands back what was recorded for each attempt
+   in turn, either straight away or after as long as the attempt took
+   on the bus. An attempt other than the one recorded (a different
+   op, address, register or length) fails with FIFO_ERR and is left
+   for the next, so that a driver changed since the recording is
+   caught rather than fed the wrong bytes.
+
+   Recordings are written in the byte order of the host, which is
+   little-endian on the Pi and on any likely build machine.
+*/
+
+// Recording chosen for the replay backend, and whether timed
+static const char *replay_path;
+static int replay_timed = -1;
+// Whether a replay has been warned of diverging from its recording
+static int diverged;
+
+// Monotonic clock in nanoseconds
+static uint64_t now_ns(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// Copy fmt into path, with the first %d replaced by the bus number
+static void bus_path(char *path, size_t size, const char *fmt, int bus)
+{
+  const char *at = strstr(fmt, "%d");
+  if (!at)
+  {
+    snprintf(path, size, "%s", fmt);
+    return;
+  }
+  snprintf(path, size, "%.*s%d%s", (int)(at - fmt), fmt, bus, at + 2);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RECORDING
+///////////////////////////////////////////////////////////////////////////////
+
+// Append an attempt that began at start, with its bytes, to the
+// recording of the bus
+static void record(i2c_bus *i2c, i2c_rec_entry entry,
+                   const uint8_t *data, int bytes, uint64_t start)
+{
+  i2c_state *state = i2c_state_of(i2c);
+  entry.ns = (uint32_t)(now_ns() - start);
+  entry.status = BSC_S;
+  // Attempts may be made from any thread, keep each entry whole
+  flockfile(state->rec);
+  fwrite(&entry, sizeof(entry), 1, state->rec);
+  fwrite(data, 1, bytes, state->rec);
+  funlockfile(state->rec);
+}
+
+// A register read, recording what was read
+static int record_read(i2c_bus *i2c,
+                       short   addr,
+                       short   reg,
+                       uint8_t *buf,
+                       int     len)
+{
+  i2c_state *state = i2c_state_of(i2c);
+  uint64_t start = now_ns();
+  state->rec_depth++;
+  int code = state->recorded->read(i2c, addr, reg, buf, len);
+  state->rec_depth--;
+  record(i2c, (i2c_rec_entry) { .result = code, .reg = reg, .len = len,
+                                .op = I2C_REC_READ, .addr = addr },
+         buf, len, start);
+  return code;
+}
+
+// A single byte read, recording the byte
+static int record_read_byte(i2c_bus *i2c, short addr, uint8_t *byte)
+{
+  i2c_state *state = i2c_state_of(i2c);
+  uint64_t start = now_ns();
+  state->rec_depth++;
+  int code = state->recorded->read_byte(i2c, addr, byte);
+  state->rec_depth--;
+  record(i2c, (i2c_rec_entry) { .result = code, .reg = -1, .len = 1,
+                                .op = I2C_REC_READ_BYTE, .addr = addr },
+         byte, 1, start);
+  return code;
+}
+
+// A write, recording what was written
+static int record_write(i2c_bus *i2c,
+                        short   addr,
+                        short   size,
+                        uint8_t *content)
+{
+  i2c_state *state = i2c_state_of(i2c);
+  uint64_t start = now_ns();
+  state->rec_depth++;
+  int code = state->recorded->write(i2c, addr, size, content);
+  state->rec_depth--;
+  record(i2c, (i2c_rec_entry) { .result = code, .reg = -1, .len = size,
+                                .op = I2C_REC_WRITE, .addr = addr },
+         content, size, start);
+  return code;
+}
+
+// A probe, recording whether the address acknowledged. A probe made
+// by the backend within another attempt (the BSC backend probes an
+// address missing from the presence cache before writing to it) is
+// part of that attempt, and replayed with it.
+static int record_probe(i2c_bus *i2c, short addr)
+{
+  i2c_state *state = i2c_state_of(i2c);
+  if (state->rec_depth)
+  {
+    return state->recorded->probe(i2c, addr);
+  }
+  uint64_t start = now_ns();
+  int acked = state->recorded->probe(i2c, addr);
+  record(i2c, (i2c_rec_entry) { .result = acked, .reg = -1,
+                                .op = I2C_REC_PROBE, .addr = addr },
+         NULL, 0, start);
+  return acked;
+}
+
+// The wrapped backend, each attempt recorded as it is made
+static const i2c_ops record_ops = {
+  /* read */      &record_read,
+  /* read_byte */ &record_read_byte,
+  /* write */     &record_write,
+  /* probe */     &record_probe,
+  /* batch */     NULL
+};
+
+// Start recording every attempt on the bus to path. Returns 0 on
+// success.
+int i2c_record_start(i2c_bus *i2c, const char *path)        // i2c_record_start
+{
+  i2c_state *state = i2c_state_of(i2c);
+  if (state->recorded)
+  {
+    ERR("The bus is already being recorded.\n\n");
+    return -1;
+  }
+  FILE *file = fopen(path, "wb");
+  if (!file)
+  {
+    ERR("Unable to open recording %s.\n\n", path);
+    return -1;
+  }
+  i2c_rec_header header = { I2C_REC_MAGIC, I2C_REC_VERSION,
+                            i2c_get_clock(i2c) };
+  if (fwrite(&header, sizeof(header), 1, file) != 1)
+  {
+    ERR("Failed to write recording %s.\n\n", path);
+    fclose(file);
+    return -1;
+  }
+  // Wrap the backend
+  state->rec = file;
+  state->recorded = state->ops;
+  state->ops = &record_ops;
+  return 0;
+}
+
+// Stop recording the bus, returning 0 if the recording is whole
+int i2c_record_stop(i2c_bus *i2c)                            // i2c_record_stop
+{
+  i2c_state *state = i2c_state_of(i2c);
+  if (!state->recorded)
+  {
+    return -1;
+  }
+  // Unwrap the backend
+  state->ops = state->recorded;
+  state->recorded = NULL;
+  int failed = ferror(state->rec);
+  if (fclose(state->rec) || failed)
+  {
+    ERR("Failed to write the recording, it may be cut short.\n\n");
+    failed = 1;
+  }
+  state->rec = NULL;
+  return failed ? -1 : 0;
+}
+
+// Start recording the bus should I2C_RECORD name a path
+void i2c_record_from_env(i2c_bus *i2c, int bus)
+{
+  const char *fmt = getenv("I2C_RECORD");
+  char path[256];
+  if (fmt && *fmt)
+  {
+    bus_path(path, sizeof(path), fmt, bus);
+    i2c_record_start(i2c, path);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// REPLAY BACKEND
+///////////////////////////////////////////////////////////////////////////////
+
+// Play back the next attempt of the recording, should it be of the
+// given op, addr, reg and len. Bytes read are copied into in, and
+// those written compared with out. Returns what the attempt did.
+static int replay(i2c_bus *i2c, i2c_rec_op op, short addr, short reg,
+                  int len, uint8_t *in, const uint8_t *out)
+{
+  i2c_state *state = i2c_state_of(i2c);
+  uint64_t start = now_ns();
+  i2c_rec_entry entry;
+  uint8_t data[len > 0 ? len : 1];
+  if (fread(&entry, sizeof(entry), 1, state->rec) != 1)
+  {
+    if (!diverged++)
+    {
+      ERR("The i2c recording has come to an end.\n\n");
+    }
+    BSC_S = 0;
+    return op == I2C_REC_PROBE ? 0 : FIFO_ERR;
+  }
+  // Leave an attempt other than this one for the next
+  if ((entry.op != op) || (entry.addr != (addr & 0x7f)) ||
+      (entry.reg != reg) || (entry.len != len))
+  {
+    if (!diverged++)
+    {
+      ERR("The i2c recording diverges here, expected op %d to 0x%02x "
+          "(reg %d, %d bytes).\n\n", entry.op, entry.addr, entry.reg,
+          entry.len);
+    }
+    fseek(state->rec, -(long)sizeof(entry), SEEK_CUR);
+    BSC_S = 0;
+    return op == I2C_REC_PROBE ? 0 : FIFO_ERR;
+  }
+  if (len && (fread(data, 1, len, state->rec) != (size_t)len))
+  {
+    ERR("The i2c recording is cut short.\n\n");
+    BSC_S = 0;
+    return FIFO_ERR;
+  }
+  if (in)
+  {
+    memcpy(in, data, len);
+  }
+  // Writes that differ are only warned of, the replay carries on
+  else if (out && memcmp(out, data, len) && !diverged++)
+  {
+    ERR("A write to 0x%02x differs from the i2c recording.\n\n", addr);
+  }
+  // Hold the caller for as long as the attempt took, if timed
+  if (replay_timed > 0)
+  {
+    uint64_t end = start + entry.ns;
+    struct timespec until = { end / 1000000000ull, end % 1000000000ull };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL));
+  }
+  BSC_S = entry.status;
+  i2c_presence_update(i2c, addr, entry.status);
+  return entry.result;
+}
+
+// A register read
+static int replay_read(i2c_bus *i2c,
+                       short   addr,
+                       short   reg,
+                       uint8_t *buf,
+                       int     len)
+{
+  return replay(i2c, I2C_REC_READ, addr, reg, len, buf, NULL);
+}
+
+// A single byte read
+static int replay_read_byte(i2c_bus *i2c, short addr, uint8_t *byte)
+{
+  return replay(i2c, I2C_REC_READ_BYTE, addr, -1, 1, byte, NULL);
+}
+
+// A write
+static int replay_write(i2c_bus *i2c,
+                        short   addr,
+                        short   size,
+                        uint8_t *content)
+{
+  return replay(i2c, I2C_REC_WRITE, addr, -1, size, NULL, content);
+}
+
+// A probe
+static int replay_probe(i2c_bus *i2c, short addr)
+{
+  return replay(i2c, I2C_REC_PROBE, addr, -1, 0, NULL, NULL);
+}
+
+// Transfers played back from a recording
+const i2c_ops i2c_replay_ops = {
+  /* read */      &replay_read,
+  /* read_byte */ &replay_read_byte,
+  /* write */     &replay_write,
+  /* probe */     &replay_probe,
+  /* batch */     NULL
+};
+
+// Select the replay backend, playing back the recording at path
+void i2c_set_replay(const char *path, int timed)              // i2c_set_replay
+{
+  replay_path = path;
+  replay_timed = timed;
+  i2c_set_backend(I2C_BACKEND_REPLAY);
+}
+
+// Open the recording chosen for the bus and return a handle playing
+// it back
+i2c_bus *i2c_replay_init(int bus)                            // i2c_replay_init
+{
+  const char *fmt = replay_path ? replay_path : getenv("I2C_REPLAY");
+  const char *timed = getenv("I2C_REPLAY_TIMED");
+  i2c_rec_header header;
+  char path[256];
+  if (!fmt)
+  {
+    ERR("No i2c recording chosen to replay, set I2C_REPLAY.\n\n");
+    exit(EXIT_FAILURE);
+  }
+  bus_path(path, sizeof(path), fmt, bus);
+  // Open the recording
+  FILE *file = fopen(path, "rb");
+  if (!file || (fread(&header, sizeof(header), 1, file) != 1) ||
+      (header.magic != I2C_REC_MAGIC) ||
+      (header.version != I2C_REC_VERSION))
+  {
+    ERR("%s is not an i2c recording.\n\n", path);
+    exit(EXIT_FAILURE);
+  }
+  if (replay_timed < 0)
+  {
+    replay_timed = timed && (*timed == '1');
+  }
+  // The handle is a register block of our own, holding BSC_S
+  i2c_bus *i2c = calloc(8, sizeof(unsigned));
+  if (!i2c)
+  {
+    ERR("Failed to allocate memory (malloc) for i2c_bus.\n\n");
+    exit(EXIT_FAILURE);
+  }
+  // Claim the bus state, starting with an empty presence cache
+  i2c_state *state = i2c_state_of(i2c);
+  state->ops = &i2c_replay_ops;
+  state->rec = file;
+  i2c_presence_invalidate(i2c);
+  // Run at the clock recorded, for timing only
+  BSC_CLOCK_DIV = (unsigned)(BSC_CORE_CLK_HZ /
+                             (header.hz ? header.hz : I2C_DEFAULT_HZ)) & ~1u;
+  return i2c;
+}
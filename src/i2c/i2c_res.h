@@ -26,6 +26,14 @@
 // Hex is actual offset (in byte addressable), but will
 // return offset in words
 
+// Simulated builds (TARGET=SIM) hand every access to the BSC model
+#ifdef TARGET_SIM
+#include "sim.h"
+#define BSC_REG(off)       (*sim_reg(i2c, (off) >> 2))
+#else
+#define BSC_REG(off)       (*(i2c + ((off) >> 2)))
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 // I2C Control Register    ////////////////////////////////////////////////////
 // 10  -> INTR interrupt on RX, 1/0                                       INTR
@@ -35,7 +43,7 @@
 // 5:4 -> Clear FIFO, 00 nothing, 01 clear                               CLEAR
 // 0   -> Read or Write 1/0                                               READ
 // 31:16, 14:11, 6, 3:1 -> *RESERVED*
-#define BSC_C              *(i2c + (0x00u >> 2))
+#define BSC_C              BSC_REG(0x00u)
 #define BSC_C_I2CEN         (1 << 15)
 #define BSC_C_INTR          (1 << 10)
 #define BSC_C_INTT          (1 << 9)
@@ -56,7 +64,7 @@
 // 1 -> Transfer done?   1/0                                              DONE
 // 0 -> Transfer active? 1/0                                                TA
 // 31:10 -> *RESERVED*
-#define BSC_S              *(i2c + (0x04u >> 2))
+#define BSC_S              BSC_REG(0x04u)
 #define BSC_S_CLKT          (1 << 9)
 #define BSC_S_ERR           (1 << 8)
 #define BSC_S_RXF           (1 << 7)
@@ -71,32 +79,32 @@
 // I2C Data Length Register  //////////////////////////////////////////////////
 // 15:0 -> Specifies no of bytes to write/receive                         DLEN
 // 31:16 -> *RESERVED*
-#define BSC_DATA_LEN       *(i2c + (0x08u >> 2))
+#define BSC_DATA_LEN       BSC_REG(0x08u)
 ///////////////////////////////////////////////////////////////////////////////
 // I2C Slave Address Register  ////////////////////////////////////////////////
 // 6:0 -> 7 bit slave address                                             ADDR
 // 31:7 -> *RESERVED*
-#define BSC_SLAVE_ADDR     *(i2c + (0x0cu >> 2))
+#define BSC_SLAVE_ADDR     BSC_REG(0x0cu)
 ///////////////////////////////////////////////////////////////////////////////
 // I2C FIFO Register  /////////////////////////////////////////////////////////
 // 7:0 -> Writes to FIFO, reads from FIFO                                 DATA
 // 31:8 -> *RESERVED*
-#define BSC_FIFO           *(i2c + (0x10u >> 2))
+#define BSC_FIFO           BSC_REG(0x10u)
 ///////////////////////////////////////////////////////////////////////////////
 // I2C Clock Divider Register  ////////////////////////////////////////////////
 // 15:0 -> Default 0 = div(32768)                                         CDIV
 // 31:16 -> *RESERVED*
-#define BSC_CLOCK_DIV      *(i2c + (0x14u >> 2))
+#define BSC_CLOCK_DIV      BSC_REG(0x14u)
 ///////////////////////////////////////////////////////////////////////////////
 // I2C Data Delay Register  ///////////////////////////////////////////////////
 // 31:16 -> Falling edge delay, no of clk cycles                          FEDL
 // 15:0  -> Rising edge delay, no of clk cycles                           REDL
-#define BSC_DATA_DELAY     *(i2c + (0x18u >> 2))
+#define BSC_DATA_DELAY     BSC_REG(0x18u)
 ///////////////////////////////////////////////////////////////////////////////
 // I2C Clock Stretch Timeout  /////////////////////////////////////////////////
 // 15:0 -> Clock stretch timeout value in cycles                          TOUT
 // 31:16 -> *RESERVED*
-#define BSC_CLOCK_STRETCH  *(i2c + (0x1cu >> 2))
+#define BSC_CLOCK_STRETCH  BSC_REG(0x1cu)
 ///////////////////////////////////////////////////////////////////////////////
 
 // Start I2C read macro, with enable, start transfer, 
@@ -104,6 +112,9 @@
 #define START_READ    BSC_C_I2CEN|BSC_C_ST|BSC_C_CLEAR|BSC_C_READ
 // Start I2C write macro with enable and start bits
 #define START_WRITE   BSC_C_I2CEN|BSC_C_ST
+// Start I2C read without clearing the FIFO, used to queue a read
+// behind a write in flight so that it follows a repeated start
+#define START_READ_RS BSC_C_I2CEN|BSC_C_ST|BSC_C_READ
 // Define a 'clear' status, where timeout has been exceeded,
 // error has occurred, bus reads 'DONE'
 #define CLEAR_STATUS  BSC_S_CLKT|BSC_S_ERR|BSC_S_DONE
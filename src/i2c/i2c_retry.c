@@ -0,0 +1,124 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: i2c_retry.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <time.h>
+#include <string.h>
+#include "i2c_private.h"
+#include "i2c_res.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// ERRORS AND RETRIES
+///////////////////////////////////////////////////////////////////////////////
+/*
+   A single glitch on a long capture should cost one device a few
+   retries, not the whole process. Every transfer reports one of three
+   kinds of failure...
+
+     I2C_DEV_DEAD     - the device did not acknowledge (NACK)
+     I2C_CLK_STRETCH  - a device held SCL past the stretch timeout
+     FIFO_TIMEOUT     - the transfer did not progress in time
+
+   ...each of which is counted against the addressed device, and
+   retried as many times as the bus policy allows for that kind. The
+   controller is reset between attempts, and the pause between them
+   doubles with every retry.
+*/
+
+// Policy given to every bus on creation
+const i2c_retry_policy i2c_default_retry = {
+  /* nack_retries */    2,
+  /* clkt_retries */    3,
+  /* timeout_retries */ 3,
+  /* backoff_ns */      100000l
+};
+
+// Convert the status at the end of a transfer into an error code,
+// 0 if the transfer completed cleanly
+int i2c_status_code(uint32_t status)                         // i2c_status_code
+{
+  if (status & BSC_S_CLKT)
+  {
+    return I2C_CLK_STRETCH;
+  }
+  if (status & BSC_S_ERR)
+  {
+    return I2C_DEV_DEAD;
+  }
+  if (!(status & BSC_S_DONE))
+  {
+    return FIFO_TIMEOUT;
+  }
+  return 0;
+}
+
+// Given the code of a failed attempt (the attempt'th) at a transfer
+// to addr, count the error, reset the controller and decide whether
+// to try again. Sleeps out the backoff before returning 1 to retry.
+int i2c_should_retry(i2c_bus *i2c,                          // i2c_should_retry
+                     short   addr,
+                     int     code,
+                     int     attempt)
+{
+  i2c_state *state = i2c_state_of(i2c);
+  i2c_dev_errors *errors = &state->errors[addr & 0x7f];
+  int limit;
+  // Count the error against the device
+  switch (code)
+  {
+    case I2C_DEV_DEAD:
+      errors->nacks++;
+      limit = state->retry.nack_retries;
+      break;
+    case I2C_CLK_STRETCH:
+      errors->clkts++;
+      limit = state->retry.clkt_retries;
+      break;
+    default:
+      errors->timeouts++;
+      limit = state->retry.timeout_retries;
+      break;
+  }
+  // Give up if out of retries, leaving the status for the caller
+  if (attempt >= limit)
+  {
+    errors->failures++;
+    return 0;
+  }
+  errors->retries++;
+  // Abort whatever the controller is doing and clear the flags
+  BSC_C = BSC_C_CLEAR;
+  BSC_S = CLEAR_STATUS;
+  // Back off for longer each time
+  long ns = state->retry.backoff_ns << attempt;
+  nanosleep((struct timespec[]) {{ns / 1000000000l, ns % 1000000000l}}, NULL);
+  return 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// POLICY AND COUNTER ACCESS
+///////////////////////////////////////////////////////////////////////////////
+
+// Set the retry policy for all transfers on the bus
+void i2c_set_retry_policy(i2c_bus *i2c,                 // i2c_set_retry_policy
+                          const i2c_retry_policy *policy)
+{
+  i2c_state_of(i2c)->retry = *policy;
+}
+
+// Copy the error counters for the device at addr into errors
+void i2c_get_dev_errors(i2c_bus *i2c,                     // i2c_get_dev_errors
+                        short   addr,
+                        i2c_dev_errors *errors)
+{
+  *errors = i2c_state_of(i2c)->errors[addr & 0x7f];
+}
+
+// Zero the error counters for the device at addr
+void i2c_reset_dev_errors(i2c_bus *i2c, short addr)     // i2c_reset_dev_errors
+{
+  memset(&i2c_state_of(i2c)->errors[addr & 0x7f], 0, sizeof(i2c_dev_errors));
+}
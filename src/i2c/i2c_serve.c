@@ -0,0 +1,237 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: i2c_serve.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "i2c_private.h"
+#include "i2c_res.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// BROKER (SERVER)
+///////////////////////////////////////////////////////////////////////////////
+/*
+   The broker owns the bus, driving it through whichever backend is
+   chosen, and serves clients on a unix socket - one thread for each,
+   each request a single packet. A request becomes a transaction on
+   the bus queue, so those of every client run back to back on the
+   bus thread, batched where the backend allows.
+
+   Requests carry the client's mux selection. The broker keeps the
+   selection of each mux as it will stand once everything queued has
+   run, and queues a reselection ahead of any request whose client
+   expects otherwise. Selection and request are queued together under
+   the lock, so no other client's selection can come between them.
+   Should a selection fail, the state of that mux is forgotten, and
+   the next request through it reselects.
+*/
+
+// Mux selection not known
+#define MUX_UNKNOWN -1
+
+// A client, and the request being served for it
+typedef struct i2cd_client i2cd_client;
+struct i2cd_client {
+  int fd;
+  // The request, and the reply it fills
+  i2cd_req req;
+  i2cd_rep rep;
+  // The transaction for the request, and any reselection before it
+  i2c_txn txn, select;
+  // Posted once the request has run
+  sem_t done;
+};
+
+// The bus being served
+static i2c_bus *served;
+// Held while queueing, guards the selections
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+// Selection of each mux (0x70-0x77) once the queue has run
+static short selected[8];
+
+// A selection has run, forget the mux should it have failed
+static void select_done(i2c_txn *txn)
+{
+  if (txn->result)
+  {
+    pthread_mutex_lock(&lock);
+    selected[txn->addr & 7] = MUX_UNKNOWN;
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+// The request has run, take the status and wake the client thread
+static void request_done(i2c_txn *txn)
+{
+  i2c_bus *i2c = served;
+  i2cd_client *c = txn->arg;
+  c->rep.status = BSC_S;
+  // A write to a mux is also a selection
+  if ((txn->type == I2C_TXN_WRITE) && !txn->len && I2CD_IS_MUX(txn->addr))
+  {
+    select_done(txn);
+  }
+  sem_post(&c->done);
+}
+
+// Turn the request into a transaction on the queue, ahead of it any
+// reselection the client expects. Returns 0 if queued.
+static int queue_request(i2cd_client *c)
+{
+  i2cd_req *req = &c->req;
+  i2c_txn *txn = &c->txn;
+  *txn = (i2c_txn) { .prio = I2C_PRIO_NORMAL, .addr = req->addr & 0x7f,
+                     .reg = req->reg, .buf = c->rep.data, .len = req->len,
+                     .done = &request_done, .arg = c };
+  switch (req->op)
+  {
+    case I2CD_READ:
+      txn->type = I2C_TXN_READ;
+      break;
+    case I2CD_READ_BYTE:
+      txn->type = I2C_TXN_READ_BYTE;
+      break;
+    case I2CD_PROBE:
+      txn->type = I2C_TXN_PROBE;
+      break;
+    // The first byte written goes as the register
+    case I2CD_WRITE:
+      txn->type = I2C_TXN_WRITE;
+      txn->reg = req->data[0];
+      txn->buf = req->data + 1;
+      txn->len = req->len - 1;
+      break;
+    default:
+      return FIFO_ERR;
+  }
+  pthread_mutex_lock(&lock);
+  // Put the client's mux back, should another client have moved it
+  if (req->mux_addr && (req->mux_addr != txn->addr) &&
+      (selected[req->mux_addr & 7] != req->mux_byte))
+  {
+    c->select = (i2c_txn) { I2C_TXN_WRITE, I2C_PRIO_NORMAL,
+                            req->mux_addr, req->mux_byte, NULL, 0 };
+    c->select.done = &select_done;
+    i2c_submit(served, &c->select);
+    selected[req->mux_addr & 7] = req->mux_byte;
+  }
+  // A single byte to a mux moves it for everyone
+  if ((txn->type == I2C_TXN_WRITE) && !txn->len && I2CD_IS_MUX(txn->addr))
+  {
+    selected[txn->addr & 7] = req->data[0];
+  }
+  int code = i2c_submit(served, txn);
+  pthread_mutex_unlock(&lock);
+  return code;
+}
+
+// Serve the client until it hangs up
+static void *serve_client(void *arg)
+{
+  i2cd_client *c = arg;
+  ssize_t got;
+  while ((got = recv(c->fd, &c->req, sizeof(c->req), 0)) > 0)
+  {
+    size_t header = offsetof(i2cd_req, data),
+           reply = offsetof(i2cd_rep, data);
+    // Verify the request is whole and will fit the reply
+    if ((got < (ssize_t)header) || (c->req.len > I2CD_MAX_DATA) ||
+        ((c->req.op == I2CD_WRITE) &&
+         (!c->req.len || (got < (ssize_t)(header + c->req.len)))))
+    {
+      c->rep.result = FIFO_ERR;
+      c->rep.status = 0;
+    }
+    // Else run it on the bus and wait
+    else if ((c->rep.result = queue_request(c)))
+    {
+      c->rep.status = 0;
+    }
+    else
+    {
+      sem_wait(&c->done);
+      c->rep.result = c->txn.result;
+      // Return what was read
+      if ((c->req.op == I2CD_READ) || (c->req.op == I2CD_READ_BYTE))
+      {
+        reply += c->req.len;
+      }
+    }
+    if (send(c->fd, &c->rep, reply, MSG_NOSIGNAL) < 0)
+    {
+      break;
+    }
+  }
+  close(c->fd);
+  sem_destroy(&c->done);
+  free(c);
+  return NULL;
+}
+
+// Serve the bus to other processes until the socket fails. The bus
+// is driven through the backend chosen for i2c_init.
+int i2c_broker_serve(int bus)                               // i2c_broker_serve
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  snprintf(addr.sun_path, sizeof(addr.sun_path), I2CD_SOCKET_FMT, bus);
+  // Take the bus, and start the thread that owns it
+  served = i2c_init(bus);
+  if (i2c_queue_start(served))
+  {
+    return EXIT_FAILURE;
+  }
+  for (int i = 0; i < 8; i++)
+  {
+    selected[i] = MUX_UNKNOWN;
+  }
+  // Listen, replacing the socket of any broker before us
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  unlink(addr.sun_path);
+  if ((fd < 0) || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(fd, 8))
+  {
+    ERR("Failed to listen on %s.\n\n", addr.sun_path);
+    return EXIT_FAILURE;
+  }
+  // Let clients in without sudo
+  chmod(addr.sun_path, 0666);
+  PRINTC(GREEN, "Serving i2c bus %d on %s...\n\n", bus, addr.sun_path);
+  while (1)
+  {
+    int client = accept(fd, NULL, NULL);
+    if (client < 0)
+    {
+      ERR("Failed to accept an i2c client.\n\n");
+      continue;
+    }
+    // Give the client a thread of its own
+    i2cd_client *c = calloc(1, sizeof(i2cd_client));
+    pthread_t thread;
+    if (!c)
+    {
+      ERR("Failed to allocate memory (malloc) for i2cd_client.\n\n");
+      exit(EXIT_FAILURE);
+    }
+    c->fd = client;
+    sem_init(&c->done, 0, 0);
+    if (pthread_create(&thread, NULL, &serve_client, c))
+    {
+      ERR("Failed to start a thread for an i2c client.\n\n");
+      close(client);
+      sem_destroy(&c->done);
+      free(c);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+  return 0;
+}
@@ -0,0 +1,126 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: i2c_state.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+// Required for recursive mutexes
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include "i2c_private.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// PER BUS STATE
+///////////////////////////////////////////////////////////////////////////////
+/*
+   The i2c_bus handle is nothing more than the mapped BSC register
+   block, so any state we wish to keep for a bus lives in a small
+   table alongside, found by the handle it belongs to. Buses are
+   registered by i2c_init, but any handle (such as a simulated
+   register block) is given a slot on first use.
+
+   Unless i2c_init says otherwise, a bus is driven through its BSC
+   registers.
+
+   The state is the context of the bus - its backend, clocks, lock,
+   queue, retry policy and statistics - so threads driving different
+   buses share nothing but this table, which is only ever added to.
+   Threads sharing a bus take turns through its lock, held for each
+   transfer along with its retries.
+*/
+
+// Transfers made directly through the BSC registers
+const i2c_ops i2c_bsc_ops = {
+  /* read */      &i2c_bsc_read,
+  /* read_byte */ &i2c_bsc_read_byte,
+  /* write */     &i2c_bsc_write,
+  /* probe */     &i2c_bsc_probe,
+  /* batch */     NULL
+};
+
+// Table of state for every bus handle seen
+static i2c_state states[I2C_MAX_BUSES];
+// Number of slots in use, only ever grows
+static int no_of_states = 0;
+// Held while claiming a slot
+static pthread_mutex_t claim = PTHREAD_MUTEX_INITIALIZER;
+
+// Search the slots in use for the state of the handle
+static i2c_state *find_state(i2c_bus *i2c)
+{
+  // Slots are filled before being counted, so those counted are whole
+  int count = __sync_fetch_and_add(&no_of_states, 0);
+  for (int i = 0; i < count; i++)
+  {
+    if (states[i].regs == i2c)
+    {
+      return &states[i];
+    }
+  }
+  return NULL;
+}
+
+// Fetch the state for the given bus handle, creating it
+// should this be the first time the handle has been seen
+i2c_state *i2c_state_of(i2c_bus *i2c)                           // i2c_state_of
+{
+  i2c_state *state = find_state(i2c);
+  if (state)
+  {
+    return state;
+  }
+  // Claim a slot, unless another thread has just done so
+  pthread_mutex_lock(&claim);
+  if ((state = find_state(i2c)))
+  {
+    pthread_mutex_unlock(&claim);
+    return state;
+  }
+  // Verify there is room for another
+  if (no_of_states == I2C_MAX_BUSES)
+  {
+    ERR("No room for state of more than %d i2c buses.\n\n", I2C_MAX_BUSES);
+    exit(EXIT_FAILURE);
+  }
+  // Fill the next slot, static so already zeroed, then count it
+  state = &states[no_of_states];
+  state->regs = i2c;
+  state->retry = i2c_default_retry;
+  state->ops = &i2c_bsc_ops;
+  state->fd = -1;
+  // The bus lock is recursive, batches fall back on single transfers
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&state->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+  // The queue is made ready once, whether or not it is ever started
+  pthread_mutex_init(&state->queue.lock, NULL);
+  pthread_cond_init(&state->queue.work, NULL);
+  pthread_cond_init(&state->queue.finished, NULL);
+  __sync_fetch_and_add(&no_of_states, 1);
+  pthread_mutex_unlock(&claim);
+  return state;
+}
+
+// Fetch the states of every bus seen so far
+i2c_state *i2c_states(int *count)                                 // i2c_states
+{
+  *count = __sync_fetch_and_add(&no_of_states, 0);
+  return states;
+}
+
+// Take the bus for a transfer, waiting on any other thread using
+// it. The thread holding the bus may take it again.
+void i2c_bus_lock(i2c_bus *i2c)                                 // i2c_bus_lock
+{
+  pthread_mutex_lock(&i2c_state_of(i2c)->lock);
+}
+
+// Release the bus, once taken as many times as it was released
+void i2c_bus_unlock(i2c_bus *i2c)                             // i2c_bus_unlock
+{
+  pthread_mutex_unlock(&i2c_state_of(i2c)->lock);
+}
@@ -0,0 +1,268 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: i2c_trace.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "i2c_private.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// TRACE RING
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Every transfer attempt is recorded in a fixed ring of the most
+   recent I2C_TRACE_LEN attempts, and its latency counted against
+   the device address in a log2 histogram of microseconds.
+
+   Writers claim a slot with an atomic increment of the head and
+   never block. The seq of a slot is zeroed while it is filled and
+   set last, so a snapshot can drop any slot that was mid-write or
+   has since been lapped.
+
+   Everything here only records when built with I2C_TRACE. Without
+   it the TRACE_ macros in i2c_private.h compile to nothing, and
+   saved traces can still be printed.
+*/
+
+// Records held in the ring, must be a power of two
+#define I2C_TRACE_LEN       1024
+// Histogram buckets, the last collects anything over 32ms
+#define I2C_TRACE_BUCKETS   16
+// Identifies a saved trace file
+#define I2C_TRACE_MAGIC     0x54433249u
+
+// Header at the start of a saved trace, followed by count records
+// oldest first, then the histograms
+typedef struct trace_header trace_header;
+struct trace_header {
+  uint32_t magic, count, buckets;
+};
+
+#ifdef I2C_TRACE
+// The ring, and the number of records ever claimed
+static i2c_trace_rec ring[I2C_TRACE_LEN];
+static unsigned long head;
+// Latency histograms for each address
+static uint32_t hist[128][I2C_TRACE_BUCKETS];
+
+// Histogram bucket for a latency, bucket b holds [2^b, 2^(b+1)) us
+static int bucket_of(uint64_t ns)
+{
+  int b = 0;
+  for (uint64_t us = ns / 1000; (us > 1) && (b < I2C_TRACE_BUCKETS - 1);
+       us >>= 1)
+  {
+    b++;
+  }
+  return b;
+}
+#endif
+
+// Monotonic clock in nanoseconds
+static uint64_t now_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RECORDING
+///////////////////////////////////////////////////////////////////////////////
+
+// Note the clock and polls at the start of a transfer attempt
+void i2c_trace_begin(i2c_bus *i2c,                          // i2c_trace_begin
+                     i2c_trace_mark *mark)
+{
+  mark->i2c = i2c;
+  mark->polls = i2c_wait_polls(i2c);
+  mark->start_ns = now_ns();
+}
+
+// Record the attempt begun at mark in the ring, and count its
+// latency against addr
+void i2c_trace_end(i2c_trace_mark *mark,                      // i2c_trace_end
+                   short          addr,
+                   short          reg,
+                   int            len,
+                   i2c_trace_dir  dir,
+                   uint32_t       status)
+{
+#ifdef I2C_TRACE
+  uint64_t end = now_ns();
+  // Claim the next slot, lapping the oldest
+  unsigned long seq = __sync_fetch_and_add(&head, 1);
+  i2c_trace_rec *rec = &ring[seq & (I2C_TRACE_LEN - 1)];
+  // Mark the slot as being written before filling it
+  rec->seq = 0;
+  __sync_synchronize();
+  rec->start_ns = mark->start_ns;
+  rec->end_ns = end;
+  rec->status = status;
+  rec->polls = i2c_wait_polls(mark->i2c) - mark->polls;
+  rec->len = len;
+  rec->addr = addr;
+  rec->reg = reg;
+  rec->dir = dir;
+  // Publish the slot
+  __sync_synchronize();
+  rec->seq = (uint32_t)(seq + 1);
+  __sync_fetch_and_add(&hist[addr & 0x7f][bucket_of(end - mark->start_ns)], 1);
+#endif
+}
+
+// Empty the ring and the histograms
+void i2c_trace_reset(void)                                  // i2c_trace_reset
+{
+#ifdef I2C_TRACE
+  memset(ring, 0, sizeof(ring));
+  memset(hist, 0, sizeof(hist));
+  head = 0;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SAVING AND PRINTING
+///////////////////////////////////////////////////////////////////////////////
+
+// Write every complete record in the ring, oldest first, and the
+// histograms to path. Returns 0 on success.
+int i2c_trace_save(const char *path)                         // i2c_trace_save
+{
+#ifdef I2C_TRACE
+  FILE *file = fopen(path, "wb");
+  if (!file)
+  {
+    ERR("Unable to open trace file %s.\n\n", path);
+    return -1;
+  }
+  // Take a copy of the ring as it stands
+  static i2c_trace_rec snap[I2C_TRACE_LEN];
+  trace_header header = { I2C_TRACE_MAGIC, 0, I2C_TRACE_BUCKETS };
+  unsigned long end = head,
+                start = end > I2C_TRACE_LEN ? end - I2C_TRACE_LEN : 0;
+  for (unsigned long seq = start; seq < end; seq++)
+  {
+    i2c_trace_rec rec = ring[seq & (I2C_TRACE_LEN - 1)];
+    // Skip slots being written, or already lapped
+    if (rec.seq == (uint32_t)(seq + 1))
+    {
+      snap[header.count++] = rec;
+    }
+  }
+  int failed =
+    (fwrite(&header, sizeof(header), 1, file) != 1) ||
+    (fwrite(snap, sizeof(i2c_trace_rec), header.count, file)
+        != header.count) ||
+    (fwrite(hist, sizeof(hist), 1, file) != 1);
+  if (fclose(file) || failed)
+  {
+    ERR("Failed to write trace file %s.\n\n", path);
+    return -1;
+  }
+  return 0;
+#else
+  ERR("Tracing not built in, rebuild with I2C_TRACE=1.\n\n");
+  return -1;
+#endif
+}
+
+static const char *dir_names[] = { "read", "write", "probe" };
+
+// Print the saved trace at path to stdout, either as a table of
+// records and histograms, or as csv. Returns 0 on success.
+int i2c_trace_print(const char *path, int csv)              // i2c_trace_print
+{
+  FILE *file = fopen(path, "rb");
+  trace_header header;
+  i2c_trace_rec rec;
+  uint32_t counts[128][I2C_TRACE_BUCKETS];
+  if (!file)
+  {
+    ERR("Unable to open trace file %s.\n\n", path);
+    return -1;
+  }
+  if ((fread(&header, sizeof(header), 1, file) != 1) ||
+      (header.magic != I2C_TRACE_MAGIC) ||
+      (header.buckets != I2C_TRACE_BUCKETS))
+  {
+    ERR("%s is not an i2c trace.\n\n", path);
+    fclose(file);
+    return -1;
+  }
+  // Records //////////////////////////////////////////////////
+  uint64_t first_ns = 0;
+  if (csv)
+  {
+    printf("seq,dir,addr,reg,len,start_ns,latency_ns,polls,status\n");
+  }
+  else
+  {
+    printf("   %8s | %-5s | addr | reg  |  len "
+           "| %10s | %10s | %6s | status\n",
+           "seq", "dir", "start us", "latency us", "polls");
+  }
+  for (uint32_t i = 0; i < header.count; i++)
+  {
+    if (fread(&rec, sizeof(rec), 1, file) != 1)
+    {
+      ERR("Trace file %s is truncated.\n\n", path);
+      fclose(file);
+      return -1;
+    }
+    first_ns = i ? first_ns : rec.start_ns;
+    const char *dir = rec.dir <= I2C_TRACE_PROBE ? dir_names[rec.dir] : "?";
+    if (csv)
+    {
+      printf("%u,%s,0x%02x,0x%02x,%u,%llu,%llu,%u,0x%08x\n",
+             rec.seq, dir, rec.addr, rec.reg, rec.len,
+             (unsigned long long)rec.start_ns,
+             (unsigned long long)(rec.end_ns - rec.start_ns),
+             rec.polls, rec.status);
+    }
+    else
+    {
+      printf("   %8u | %-5s | 0x%02x | 0x%02x | %4u "
+             "| %10.1f | %10.1f | %6u | 0x%08x\n",
+             rec.seq, dir, rec.addr, rec.reg, rec.len,
+             (rec.start_ns - first_ns) / 1000.0,
+             (rec.end_ns - rec.start_ns) / 1000.0,
+             rec.polls, rec.status);
+    }
+  }
+  // Histograms ///////////////////////////////////////////////
+  if (fread(counts, sizeof(counts), 1, file) != 1)
+  {
+    ERR("Trace file %s is truncated.\n\n", path);
+    fclose(file);
+    return -1;
+  }
+  fclose(file);
+  printf(csv ? "\naddr,min_us,count\n" : "\n   Latency by device:\n");
+  for (int addr = 0; addr < 128; addr++)
+  {
+    for (int b = 0; b < I2C_TRACE_BUCKETS; b++)
+    {
+      if (!counts[addr][b])
+      {
+        continue;
+      }
+      // The first bucket also holds anything under 1us
+      unsigned min_us = b ? 1u << b : 0;
+      if (csv)
+      {
+        printf("0x%02x,%u,%u\n", addr, min_us, counts[addr][b]);
+      }
+      else
+      {
+        printf("   0x%02x  >= %6u us : %u\n", addr, min_us, counts[addr][b]);
+      }
+    }
+  }
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,226 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: i2c_wait.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <time.h>
+#include <string.h>
+#include "i2c_private.h"
+#include "i2c_res.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// WAIT POLICIES
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Every transfer ends with a wait on a BSC_S status bit. Sleeping
+   between polls costs a syscall per poll, and the scheduler will
+   rarely wake us in less than 50-100us, which dwarfs the ~100us it
+   takes to move a byte at 100khz.
+
+   The adaptive policy works out how long the transfer should take
+   from the clock divider and the number of bytes left, sleeps only
+   if that is long enough to be worth the slack, then busy-polls
+   BSC_S around the expected completion. Should the device stretch
+   the clock well past the estimate, it backs off to sleeping polls
+   so that a stalled bus does not pin a core.
+
+   A transfer is only timed out once it has run past the stretch the
+   hardware allows (see i2c_clock.c), as stretching within it is
+   legitimate and is ended by CLKT otherwise.
+*/
+
+// Each byte is 8 data clocks plus an ack
+#define BSC_CLKS_PER_BYTE   9ull
+// Only sleep through transfers expected to be longer than this
+#define SLEEP_THRESHOLD_NS  250000l
+// Wake this long before the expected completion and spin
+#define SPIN_MARGIN_NS      120000l
+// Only read the clock every n spins, it is not free on the Pi
+#define SPINS_PER_CLOCK     16
+// Allow for devices stretching the clock to this multiple of
+// the expected transfer time before timing out
+#define STRETCH_FACTOR      10
+// Plus this much to cover starting the transfer
+#define TIMEOUT_SLACK_NS    1000000l
+
+// Pause between polls for the sleeping policy, and for the
+// adaptive policy once the transfer is overdue
+static long pause = 5000;
+// The policy in use by i2c_wait_status
+static i2c_wait_policy policy = I2C_WAIT_ADAPTIVE;
+
+// Nanoseconds elapsed since `start`
+static long ns_since(struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000000000l
+       + (now.tv_nsec - start->tv_nsec);
+}
+
+// Sleep the thread for ns nanoseconds
+static void sleep_ns(long ns)
+{
+  nanosleep((struct timespec[]) {{ns / 1000000000l, ns % 1000000000l}}, NULL);
+}
+
+// Estimate how long a transfer of `bytes` will take on the
+// wire, given the current clock divider. Includes the slave
+// address byte.
+long i2c_transfer_ns(i2c_bus *i2c, int bytes)               // i2c_transfer_ns
+{
+  // A divider of 0 is treated by the hardware as 32768
+  unsigned long long cdiv = BSC_CLOCK_DIV & 0xffffu;
+  if (!cdiv)
+  {
+    cdiv = 32768;
+  }
+  return (long)(((bytes + 1) * BSC_CLKS_PER_BYTE * cdiv * 1000000000ull)
+                / BSC_CORE_CLK_HZ);
+}
+
+// Longest the hardware lets a slave stretch the clock before raising
+// CLKT, from the stretch timeout programmed in SCL cycles
+static long stretch_ns(i2c_bus *i2c)
+{
+  unsigned long long cdiv = BSC_CLOCK_DIV & 0xffffu;
+  if (!cdiv)
+  {
+    cdiv = 32768;
+  }
+  return (long)(((BSC_CLOCK_STRETCH & 0xffffu) * cdiv * 1000000000ull)
+                / BSC_CORE_CLK_HZ);
+}
+
+// Time to allow a transfer of `bytes` at the active clock before it
+// is considered to have timed out. Never less than the stretch the
+// hardware allows, so a slave within it is left for CLKT to judge.
+long i2c_timeout_ns(i2c_bus *i2c, int bytes)                 // i2c_timeout_ns
+{
+  long wire = i2c_transfer_ns(i2c, bytes),
+       stretched = wire + stretch_ns(i2c);
+  wire *= STRETCH_FACTOR;
+  return (wire > stretched ? wire : stretched) + TIMEOUT_SLACK_NS;
+}
+
+// Wait until any of the bits in `mask` are raised in BSC_S, or until
+// `timeout` nanoseconds have passed. `bytes` is the number of bytes
+// the controller must move before the bits are expected, with none
+// meaning they are due at once and so spun for under any policy.
+// Returns the status register once raised, or 0 on timeout.
+uint32_t i2c_wait_status( i2c_bus  *i2c,                    // i2c_wait_status
+                          uint32_t mask,
+                          int      bytes,
+                          long     timeout )
+{
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  // Work out when the bits should appear
+  long expected = i2c_transfer_ns(i2c, bytes),
+       elapsed = 0;
+  unsigned long polls = 0, sleeps = 0;
+  uint32_t status;
+  // Sleep through the bulk of long transfers
+  if ((policy == I2C_WAIT_ADAPTIVE) && (expected > SLEEP_THRESHOLD_NS))
+  {
+    sleep_ns(expected - SPIN_MARGIN_NS);
+    sleeps++;
+  }
+  // Poll the status register
+  while (!((status = BSC_S) & mask))
+  {
+    polls++;
+    // Only consult the clock every so often while spinning
+    if ((policy != I2C_WAIT_SLEEP) && (polls % SPINS_PER_CLOCK))
+    {
+      continue;
+    }
+    // Give up once past the timeout
+    if ((elapsed = ns_since(&start)) > timeout)
+    {
+      status = 0;
+      break;
+    }
+    // Sleep between polls if the policy (or overdue transfer) calls for
+    // it, unless the bits are due at once
+    if (bytes && ((policy == I2C_WAIT_SLEEP) ||
+                  ((policy == I2C_WAIT_ADAPTIVE) && (elapsed > 2 * expected))))
+    {
+      sleep_ns(pause);
+      sleeps++;
+    }
+  }
+  elapsed = ns_since(&start);
+  // Record the statistics for this call against the bus
+  i2c_wait_stats *stats = &i2c_state_of(i2c)->waits;
+  stats->calls++;
+  stats->polls += polls;
+  stats->sleeps += sleeps;
+  stats->timeouts += !status;
+  stats->ns_total += elapsed;
+  stats->ns_expected += expected;
+  stats->ns_last = elapsed;
+  if (elapsed > stats->ns_max)
+  {
+    stats->ns_max = elapsed;
+  }
+  return status;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// POLICY AND STATISTICS ACCESS
+///////////////////////////////////////////////////////////////////////////////
+
+// Select the policy used for all subsequent waits
+void i2c_set_wait_policy(i2c_wait_policy p)             // i2c_set_wait_policy
+{
+  policy = p;
+}
+
+// Copy the wait statistics of every bus, added together, into `s`.
+// The last wait is taken as the longest of the last on each bus.
+void i2c_get_wait_stats(i2c_wait_stats *s)               // i2c_get_wait_stats
+{
+  int count;
+  i2c_state *states = i2c_states(&count);
+  memset(s, 0, sizeof(i2c_wait_stats));
+  for (int i = 0; i < count; i++)
+  {
+    i2c_wait_stats *bus = &states[i].waits;
+    s->calls += bus->calls;
+    s->polls += bus->polls;
+    s->sleeps += bus->sleeps;
+    s->timeouts += bus->timeouts;
+    s->ns_total += bus->ns_total;
+    s->ns_expected += bus->ns_expected;
+    s->ns_last = bus->ns_last > s->ns_last ? bus->ns_last : s->ns_last;
+    s->ns_max = bus->ns_max > s->ns_max ? bus->ns_max : s->ns_max;
+  }
+}
+
+// Copy the wait statistics of the bus into `s`
+void i2c_get_bus_wait_stats(i2c_bus *i2c,            // i2c_get_bus_wait_stats
+                            i2c_wait_stats *s)
+{
+  *s = i2c_state_of(i2c)->waits;
+}
+
+// Total polls made on the bus since the statistics were last reset,
+// so that tracing can take the difference across a transfer
+unsigned long i2c_wait_polls(i2c_bus *i2c)                  // i2c_wait_polls
+{
+  return i2c_state_of(i2c)->waits.polls;
+}
+
+// Zero the wait statistics of every bus
+void i2c_reset_wait_stats(void)                        // i2c_reset_wait_stats
+{
+  int count;
+  i2c_state *states = i2c_states(&count);
+  for (int i = 0; i < count; i++)
+  {
+    memset(&states[i].waits, 0, sizeof(i2c_wait_stats));
+  }
+}
@@ -12,6 +12,11 @@
 // I2C Write
 ///////////////////////////////////////////////////////////////////////////////
 
+// Capacity of the BSC fifo
+#define FIFO_BYTES    16
+// Bytes left in the fifo when the controller raises TXW (< 1/4 full)
+#define TXW_BYTES     4
+
 // Write a single byte to the addr given, on the supplied
 // i2c bus
 uint32_t i2c_write_byte(i2c_bus *i2c,                         // i2c_write_byte
@@ -24,12 +29,29 @@ uint32_t i2c_write_byte(i2c_bus *i2c,                         // i2c_write_byte
 }
 
 // Write to the register of the device specified the contents
-// of the `bytes` array
+// of the `bytes` array. Returns the bus status.
 uint32_t i2c_write_reg(i2c_bus *i2c,                           // i2c_write_reg
     short addr, 
     short reg, 
     uint8_t *bytes, 
     short size)
+{
+  // Report, rather than return, any failure
+  if (i2c_try_write_reg(i2c, addr, reg, bytes, size))
+  {
+    ERR("Write to register 0x%02x of dev 0x%02x failed.\n\n", reg, addr);
+  }
+  return BSC_S;
+}
+
+// Write to the register of the device specified the contents of
+// the `bytes` array, retrying under the bus policy. Returns 0 on
+// success, else an error code from i2c_err.h.
+int i2c_try_write_reg(i2c_bus *i2c,                        // i2c_try_write_reg
+    short addr, 
+    short reg, 
+    uint8_t *bytes, 
+    short size)
 {
   // Generate content package
   uint8_t content[size + 1];
@@ -41,41 +63,103 @@ uint32_t i2c_write_reg(i2c_bus *i2c,                           // i2c_write_reg
     content[i] = bytes[i - 1];
   }
   // Write the block with the included reg
-  uint32_t status = i2c_write_block(i2c, addr, size + 1, content);
-  // Return the i2c bus status
-  return status;
+  return i2c_try_write_block(i2c, addr, size + 1, content);
 }
 
-uint32_t i2c_write_block( i2c_bus *i2c,                      // i2c_write_block
-                          short addr, 
-                          short size, 
-                          uint8_t *content)
+// A single attempt at writing size bytes of content to the device at
+// addr as one transaction, through the BSC. The fifo only holds 16
+// bytes, so it is refilled as it drains for anything longer.
+int i2c_bsc_write(i2c_bus *i2c,                                // i2c_bsc_write
+                  short   addr,
+                  short   size,
+                  uint8_t *content)
 {
   // Verify that the addressed device is currently active and registered
-  // on the bus
-  if (!i2c_bus_addr_active(i2c, addr))
+  // on the bus. Only probes if the presence cache has not seen it.
+  if (!i2c_dev_present(i2c, addr))
   {
-    ERR("No device found at current address (0x%02x)\n\n", addr);
-    exit(I2C_DEV_DEAD);
+    // The failed probe leaves its status behind
+    int code = i2c_status_code(BSC_S);
+    return code ? code : I2C_DEV_DEAD;
   }
   // Clear the current fifo
   // TODO - Investigate if this is actually the best method
   BSC_C = BSC_C_CLEAR;
+  // Switch to the clock profile of the device
+  i2c_clock_select(i2c, addr);
   // Set dev address
   BSC_SLAVE_ADDR = addr;
   // Clear the current status
   BSC_S = CLEAR_STATUS;
   // Set the length of the transfer + addr byte
   BSC_DATA_LEN = size;
-  // Load the content into the fifo buffer
-  for (int i = 0; i < size; i++)
+  // Load as much of the content as the fifo buffer will hold
+  uint8_t *end = content + size;
+  while ((content < end) && (BSC_S & BSC_S_TXD))
   {
-    BSC_FIFO = content[i];
+    BSC_FIFO = *content++;
   }
   // Start the write
   BSC_C = START_WRITE;
+  // Keep the fifo fed for the rest of the content
+  while (content < end)
+  {
+    // Wait until the fifo is running low, or the transfer has
+    // ended early through a NACK
+    uint32_t status = i2c_wait_status(i2c, BSC_S_TXW|BSC_S_DONE,
+                        FIFO_BYTES - TXW_BYTES,
+                        i2c_timeout_ns(i2c, FIFO_BYTES - TXW_BYTES));
+    if (!status || (status & BSC_S_DONE))
+    {
+      break;
+    }
+    // Top the fifo back up
+    while ((content < end) && (BSC_S & BSC_S_TXD))
+    {
+      BSC_FIFO = *content++;
+    }
+  }
   // Wait for the i2c transfer to finish
   i2c_wait_done(i2c);
-  // Return the value of the status register
+  // Keep the presence cache in step with the outcome
+  uint32_t status = BSC_S;
+  i2c_presence_update(i2c, addr, status);
+  return i2c_status_code(status);
+}
+
+// Write size bytes of content to the device at addr as a single
+// transaction, retrying under the bus policy. Returns 0 on success,
+// else an error code from i2c_err.h.
+int i2c_try_write_block( i2c_bus *i2c,                   // i2c_try_write_block
+                         short addr, 
+                         short size, 
+                         uint8_t *content)
+{
+  const i2c_ops *ops = i2c_state_of(i2c)->ops;
+  int code, attempt = 0;
+  i2c_bus_lock(i2c);
+  do
+  {
+    TRACE_START(mark);
+    code = ops->write(i2c, addr, size, content);
+    TRACE_STOP(mark, addr, size ? content[0] : 0, size,
+               I2C_TRACE_WRITE, BSC_S);
+  } while (code && i2c_should_retry(i2c, addr, code, attempt++));
+  i2c_bus_unlock(i2c);
+  return code;
+}
+
+// Write size bytes of content to the device at addr as a single
+// transaction. Returns the bus status.
+uint32_t i2c_write_block( i2c_bus *i2c,                      // i2c_write_block
+                          short addr, 
+                          short size, 
+                          uint8_t *content)
+{
+  // Report, rather than return, any failure
+  if (i2c_try_write_block(i2c, addr, size, content))
+  {
+    ERR("Write to dev 0x%02x failed.\n\n", addr);
+  }
   return BSC_S;
 }
@@ -24,12 +24,30 @@ void print_usage(int extended)                                  // print_usage
   printf("Usage:       i2c (optional) detect\n");
   printf("             i2c read  [addr] [reg] [noOfBytes]\n");
   printf("             i2c write [addr] [reg] [noOfBytes] [content]\n");
-  printf("             i2c file  [filename]\n\n");
+  printf("             i2c file  [filename]\n");
+  printf("             i2c bench (optional) [iterations]\n");
+  printf("             i2c bench kernel [addr] [reg] [noOfBytes] "
+         "(optional) [iterations]\n");
+  printf("             i2c dump  [tracefile] (optional) csv\n");
+  printf("             i2c serve\n\n");
   if (!extended) return;
   printf("[bus]:       optional flag: supply `bus N`\n");
+  printf("[trace]:     optional flag: supply `trace FILE` to save the\n");
+  printf("             transfers made, needs a build with I2C_TRACE=1\n");
+  printf("[kernel]:    optional flag: supply `kernel` to use /dev/i2c-N\n");
+  printf("             rather than the registers, needs no sudo\n");
+  printf("[broker]:    optional flag: supply `broker` to share the bus\n");
+  printf("             served by `i2c serve` with other processes\n");
+  printf("[record]:    optional flag: supply `record FILE` to record\n");
+  printf("             every transfer, and the bytes, to FILE\n");
+  printf("[replay]:    optional flag: supply `replay FILE` to play back\n");
+  printf("             a recording in place of the bus\n");
   printf("[addr]:      device address\n");
   printf("[reg]:       data register\n");
   printf("[noOfBytes]: to either read or write\n");
   printf("[content]:   to write to device. any mix of dec or hex numbers.\n");
-  printf("[filename]:  the filename containing commands\n\n");
+  printf("[filename]:  the filename containing commands\n");
+  printf("[iterations]: transfers per wait policy benchmark, or\n");
+  printf("             sets of reads per backend benchmark\n");
+  printf("[tracefile]: a trace saved with the trace flag\n\n");
 }
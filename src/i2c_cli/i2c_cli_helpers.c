@@ -40,7 +40,7 @@ void verify_i2c_details(i2c_bus *i2c,
     exit(EXIT_FAILURE);
   }
   // Verify that the device is on the bus
-  if (!i2c_bus_addr_active(i2c, addr))
+  if (!i2c_dev_present(i2c, addr))
   {
     // If it's not, then exit with error
     ERR("Device (0x%02x) not found on bus. \
@@ -5,6 +5,7 @@
 // PA Consulting - Lawrence Jones
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <time.h>
 #include "i2c/i2c_res.h"
 #include "i2c_cli_private.h"
 
@@ -45,8 +46,18 @@ void process_command(i2c_bus *i2c,                           // process_command
     verify_arg_count(/* expected */ 2, /* got */ no_of_tokens);
     PRINTC(GREEN, "Reading %d bytes from dev 0x%02x at \
 register 0x%02x...\n\n", bytes, addr, reg);
-    // Initiate read from dev
-    uint8_t *read = i2c_read_block(i2c, addr, reg, bytes);
+    // Initiate read from dev into the stack, timing the transfer
+    uint8_t read[bytes];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (i2c_read_into(i2c, addr, reg, read, bytes))
+    {
+      ERR("Read from dev 0x%02x failed.\n\n", addr);
+      return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) 
+                + (end.tv_nsec - start.tv_nsec) / 1e9;
     // For all bytes received
     for (int i = 0; i < bytes; i++)
     {
@@ -57,9 +68,13 @@ register 0x%02x...\n\n", bytes, addr, reg);
     }
     PRINTC(GREEN, "\nFinished read. I2C bus status is \
 0x%03x / ", BSC_S);
-    PRINT_BIN_BYTE(BSC_S, "\n\n");
-    // Free the reading array
-    free(read);
+    PRINT_BIN_BYTE(BSC_S, "\n");
+    // Report the throughput against the most the clock allows,
+    // 9 clocks per byte from the 150Mhz core clock
+    unsigned cdiv = BSC_CLOCK_DIV & 0xffffu;
+    cdiv = cdiv ? cdiv : 32768;
+    PRINTC(GREEN, "Achieved %.0f bytes/s (bus limit %.0f bytes/s).\n\n",
+           bytes / secs, 150e6 / (9.0 * cdiv));
   } 
   if (!strcmp(tokens[0], "write")) // **WRITE**
   // write [addr] [reg] [bytes] [content]
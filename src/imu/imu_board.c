@@ -6,3 +6,326 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "imu_private.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include "dev/mpu3300.h"
+#include "dev/itg3050.h"
+#include "dev/pca9548a.h"
+#include "macros.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// PARALLEL ACQUISITION
+///////////////////////////////////////////////////////////////////////////////
+
+// Draws on gyros as given by triples of model, bus and path, eg...
+//
+//   imu acquire 10 50 mpu 0 0x74/1/0x69 mpu 1 0x74/1/0x69
+//
+// draining both every 50ms for 10 seconds, a thread for each bus.
+int imu_board_acquire(char **tokens, int argc)           // imu_board_acquire
+{
+  // Verify the seconds and interval, then whole triples
+  if ((argc < 7) || ((argc - 4) % 3))
+  {
+    ERR("Incorrect arguments.\nCorrect usage: imu acquire SECONDS MS "
+        "DEV BUS MUX/CHANNEL/DEV [DEV BUS MUX/CHANNEL/DEV...]\n\n");
+    return 1;
+  }
+  double seconds = atof(tokens[2]), interval_ms = atof(tokens[3]);
+  if ((seconds <= 0) || (interval_ms <= 0))
+  {
+    ERR("Both the seconds and the interval must be positive.\n\n");
+    return 1;
+  }
+  int count = (argc - 4) / 3;
+  if (count > DEV_ACQ_BUSES * DEV_ACQ_SENSORS)
+  {
+    ERR("Cannot acquire from more than %d gyros.\n\n",
+        DEV_ACQ_BUSES * DEV_ACQ_SENSORS);
+    return 1;
+  }
+  Sensor *sensors[DEV_ACQ_BUSES * DEV_ACQ_SENSORS];
+  // One handle for each bus, so that its sensors share a thread
+  i2c_bus *buses[2] = { NULL, NULL };
+  // One struct for each mux, so that its cached channel is shared
+  Mux *muxes[DEV_ACQ_BUSES * DEV_ACQ_SENSORS];
+  int mux_count = 0;
+  for (int i = 0; i < count; i++)
+  {
+    char **t = &tokens[4 + 3 * i];
+    int bus = DEX_TO_INT(t[1]), mux_addr, mux_chan, gyro_addr, err;
+    // Verify the bus, then the path
+    if (!(bus == 0 || bus == 1))
+    {
+      ERR("Only two i2c buses available (0 or 1). %d is not valid.\n\n", bus);
+      return 1;
+    }
+    if ((err = imu_parse_path(t[2], &mux_addr, &mux_chan, &gyro_addr)))
+    {
+      return err;
+    }
+    // Init the bus once, then the gyro behind its mux
+    if (!buses[bus])
+    {
+      buses[bus] = i2c_init(bus);
+    }
+    i2c_bus *i2c = buses[bus];
+    Mux *pca = NULL;
+    for (int m = 0; !pca && (m < mux_count); m++)
+    {
+      if ((muxes[m]->i2c == i2c) && (muxes[m]->i2c_addr == mux_addr))
+      {
+        pca = muxes[m];
+      }
+    }
+    if (!pca)
+    {
+      pca = muxes[mux_count++] = pca_init(i2c, mux_addr);
+    }
+    if (!strcmp(t[0], "mpu"))
+    {
+      sensors[i] = mpu_init(i2c, gyro_addr, pca, mux_chan, NULL);
+    }
+    else if (!strcmp(t[0], "itg"))
+    {
+      sensors[i] = itg_init(i2c, gyro_addr, pca, mux_chan, NULL);
+    }
+    else
+    {
+      ERR("Gyro `%s` is unsupported.\n\n", t[0]);
+      return 1;
+    }
+    if (!sensors[i])
+    {
+      ERR("Failed to init the gyro at %s on bus %d.\n\n", t[2], bus);
+      return 1;
+    }
+  }
+  // Drain until done, then report what each bus managed
+  DevAcquire acq = { .sensors = sensors, .count = count,
+                     .interval_ns = (long)(interval_ms * 1e6),
+                     .seconds = seconds };
+  printf("Acquiring from %d gyros for %.1fs...\n\n", count, seconds);
+  int err = dev_acquire(&acq);
+  if (!err)
+  {
+    dev_acquire_print(&acq);
+  }
+  return err;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// BOARD LAYOUT
+///////////////////////////////////////////////////////////////////////////////
+/*
+   The board has two sides, one on each bus, each with a PCA9548A at
+   0x74. Behind it are an MPU3300 at 0x69 and an ITG3050 at 0x68 on
+   channel 0, and an ITG3050 at 0x69 on channel 1. The L3G gyros
+   have no driver yet, and are left out. Both muxes answer to 0x74,
+   so could never share a bus, and are not cascaded.
+
+   The MPU3300s power up asleep, so are woken as they are brought up.
+
+   Every gyro samples at 100hz into its fifo, x, y and z only. With
+   three gyros to a bus the data takes a sixth of a 100khz bus, and
+   draining is left the rest, however the gyros were left by a past
+   run.
+*/
+
+// Address of the pca on each side
+#define BOARD_PCA 0x74
+// Rate and fifo contents of every gyro
+#define BOARD_FIFO "samplerate:100hz, fifo_selection:xg|yg|zg"
+
+// Where each gyro of the board sits, and its place in the Board
+static const struct {
+  const char *name;
+  model_t model;
+  int bus, chan, addr;
+  size_t slot;
+  // Applied over the defaults as the gyro is brought up
+  const char *config;
+} board_layout[] = {
+  { "mpu_1", MPU3300, 0, 0, 0x69, offsetof(Board, mpu_1),
+    "sleep:off, " BOARD_FIFO ", fifo_en:on" },
+  { "itg_1", ITG3050, 0, 0, 0x68, offsetof(Board, itg_1),
+    BOARD_FIFO ", fifo_en:yes" },
+  { "itg_2", ITG3050, 0, 1, 0x69, offsetof(Board, itg_2),
+    BOARD_FIFO ", fifo_en:yes" },
+  { "mpu_2", MPU3300, 1, 0, 0x69, offsetof(Board, mpu_2),
+    "sleep:off, " BOARD_FIFO ", fifo_en:on" },
+  { "itg_3", ITG3050, 1, 0, 0x68, offsetof(Board, itg_3),
+    BOARD_FIFO ", fifo_en:yes" },
+  { "itg_4", ITG3050, 1, 1, 0x69, offsetof(Board, itg_4),
+    BOARD_FIFO ", fifo_en:yes" }
+};
+
+#define BOARD_GYROS (sizeof(board_layout) / sizeof(board_layout[0]))
+
+// The gyro of the board in the slot given by the layout
+#define BOARD_SLOT(b, i) \
+  (*(Sensor **)((char *)(b) + board_layout[i].slot))
+
+// Init the muxes and every gyro of the board that responds, warning
+// of those that do not. Returns how many gyros were found.
+static int board_init(Board *b)
+{
+  int found = 0;
+  i2c_bus *buses[2] = { i2c_init(0), i2c_init(1) };
+  *b = (Board) { .pca_1 = pca_init(buses[0], BOARD_PCA),
+                 .pca_2 = pca_init(buses[1], BOARD_PCA) };
+  for (int i = 0; i < BOARD_GYROS; i++)
+  {
+    i2c_bus *i2c = buses[board_layout[i].bus];
+    Mux *pca = board_layout[i].bus ? b->pca_2 : b->pca_1;
+    Sensor *s = (board_layout[i].model == MPU3300)
+      ? mpu_init(i2c, board_layout[i].addr, pca, board_layout[i].chan, NULL)
+      : itg_init(i2c, board_layout[i].addr, pca, board_layout[i].chan, NULL);
+    if (s)
+    {
+      // Defaults first, the gyro may hold the settings of a past run
+      s->reset(s);
+      // The config is tokenised in place, so is copied first
+      char config[128];
+      strcpy(config, board_layout[i].config);
+      s->config(s, config);
+    }
+    else
+    {
+      printf("Warning: %s not found on bus %d, channel %d at 0x%02x.\n\n",
+             board_layout[i].name, board_layout[i].bus,
+             board_layout[i].chan, board_layout[i].addr);
+      continue;
+    }
+    BOARD_SLOT(b, i) = s;
+    found++;
+  }
+  return found;
+}
+
+// Print how many selects of each mux of the board reached the bus
+static void board_print_muxes(Board *b)
+{
+  Mux *pcas[2] = { b->pca_1, b->pca_2 };
+  for (int i = 0; i < 2; i++)
+  {
+    printf("  Mux %d : %lu selects, %lu skipped, %lu written, "
+           "%lu read back\n", i + 1, pcas[i]->selects, pcas[i]->skipped,
+           pcas[i]->writes, pcas[i]->verifies);
+  }
+  printf("\n");
+}
+
+// Dealloc the gyros and muxes of the board
+static void board_dealloc(Board *b)
+{
+  for (int i = 0; i < BOARD_GYROS; i++)
+  {
+    if (BOARD_SLOT(b, i))
+    {
+      BOARD_SLOT(b, i)->dealloc(&BOARD_SLOT(b, i));
+    }
+  }
+  if (b->pca_1)
+  {
+    b->pca_1->dealloc(&b->pca_1);
+  }
+  if (b->pca_2)
+  {
+    b->pca_2->dealloc(&b->pca_2);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// BOARD RUN
+///////////////////////////////////////////////////////////////////////////////
+
+// Writes each frame as a line of the time, sequence and every axis
+static void write_frame(DevFrame *f, void *arg)
+{
+  FILE *out = arg;
+  fprintf(out, "%llu,%lu", (unsigned long long)f->t_ns, f->seq);
+  for (int i = 0; i < f->count; i++)
+  {
+    // A gyro yet to give a sample leaves its fields empty
+    if (f->missing[i])
+    {
+      fprintf(out, ",,,");
+      continue;
+    }
+    fprintf(out, ",%d,%d,%d", f->x[i], f->y[i], f->z[i]);
+  }
+  fprintf(out, "\n");
+}
+
+// Drains every gyro of the board for the seconds given, writing the
+// frames aligned in time to the path given, else stdout, eg...
+//
+//   imu run 10 /tmp/board.csv
+//
+// as a header of the gyros, then a line for each frame.
+int imu_board_run(char **tokens, int argc)                   // imu_board_run
+{
+  Board board;
+  Sensor *gyros[BOARD_GYROS];
+  double seconds = (argc > 2) ? atof(tokens[2]) : 0;
+  if (seconds <= 0)
+  {
+    ERR("Incorrect arguments.\nCorrect usage: imu run SECONDS [PATH]\n\n");
+    return 1;
+  }
+  FILE *out = (argc > 3) ? fopen(tokens[3], "w") : stdout;
+  if (!out)
+  {
+    ERR("Unable to open `%s` for the frames.\n\n", tokens[3]);
+    return 1;
+  }
+  int count = board_init(&board);
+  if (!count)
+  {
+    ERR("No gyros of the board responded.\n\n");
+    board_dealloc(&board);
+    return 1;
+  }
+  DevSched *sched = dev_sched_malloc(DEV_STREAM_FILL, seconds,
+                                     &write_frame, out);
+  for (int i = 0, n = 0; i < BOARD_GYROS; i++)
+  {
+    if ((gyros[n] = BOARD_SLOT(&board, i)))
+    {
+      dev_sched_add(sched, gyros[n++]);
+    }
+  }
+  // Refuse before writing anything should the buses not keep up
+  int err = dev_sched_plan(sched);
+  if (!err)
+  {
+    PRINTC(GREEN, "Running the board's %d gyros for %.1fs...\n\n",
+           count, seconds);
+    // The header names the gyros in the order of their axes
+    fprintf(out, "t_ns,seq");
+    for (int i = 0; i < BOARD_GYROS; i++)
+    {
+      if (BOARD_SLOT(&board, i))
+      {
+        fprintf(out, ",%s_x,%s_y,%s_z", board_layout[i].name,
+                board_layout[i].name, board_layout[i].name);
+      }
+    }
+    fprintf(out, "\n");
+    err = dev_sched_run(sched);
+  }
+  if (out != stdout)
+  {
+    fclose(out);
+  }
+  if (!err)
+  {
+    dev_sched_print(sched);
+    board_print_muxes(&board);
+  }
+  dev_sched_dealloc(&sched);
+  board_dealloc(&board);
+  return err;
+}
@@ -7,6 +7,8 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <signal.h>
+#include <time.h>
 #include "imu_private.h"
 #include "dev/mpu3300.h"
 #include "dev/itg3050.h"
@@ -21,6 +23,11 @@ static int imu_gyro_read_axes(Sensor *gyro)
 {
   // Attempt a read and print results
   Axes *ax = gyro->read(gyro, HOST);
+  // Return failure if the read did not succeed
+  if (ax == NULL)
+  {
+    return 1;
+  }
   printf("The axes readings are...\n\n");
   printf("  X : %d\n  Y : %d\n  Z : %d\n\n", 
     (int)ax->x, (int)ax->y, (int)ax->z);
@@ -36,24 +43,28 @@ static int imu_gyro_read_axes(Sensor *gyro)
 
 static int imu_gyro_read_burst(Sensor *gyro)
 {
-  // Attempt a burst read and print results
-  Axes *head = gyro->read(gyro, FIFO),
-       *ax = head;
+  // Attempt a burst read into a batch holding a full fifo
+  SampleBatch *b = batch_malloc(DEV_BATCH_SAMPLES);
+  int err = gyro->read_batch(gyro, FIFO, b);
+  if (err)
+  {
+    batch_dealloc(&b);
+    return err;
+  }
+  // Print results
   printf("The axes readings are...\n\n");
   printf  ("             +---------+---------+---------+\n");
   printf  ("             |    X    |    Y    |    Z    |\n");
   printf  ("             +---------+---------+---------+\n");
-  int count = 0;
-  while (ax)
+  for (int i = 0; i < b->count; i++)
   {
     printf(" %3d -       | %7d | %7d | %7d |\n", 
-      count++, (short)ax->x, (short)ax->y, (short)ax->z);
-    ax = ax->next;
+      i, b->x[i], b->y[i], b->z[i]);
   }
   // Print final clearing line
   printf("\n");
-  // Deallocate the returned axes
-  axes_dealloc(&head);
+  // Deallocate the batch
+  batch_dealloc(&b);
   // Return success
   return 0;
 }
@@ -72,14 +83,101 @@ static int imu_gyro_config(Sensor *gyro, char* config_str)
   return 0;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// GYRO PIPE
+///////////////////////////////////////////////////////////////////////////////
+
+static int imu_gyro_pipe(Sensor *gyro, char *path, char *seconds, char *pin,
+                         char *drdy_config)
+{
+  DevStreamStats stats;
+  GpioEvent *line = NULL;
+  sigset_t stop;
+  int sig;
+  // Stream for the seconds given, else (or given 0) until interrupted
+  double secs = seconds ? atof(seconds) : 0;
+  if (seconds && (secs < 0 || (!secs && strcmp(seconds, "0"))))
+  {
+    ERR("The duration `%s` is not a number of seconds.\n\n", seconds);
+    return 1;
+  }
+  // Given the gpio the INT pin is wired to, drain as it signals
+  if (pin && !(line = gpio_event_open(atoi(pin), "rising")))
+  {
+    return 1;
+  }
+  // The line only signals with the data ready interrupt enabled
+  if (line)
+  {
+    gyro->config(gyro, drdy_config);
+  }
+  // Take interrupts as a signal to stop, not to exit, before the
+  // stream thread starts and inherits the mask
+  sigemptyset(&stop);
+  sigaddset(&stop, SIGINT);
+  sigaddset(&stop, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop, NULL);
+  int err = dev_pipe_irq(gyro, path, line);
+  if (err)
+  {
+    pthread_sigmask(SIG_UNBLOCK, &stop, NULL);
+    gpio_event_close(&line);
+    return err;
+  }
+  PRINTC(GREEN, "Piping from 0x%02x into `%s`...\n\n", gyro->i2c_addr, path);
+  if (secs)
+  {
+    struct timespec wait = { (time_t)secs,
+                             (long)((secs - (time_t)secs) * 1e9) };
+    sigtimedwait(&stop, NULL, &wait);
+  }
+  else
+  {
+    sigwait(&stop, &sig);
+  }
+  // Take the stats before the stream is gone
+  dev_stream_stats(gyro, &stats);
+  dev_pipe_close(gyro);
+  gpio_event_close(&line);
+  pthread_sigmask(SIG_UNBLOCK, &stop, NULL);
+  printf("Stream from 0x%02x...\n\n", gyro->i2c_addr);
+  dev_stream_print(&stats);
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GYRO PLAN
+///////////////////////////////////////////////////////////////////////////////
+
+static int imu_gyro_plan(Sensor *gyro, char *interval_ms)
+{
+  DevPlan plan;
+  // Plan draining every interval, 50ms unless given
+  double interval_s = (interval_ms ? atof(interval_ms) : 50) / 1e3;
+  if (interval_s <= 0)
+  {
+    ERR("The interval `%s` is not a number of ms.\n\n", interval_ms);
+    return 1;
+  }
+  // Allow the fifo to fill to 80% between drains
+  int err = dev_plan(&gyro, 1, interval_s, 0.8, &plan);
+  if (err == DEV_NOT_RESPOND)
+  {
+    return err;
+  }
+  printf("Bus plan for draining 0x%02x...\n\n", gyro->i2c_addr);
+  dev_plan_print(&plan);
+  return err;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // HELPERS
 ///////////////////////////////////////////////////////////////////////////////
 
-static int parse_path ( char *token, 
-                        int  *mux_addr, 
-                        int  *mux_chan, 
-                        int  *gyro_addr )
+int imu_parse_path ( char *token,                             // imu_parse_path
+                     int  *mux_addr, 
+                     int  *mux_chan, 
+                     int  *gyro_addr )
 {
   // Create a temporary var for a copied token
   char *_token = malloc(sizeof(char) * strlen(token) + 1);
@@ -147,7 +245,7 @@ int imu_gyro_route(i2c_bus *i2c, short addr, char **tokens, int argc)
   // Extract the mux address and the gyro address
   int mux_addr, mux_chan, gyro_addr, err;
   // Verify and set properties
-  if ((err = parse_path(tokens[3], &mux_addr, &mux_chan, &gyro_addr)))
+  if ((err = imu_parse_path(tokens[3], &mux_addr, &mux_chan, &gyro_addr)))
   {
     // Return failure
     return err;
@@ -215,10 +313,21 @@ int imu_gyro_route(i2c_bus *i2c, short addr, char **tokens, int argc)
         supported = 1;
       }
       // Else if piping
-      else if (!strcmp(tokens[4], "pipe"))
+      else if (!strcmp(tokens[4], "pipe"))                        // PIPE
+      {
+        // Stream into the pipe for the seconds given, else until killed,
+        // on the INT line of the gpio given
+        imu_gyro_pipe(gyro, tokens[5], argc > 6 ? tokens[6] : NULL,
+                      argc > 7 ? tokens[7] : NULL,
+                      (model == MPU3300)
+                        ? "data_ready_en:on" : "raw_rdy_en:yes");
+        supported = 1;
+      }
+      // Else if planning the bus
+      else if (!strcmp(tokens[4], "plan"))                        // PLAN
       {
-        // Initialise pipe
-        gyro->pipe(gyro, tokens[5]);
+        // Print the bus plan for the interval, if given
+        imu_gyro_plan(gyro, argc > 5 ? tokens[5] : NULL);
         supported = 1;
       }
     default:
@@ -16,8 +16,10 @@
 // TYPEDEFS
 ///////////////////////////////////////////////////////////////////////////////
 
+typedef struct Board Board;
+
 struct Board {
-  Mux *pca_1, *pca_2; 
+  Mux *pca_1, *pca_2;
   Sensor *mpu_1,  *mpu_2,  //  < Have
          *itg_1,  *itg_2,  //  < auxiliary
          *itg_3,  *itg_4,  //  < sensors.
@@ -33,5 +35,11 @@ struct Board {
 int imu_gyro_route(i2c_bus *i2c, short addr, char **tokens, int argc);
 // Route the pca commands
 int imu_pca_route(i2c_bus *i2c, short addr, char **tokens, int argc);
+// Parse a MUX/CHANNEL/DEV path, returning 0 if valid
+int imu_parse_path(char *token, int *mux_addr, int *mux_chan, int *gyro_addr);
+// Drain gyros across the buses in parallel, a thread per bus
+int imu_board_acquire(char **tokens, int argc);
+// Drain every gyro of the board, emitting frames aligned in time
+int imu_board_run(char **tokens, int argc);
 
 #endif
@@ -5,6 +5,7 @@
 // PA Consulting - Lawrence Jones
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <stdlib.h>
 #include "i2c.h"
 #include "imu_private.h"
 #include "dev/mpu3300.h"
@@ -63,14 +64,30 @@ static int verify_tokens(int *bus, short *addr, char **tokens, int argc)
 //      imu  | [dev] | [bus] |     [addr]    | [action] |  [params]
 // eg.  imu  |  mpu  |   1   |  0x74/1/0x69  |  config  | "i2c_bypass:on"
 //      imu  |  pca  |   0   |      0x74     |  test    |
+// Or, draining gyros on both buses at once...
+//      imu  acquire [secs] [ms] [dev] [bus] [path] ([dev] [bus] [path]...)
+// Or, draining every gyro of the board into frames aligned in time...
+//      imu  run [secs] ([path])
+// Or, benchmarking the decoding of fifo frames...
+//      imu  bench [iterations]
 int imu_route(char **tokens, int argc)
 {
   printf("\n");
-  // Check for simple run command
-  if (!strcmp(tokens[1], "run"))
+  // Check for simple run command, draining the whole board
+  if (!strcmp(tokens[1], "run"))                                    // RUN
   {
-    ERR("To be implemented.\n\n"); 
-  } 
+    return imu_board_run(tokens, argc);
+  }
+  // Else if benchmarking the fifo decoder
+  else if (!strcmp(tokens[1], "bench"))                             // BENCH
+  {
+    dev_bench_decode(argc > 2 ? atoi(tokens[2]) : 100000);
+  }
+  // Else if draining gyros across buses
+  else if (!strcmp(tokens[1], "acquire"))                           // ACQUIRE
+  {
+    return imu_board_acquire(tokens, argc);
+  }
   else
   {
     // Declare variables
@@ -0,0 +1,105 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: sim.h
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef SIM_HEADER_INC
+#define SIM_HEADER_INC
+
+#include <stdint.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// TYPEDEFS / STRUCTS
+///////////////////////////////////////////////////////////////////////////////
+
+// A device model attached to a simulated bus. The BSC model calls
+// into it for every byte that crosses the wire.
+typedef struct sim_dev sim_dev;
+struct sim_dev {
+  // Address the device answers to
+  uint8_t addr;
+  // Called once the address byte has been sent, return 0 to NACK
+  int (*start)(sim_dev *dev, int read);
+  // Called with each byte written by the master
+  void (*write)(sim_dev *dev, uint8_t byte);
+  // Called for each byte read by the master
+  uint8_t (*read)(sim_dev *dev);
+  // Finds a device reached through this one (a mux), may be NULL
+  sim_dev *(*route)(sim_dev *dev, uint8_t addr);
+  // State of the model
+  void *model;
+  // Next device on the same bus, or mux channel
+  sim_dev *next;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// SIM INTERFACE
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Only linked into builds made with TARGET=SIM, which redirect
+   get_mmap to sim_mmap and pass every peripheral register access
+   through sim_reg. Off the Pi, this is the whole of the hardware.
+*/
+
+/////////////////////////////////////////////////////////////
+// Sim Peripherals //////////////////////////////////////////
+// Returns the simulated register block at the physical base
+volatile unsigned   *sim_mmap           (  int base  );
+// Returns the word to be accessed at the given index of the
+// block, after applying the effects of the last access
+volatile unsigned   *sim_reg            (  volatile unsigned *block,
+                                           unsigned word  );
+// Drives the level of an input pin, as an external device would
+void                sim_gpio_drive      (  int pin,
+                                           int level  );
+
+/////////////////////////////////////////////////////////////
+// Sim Kernel Driver ////////////////////////////////////////
+// Opens the simulated /dev/i2c-N, returning a descriptor for
+// sim_i2cdev_ioctl, or -1 with errno set
+int                 sim_i2cdev_open     (  const char *path  );
+// Carries out I2C_FUNCS and I2C_RDWR on a simulated bus as the
+// kernel driver would, returning -1 with errno set on failure
+int                 sim_i2cdev_ioctl    (  int fd,
+                                           unsigned long request,
+                                           void *arg  );
+// Sets whether message sets with a read anywhere but last are
+// refused with EOPNOTSUPP, as the bcm2835 driver does. Off by
+// default, as most drivers take any set.
+void                sim_i2cdev_read_last(  int enforce  );
+
+/////////////////////////////////////////////////////////////
+// Sim Board ////////////////////////////////////////////////
+// Attaches the device to the given bus (0 or 1)
+void                sim_attach          (  int bus,
+                                           sim_dev *dev  );
+// Attaches the device behind the given channel of a mux model
+void                sim_mux_attach      (  sim_dev *mux,
+                                           int channel,
+                                           sim_dev *dev  );
+// Populates both buses as the IMU board, a PCA9548A at 0x74 with
+// an MPU3300 (0x69) and ITG3050 (0x68) on channel 0, and an
+// ITG3050 (0x69) on channel 1. Their INT pins are wired to gpio
+// 17, 27 and 22 on bus 0, and 5, 6 and 13 on bus 1. Used unless
+// devices are attached before the first sim_mmap.
+void                sim_board_default   (  void  );
+
+/////////////////////////////////////////////////////////////
+// Sim Device Models ////////////////////////////////////////
+// Creates an MPU3300 gyro at addr
+sim_dev             *sim_mpu3300        (  uint8_t addr  );
+// Creates an ITG3050 gyro at addr
+sim_dev             *sim_itg3050        (  uint8_t addr  );
+// Creates a PCA9548A mux at addr, with all channels disabled
+sim_dev             *sim_pca9548a       (  uint8_t addr  );
+// Wires the INT pin of a gyro model to the gpio line
+void                sim_gyro_int        (  sim_dev *gyro,
+                                           int pin  );
+// Opens the gpio line as an eventfd, written with an edge for each
+// sample the gyro wired to it takes while data ready interrupts are
+// enabled. Returns -1 if no gyro is wired to the line.
+int                 sim_gyro_int_fd     (  int pin  );
+
+#endif
@@ -0,0 +1,284 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: sim_bsc.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include "sim_private.h"
+#include "i2c/i2c_res.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// SIMULATED BSC
+///////////////////////////////////////////////////////////////////////////////
+/*
+   The wire is advanced lazily. On every access the model plays out
+   each byte that would have completed by now, at 9 clocks a byte
+   from the divider and the 150Mhz core clock, so transfers take as
+   long as they would on the Pi.
+
+   Bytes to send move from the fifo to the shift register as they go
+   onto the wire, the first as soon as the transfer starts. Should
+   the fifo run dry mid write, or fill mid read, the byte on the wire
+   waits (as the controller holds SCL) and only completes a byte time
+   after the driver catches up.
+
+   Writing ST|READ while a write is in flight queues the read behind
+   it with a repeated start, as the controller does.
+*/
+
+// Word offsets of the registers
+#define W_C         (0x00u >> 2)
+#define W_S         (0x04u >> 2)
+#define W_DLEN      (0x08u >> 2)
+#define W_A         (0x0cu >> 2)
+#define W_FIFO      (0x10u >> 2)
+#define W_DIV       (0x14u >> 2)
+// Set in the reserved bits of a FIFO word placed for reading, so
+// that a write of any byte can be told apart
+#define FIFO_SENTINEL     0x5a5a0000u
+// Each byte is 8 data clocks plus an ack
+#define CLKS_PER_BYTE     9ull
+// The BSC dividers are fed from the 150Mhz core clock
+#define CORE_CLK_HZ       150000000ull
+
+// Wire time of one byte at the programmed divider
+static uint64_t byte_ns(sim_bsc *b)
+{
+  // A divider of 0 is treated by the hardware as 32768
+  uint64_t cdiv = b->regs[W_DIV] & 0xfffeu;
+  return CLKS_PER_BYTE * (cdiv ? cdiv : 32768) * 1000000000ull / CORE_CLK_HZ;
+}
+
+// Move the next byte to send from the fifo to the shift register
+static void load_shift(sim_bsc *b)
+{
+  if (!b->read && b->remaining && !b->shifting && b->count)
+  {
+    b->shift = b->fifo[b->head];
+    b->head = (b->head + 1) % SIM_FIFO_BYTES;
+    b->count--;
+    b->shifting = 1;
+  }
+}
+
+// Queue the next data byte to complete a byte time after t, unless
+// there is nothing to send or no room to receive
+static void schedule(sim_bsc *b, uint64_t t)
+{
+  load_shift(b);
+  int stalled = b->read ? (b->count == SIM_FIFO_BYTES) : !b->shifting;
+  b->t_next = stalled ? 0 : t + byte_ns(b);
+}
+
+// End the transfer, raising DONE
+static void finish(sim_bsc *b)
+{
+  b->active = 0;
+  b->pending_read = 0;
+  b->shifting = 0;
+  b->t_next = 0;
+  b->dev = NULL;
+  b->s |= BSC_S_DONE;
+}
+
+// Start a transfer of DLEN bytes at time t, the address byte first
+static void start(sim_bsc *b, int read, uint64_t t)
+{
+  b->active = 1;
+  b->read = read;
+  b->addressed = 0;
+  b->remaining = b->dlen;
+  b->t_next = t + byte_ns(b);
+  // The first byte to send is taken as the transfer starts
+  load_shift(b);
+}
+
+// Complete the byte on the wire
+static void step(sim_bsc *b)
+{
+  uint64_t t = b->t_next;
+  // The address byte, the device must acknowledge
+  if (!b->addressed)
+  {
+    b->dev = sim_route(b->devs, b->regs[W_A] & 0x7f);
+    if (!b->dev || (b->dev->start && !b->dev->start(b->dev, b->read)))
+    {
+      b->s |= BSC_S_ERR;
+      finish(b);
+      return;
+    }
+    b->addressed = 1;
+  }
+  // A data byte
+  else if (b->read)
+  {
+    uint8_t byte = b->dev->read ? b->dev->read(b->dev) : 0xff;
+    b->fifo[(b->head + b->count++) % SIM_FIFO_BYTES] = byte;
+    b->remaining--;
+  }
+  else
+  {
+    b->shifting = 0;
+    if (b->dev->write)
+    {
+      b->dev->write(b->dev, b->shift);
+    }
+    b->remaining--;
+  }
+  // Move on to the next byte, or the read queued behind this write
+  if (b->remaining)
+  {
+    schedule(b, t);
+  }
+  else if (b->pending_read)
+  {
+    b->pending_read = 0;
+    start(b, 1, t);
+  }
+  else
+  {
+    finish(b);
+  }
+}
+
+// Play out every byte that has completed by now
+static void advance(sim_bsc *b, uint64_t now)
+{
+  while (b->active && b->t_next && (b->t_next <= now))
+  {
+    step(b);
+  }
+}
+
+// Apply a write of v to BSC_C
+static void write_control(sim_bsc *b, unsigned v, uint64_t now)
+{
+  // Clearing the fifo wins over any byte in it
+  if (v & (3u << 4))
+  {
+    b->head = b->count = 0;
+  }
+  // ST and CLEAR read back as zero
+  b->c = v & ~(BSC_C_ST | (3u << 4));
+  // Disabling the controller abandons any transfer
+  if (!(v & BSC_C_I2CEN))
+  {
+    b->active = b->pending_read = b->shifting = 0;
+    b->t_next = 0;
+    b->dev = NULL;
+  }
+  if (!(v & BSC_C_ST))
+  {
+    return;
+  }
+  if (!b->active)
+  {
+    start(b, v & BSC_C_READ, now);
+  }
+  // A read started under a write follows it with a repeated start
+  else if (!b->read && (v & BSC_C_READ))
+  {
+    b->pending_read = 1;
+  }
+}
+
+// Work out what the driver did with the word last handed out, and
+// apply it as of the time it was handed out
+static void settle(sim_bsc *b, uint64_t now)
+{
+  if (b->last < 0)
+  {
+    return;
+  }
+  unsigned v = b->regs[b->last];
+  // The FIFO was read if the sentinel survived, else written
+  if (b->last == W_FIFO)
+  {
+    if ((v & 0xffff0000u) != FIFO_SENTINEL)
+    {
+      if (b->count < SIM_FIFO_BYTES)
+      {
+        b->fifo[(b->head + b->count++) % SIM_FIFO_BYTES] = v & 0xff;
+      }
+    }
+    else if (b->count)
+    {
+      b->head = (b->head + 1) % SIM_FIFO_BYTES;
+      b->count--;
+    }
+    // Release a byte held waiting on the fifo
+    if (b->active && b->addressed && !b->t_next)
+    {
+      schedule(b, now);
+    }
+    else if (b->active)
+    {
+      load_shift(b);
+    }
+  }
+  // Every other register was only written if it changed
+  else if (v != b->placed)
+  {
+    switch (b->last)
+    {
+      case W_C:
+        write_control(b, v, now);
+        break;
+      case W_S:
+        // CLKT, ERR and DONE are cleared by writing 1
+        b->s &= ~(v & (BSC_S_CLKT|BSC_S_ERR|BSC_S_DONE));
+        break;
+      case W_DLEN:
+        b->dlen = v & 0xffff;
+        break;
+    }
+  }
+}
+
+// Fill the word with what the driver should read from it
+static void place(sim_bsc *b, unsigned word)
+{
+  int full = b->count == SIM_FIFO_BYTES,
+      writing = b->active && !b->read,
+      reading = b->active && b->read;
+  switch (word)
+  {
+    case W_C:
+      b->regs[word] = b->c;
+      break;
+    case W_S:
+      b->regs[word] = b->s
+        | (b->active ? BSC_S_TA : 0)
+        | (full ? BSC_S_RXF : BSC_S_TXD)
+        | (b->count ? BSC_S_RXD : BSC_S_TXE)
+        | ((reading && (b->count >= 3 * SIM_FIFO_BYTES / 4)) ? BSC_S_RXR : 0)
+        | ((writing && (b->count < SIM_FIFO_BYTES / 4)) ? BSC_S_TXW : 0);
+      break;
+    case W_DLEN:
+      // Counts down while the transfer is active
+      b->regs[word] = b->active ? b->remaining : b->dlen;
+      break;
+    case W_FIFO:
+      b->regs[word] = FIFO_SENTINEL | (b->count ? b->fifo[b->head] : 0);
+      break;
+  }
+  b->last = word;
+  b->placed = b->regs[word];
+}
+
+// Apply the last access, bring the wire up to date and return the
+// word for this access
+volatile unsigned *sim_bsc_access(sim_bsc *b,                // sim_bsc_access
+                                  unsigned word)
+{
+  uint64_t now = sim_now_ns();
+  pthread_mutex_lock(&b->lock);
+  // The last access happened once the wire had reached t_last
+  settle(b, b->t_last);
+  advance(b, now);
+  place(b, word & 7);
+  b->t_last = now;
+  pthread_mutex_unlock(&b->lock);
+  return &b->regs[word & 7];
+}
@@ -0,0 +1,114 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: sim_gpio.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include "sim_private.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// SIMULATED GPIO
+///////////////////////////////////////////////////////////////////////////////
+/*
+   GPFSEL words are plain storage. Writing GPSET/GPCLR latches output
+   levels, and they always read back as zero, so a write shows. GPLEV
+   reads the latched level of output pins and the driven level of
+   everything else.
+*/
+
+// Word offsets of the registers
+#define W_GPFSEL0   (0x00u >> 2)
+#define W_GPSET0    (0x1cu >> 2)
+#define W_GPSET1    (0x20u >> 2)
+#define W_GPCLR0    (0x28u >> 2)
+#define W_GPCLR1    (0x2cu >> 2)
+#define W_GPLEV0    (0x34u >> 2)
+#define W_GPLEV1    (0x38u >> 2)
+
+// The output pins of bank n (0 for pins 0-31, 1 for 32-53)
+static uint32_t output_mask(sim_gpio *g, int bank)
+{
+  uint32_t mask = 0;
+  for (int pin = 32 * bank; (pin < 32 * (bank + 1)) && (pin < 54); pin++)
+  {
+    // Function select 001 is output
+    if (((g->regs[W_GPFSEL0 + pin / 10] >> (3 * (pin % 10))) & 7) == 1)
+    {
+      mask |= 1u << (pin % 32);
+    }
+  }
+  return mask;
+}
+
+// Apply a write to the word last handed out
+static void settle(sim_gpio *g)
+{
+  if (g->last < 0)
+  {
+    return;
+  }
+  unsigned v = g->regs[g->last];
+  switch (g->last)
+  {
+    case W_GPSET0: case W_GPSET1:
+      g->out[g->last - W_GPSET0] |= v;
+      break;
+    case W_GPCLR0: case W_GPCLR1:
+      g->out[g->last - W_GPCLR0] &= ~v;
+      break;
+  }
+}
+
+// Fill the word with what the driver should read from it
+static void place(sim_gpio *g, unsigned word)
+{
+  switch (word)
+  {
+    case W_GPSET0: case W_GPSET1:
+    case W_GPCLR0: case W_GPCLR1:
+      g->regs[word] = 0;
+      break;
+    case W_GPLEV0: case W_GPLEV1:
+    {
+      int bank = word - W_GPLEV0;
+      uint32_t outputs = output_mask(g, bank);
+      g->regs[word] = (g->out[bank] & outputs) | (g->in[bank] & ~outputs);
+      break;
+    }
+  }
+  g->last = word;
+  g->placed = g->regs[word];
+}
+
+// Apply the last access and return the word for this one
+volatile unsigned *sim_gpio_access(sim_gpio *g,             // sim_gpio_access
+                                   unsigned word)
+{
+  if (word >= SIM_GPIO_WORDS)
+  {
+    ERR("No simulated gpio register at word %u.\n\n", word);
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_lock(&g->lock);
+  settle(g);
+  place(g, word);
+  pthread_mutex_unlock(&g->lock);
+  return &g->regs[word];
+}
+
+// Set the level driven onto an input pin
+void sim_gpio_input(sim_gpio *g, int pin, int level)         // sim_gpio_input
+{
+  pthread_mutex_lock(&g->lock);
+  if (level)
+  {
+    g->in[pin / 32] |= 1u << (pin % 32);
+  }
+  else
+  {
+    g->in[pin / 32] &= ~(1u << (pin % 32));
+  }
+  pthread_mutex_unlock(&g->lock);
+}
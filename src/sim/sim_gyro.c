@@ -0,0 +1,468 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: sim_gyro.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include "sim_private.h"
+#include "dev/mpu3300/mpu_registers.h"
+#include "dev/itg3050/itg_registers.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// SIMULATED INVENSENSE GYROS
+///////////////////////////////////////////////////////////////////////////////
+/*
+   The MPU3300 and ITG3050 share a design, differing only in where
+   their registers sit, so one model serves both from a layout.
+
+   The first byte written after a start sets the register pointer,
+   which then increments with each byte - except at the fifo
+   register, where reads pop the fifo.
+
+   While awake, samples are taken at the internal rate (8khz with the
+   DLPF off, else 1khz) over 1 + SMPLRT_DIV. Each sample updates the
+   data registers and, with the fifo enabled, pushes the selected
+   outputs as big-endian words. A full fifo drops its oldest bytes
+   and raises the overflow bit in INT_STATUS. Samples are worked out
+   lazily from the clock, whenever the device is addressed.
+
+   Sample n reads as temp 0x0100 + n, x n, y -2n, z 3n, so that a
+   reader can check frames arrive whole and in order.
+
+   A gyro may have its INT pin wired to a gpio, and the line opened
+   as an eventfd. A thread of the gyro's own then writes an edge to
+   it for every sample taken while data ready interrupts are enabled,
+   so the line keeps time with the clock rather than with the reads.
+*/
+
+// Where the registers and bits of a model sit
+typedef struct gyro_layout gyro_layout;
+struct gyro_layout {
+  // Identity register and its reset value
+  uint8_t who_am_i, id;
+  // Sample rate divider and DLPF config (DLPF_CFG in bits 2:0)
+  uint8_t smplrt_div, dlpf;
+  // Fifo selection, interrupt status, user control and power
+  uint8_t fifo_en, int_status, user_ctrl, power;
+  // First of the temp, x, y, z big-endian data registers
+  uint8_t temp_h;
+  // Fifo count (high byte first) and fifo data
+  uint8_t count_h, fifo_r;
+  // Bits of the fifo count high byte that are implemented
+  uint8_t count_h_mask;
+  int fifo_size;
+  // User control, fifo enable and reset, and self clearing bits
+  uint8_t uc_fifo_en, uc_fifo_reset, uc_self_clearing;
+  // Power, reset and sleep bits and the value at reset
+  uint8_t pwr_reset, pwr_sleep, pwr_default;
+  // Interrupt status, overflow and data ready bits
+  uint8_t int_oflow, int_drdy;
+  // Interrupt enable register, and its data ready bit
+  uint8_t int_enable, int_drdy_en;
+};
+
+static const gyro_layout mpu_layout = {
+  .who_am_i = MPU_WHO_AM_I, .id = 0x68,
+  .smplrt_div = MPU_SMPLRT_DIV, .dlpf = MPU_CONFIG,
+  .fifo_en = MPU_FIFO_EN, .int_status = MPU_INT_STATUS,
+  .user_ctrl = MPU_USER_CTRL, .power = MPU_POWER_MGMT_1,
+  .temp_h = MPU_TEMP_H,
+  .count_h = MPU_FIFO_COUNTH, .fifo_r = MPU_FIFO_R_W,
+  .count_h_mask = 0x07, .fifo_size = MPU_FIFO_SIZE,
+  .uc_fifo_en = 0x40, .uc_fifo_reset = 0x04, .uc_self_clearing = 0x07,
+  .pwr_reset = 0x80, .pwr_sleep = 0x40, .pwr_default = 0x40,
+  .int_oflow = 0x10, .int_drdy = 0x01,
+  .int_enable = MPU_INT_ENABLE, .int_drdy_en = 0x01
+};
+
+static const gyro_layout itg_layout = {
+  .who_am_i = ITG_WHO_AM_I, .id = 0x68,
+  .smplrt_div = ITG_SMPLRT_DIV, .dlpf = ITG_SYNC_SET,
+  .fifo_en = ITG_FIFO_EN, .int_status = ITG_INT_STATUS,
+  .user_ctrl = ITG_USER_CTRL, .power = ITG_POWER_MGMT,
+  .temp_h = ITG_TEMP_H,
+  .count_h = ITG_FIFO_COUNTH, .fifo_r = ITG_FIFO_R,
+  .count_h_mask = 0x03, .fifo_size = ITG_FIFO_SIZE,
+  .uc_fifo_en = 0x40, .uc_fifo_reset = 0x02, .uc_self_clearing = 0x0b,
+  .pwr_reset = 0x80, .pwr_sleep = 0x40, .pwr_default = 0x00,
+  .int_oflow = 0x80, .int_drdy = 0x01,
+  .int_enable = ITG_INT_CFG, .int_drdy_en = 0x01
+};
+
+// Fifo selection bits for temp, x, y and z, common to both
+static const uint8_t fifo_bits[4] = { 0x80, 0x40, 0x20, 0x10 };
+
+// Largest fifo of any model
+#define GYRO_FIFO_MAX 1024
+// Gpio lines an INT pin may be wired to
+#define GYRO_INT_PINS 54
+// Longest the INT thread sleeps, so changes of rate are seen
+#define GYRO_INT_IDLE_NS 1000000ull
+
+// State of a gyro
+typedef struct gyro_model gyro_model;
+struct gyro_model {
+  const gyro_layout *layout;
+  // The register file, and the register pointer
+  uint8_t regs[256];
+  uint8_t ptr;
+  // Set after a start, until the register pointer is written
+  int expect_ptr;
+  // The fifo
+  uint8_t fifo[GYRO_FIFO_MAX];
+  int head, count;
+  // Samples taken, and the sample count and time that the current
+  // rate is measured from
+  uint64_t taken, base_n, base_ns;
+  // Guards the model against the bus and the INT thread at once
+  pthread_mutex_t lock;
+  // Eventfd the INT pin raises edges on (-1 until opened), and the
+  // sample the last edge was raised for
+  int int_fd;
+  uint64_t raised;
+};
+
+// The gyro wired to each gpio line, if any
+static gyro_model *wired[GYRO_INT_PINS];
+static pthread_mutex_t wiring = PTHREAD_MUTEX_INITIALIZER;
+
+// Samples per second at the current settings
+static uint64_t sample_hz(gyro_model *g)
+{
+  const gyro_layout *l = g->layout;
+  int dlpf = g->regs[l->dlpf] & 7,
+      internal = ((dlpf == 0) || (dlpf == 7)) ? 8000 : 1000;
+  return internal / (1 + g->regs[l->smplrt_div]);
+}
+
+// Push a byte, dropping the oldest should the fifo be full
+static void fifo_push(gyro_model *g, uint8_t byte)
+{
+  const gyro_layout *l = g->layout;
+  if (g->count == l->fifo_size)
+  {
+    g->head = (g->head + 1) % l->fifo_size;
+    g->count--;
+    g->regs[l->int_status] |= l->int_oflow;
+  }
+  g->fifo[(g->head + g->count++) % l->fifo_size] = byte;
+}
+
+// Take sample n
+static void take_sample(gyro_model *g, uint64_t n)
+{
+  const gyro_layout *l = g->layout;
+  int16_t values[4] = { (int16_t)(0x0100 + n), (int16_t)n,
+                        (int16_t)(-2 * (int64_t)n), (int16_t)(3 * n) };
+  int fifo_on = g->regs[l->user_ctrl] & l->uc_fifo_en;
+  for (int i = 0; i < 4; i++)
+  {
+    uint8_t hi = (uint16_t)values[i] >> 8, lo = values[i] & 0xff;
+    g->regs[l->temp_h + 2 * i] = hi;
+    g->regs[l->temp_h + 2 * i + 1] = lo;
+    if (fifo_on && (g->regs[l->fifo_en] & fifo_bits[i]))
+    {
+      fifo_push(g, hi);
+      fifo_push(g, lo);
+    }
+  }
+  g->regs[l->int_status] |= l->int_drdy;
+}
+
+// Measure the rate afresh from now, after a change of settings
+static void rebase(gyro_model *g, uint64_t now)
+{
+  g->base_n = g->taken;
+  g->base_ns = now;
+}
+
+// The count of samples due by now at the current rate
+static uint64_t due_by(gyro_model *g, uint64_t now)
+{
+  return g->base_n + (now - g->base_ns) * sample_hz(g) / 1000000000ull;
+}
+
+// Take every sample due by now
+static void advance(gyro_model *g)
+{
+  const gyro_layout *l = g->layout;
+  uint64_t now = sim_now_ns();
+  // Asleep, nothing is sampled
+  if (g->regs[l->power] & l->pwr_sleep)
+  {
+    rebase(g, now);
+    return;
+  }
+  uint64_t due = due_by(g, now);
+  // Skip samples that would be overwritten before being read, the
+  // fifo still overflows on those that remain
+  if (due - g->taken > (uint64_t)l->fifo_size)
+  {
+    g->taken = due - l->fifo_size;
+  }
+  while (g->taken < due)
+  {
+    take_sample(g, g->taken++);
+  }
+}
+
+// Return every register to its reset value
+static void reset(gyro_model *g)
+{
+  const gyro_layout *l = g->layout;
+  memset(g->regs, 0, sizeof(g->regs));
+  g->regs[l->who_am_i] = l->id;
+  g->regs[l->power] = l->pwr_default;
+  g->head = g->count = 0;
+  rebase(g, sim_now_ns());
+}
+
+// Read the register at the pointer
+static uint8_t read_reg(gyro_model *g, uint8_t reg)
+{
+  const gyro_layout *l = g->layout;
+  uint8_t byte;
+  if (reg == l->fifo_r)
+  {
+    if (!g->count)
+    {
+      return 0;
+    }
+    byte = g->fifo[g->head];
+    g->head = (g->head + 1) % l->fifo_size;
+    g->count--;
+    return byte;
+  }
+  if (reg == l->count_h)
+  {
+    return (g->count >> 8) & l->count_h_mask;
+  }
+  if (reg == (uint8_t)(l->count_h + 1))
+  {
+    return g->count & 0xff;
+  }
+  byte = g->regs[reg];
+  // Interrupt status clears on read
+  if (reg == l->int_status)
+  {
+    g->regs[reg] = 0;
+  }
+  return byte;
+}
+
+// Write the register at the pointer
+static void write_reg(gyro_model *g, uint8_t reg, uint8_t byte)
+{
+  const gyro_layout *l = g->layout;
+  if ((reg == l->power) && (byte & l->pwr_reset))
+  {
+    reset(g);
+    return;
+  }
+  if ((reg == l->user_ctrl) && (byte & l->uc_fifo_reset))
+  {
+    g->head = g->count = 0;
+  }
+  // Status, counts, data and the fifo are read only here
+  if ((reg == l->int_status) || (reg == l->fifo_r) ||
+      (reg == l->count_h) || (reg == (uint8_t)(l->count_h + 1)) ||
+      ((reg >= l->temp_h) && (reg < l->temp_h + 8)))
+  {
+    return;
+  }
+  g->regs[reg] = byte;
+  if (reg == l->user_ctrl)
+  {
+    g->regs[reg] &= ~l->uc_self_clearing;
+  }
+  // Changes to the rate or power start the rate afresh
+  if ((reg == l->smplrt_div) || (reg == l->dlpf) || (reg == l->power))
+  {
+    rebase(g, sim_now_ns());
+  }
+}
+
+// Addressed, catch up on sampling
+static int gyro_start(sim_dev *dev, int read)
+{
+  gyro_model *g = dev->model;
+  pthread_mutex_lock(&g->lock);
+  advance(g);
+  g->expect_ptr = !read;
+  pthread_mutex_unlock(&g->lock);
+  return 1;
+}
+
+// A byte written, the pointer first
+static void gyro_write(sim_dev *dev, uint8_t byte)
+{
+  gyro_model *g = dev->model;
+  pthread_mutex_lock(&g->lock);
+  if (g->expect_ptr)
+  {
+    g->ptr = byte;
+    g->expect_ptr = 0;
+  }
+  else
+  {
+    write_reg(g, g->ptr, byte);
+    if (g->ptr != g->layout->fifo_r)
+    {
+      g->ptr++;
+    }
+  }
+  pthread_mutex_unlock(&g->lock);
+}
+
+// A byte read from the pointer
+static uint8_t gyro_read(sim_dev *dev)
+{
+  gyro_model *g = dev->model;
+  pthread_mutex_lock(&g->lock);
+  uint8_t byte = read_reg(g, g->ptr);
+  if (g->ptr != g->layout->fifo_r)
+  {
+    g->ptr++;
+  }
+  pthread_mutex_unlock(&g->lock);
+  return byte;
+}
+
+// Thread raising an edge on the INT eventfd for each sample taken
+// with data ready interrupts enabled, for as long as the process runs
+static void *int_run(void *arg)
+{
+  gyro_model *g = arg;
+  const gyro_layout *l = g->layout;
+  for (;;)
+  {
+    uint64_t edges = 0, wait_ns = GYRO_INT_IDLE_NS;
+    pthread_mutex_lock(&g->lock);
+    uint64_t now = sim_now_ns();
+    // Asleep, nothing is sampled and the rate is measured from waking
+    if (!(g->regs[l->power] & l->pwr_sleep))
+    {
+      uint64_t hz = sample_hz(g), due = due_by(g, now),
+               next = g->base_ns
+                    + (due + 1 - g->base_n) * 1000000000ull / hz;
+      // Edges are only raised for samples taken while enabled, and
+      // none for those again should the rate be measured afresh
+      if ((g->regs[l->int_enable] & l->int_drdy_en) && (due > g->raised))
+      {
+        edges = due - g->raised;
+      }
+      g->raised = due;
+      wait_ns = (next - now < wait_ns) ? next - now : wait_ns;
+    }
+    pthread_mutex_unlock(&g->lock);
+    if (edges && (write(g->int_fd, &edges, sizeof(edges)) < 0))
+    {
+      ERR("Failed to raise the INT edge of a gyro.\n\n");
+    }
+    struct timespec wait = { 0, (long)wait_ns };
+    nanosleep(&wait, NULL);
+  }
+  return NULL;
+}
+
+// Create a gyro at addr with the given layout, fresh from reset
+static sim_dev *gyro_malloc(uint8_t addr, const gyro_layout *layout)
+{
+  sim_dev *dev = sim_dev_malloc(addr);
+  gyro_model *g = calloc(1, sizeof(gyro_model));
+  if (!g)
+  {
+    ERR("Failed to allocate memory (malloc) for gyro_model.\n\n");
+    exit(EXIT_FAILURE);
+  }
+  g->layout = layout;
+  g->int_fd = -1;
+  pthread_mutex_init(&g->lock, NULL);
+  reset(g);
+  dev->model = g;
+  dev->start = &gyro_start;
+  dev->write = &gyro_write;
+  dev->read = &gyro_read;
+  return dev;
+}
+
+// Create an MPU3300 at addr
+sim_dev *sim_mpu3300(uint8_t addr)                              // sim_mpu3300
+{
+  return gyro_malloc(addr, &mpu_layout);
+}
+
+// Create an ITG3050 at addr
+sim_dev *sim_itg3050(uint8_t addr)                              // sim_itg3050
+{
+  return gyro_malloc(addr, &itg_layout);
+}
+
+// Wire the INT pin of the gyro to the gpio line
+void sim_gyro_int(sim_dev *gyro, int pin)                      // sim_gyro_int
+{
+  if ((pin < 0) || (pin >= GYRO_INT_PINS))
+  {
+    ERR("No gpio %d to wire the INT pin of 0x%02x to.\n\n",
+        pin, gyro->addr);
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_lock(&wiring);
+  wired[pin] = gyro->model;
+  pthread_mutex_unlock(&wiring);
+}
+
+// Open the gpio line as an eventfd that counts the data ready edges
+// of the gyro wired to it, or -1 if no gyro is. Edges raised before
+// the open are not counted.
+int sim_gyro_int_fd(int pin)                                // sim_gyro_int_fd
+{
+  // Populate the default board, should nothing have been attached
+  sim_bus(0);
+  pthread_mutex_lock(&wiring);
+  gyro_model *g = ((pin >= 0) && (pin < GYRO_INT_PINS)) ? wired[pin] : NULL;
+  int fd = -1;
+  if (g && (g->int_fd < 0))
+  {
+    pthread_t thread;
+    // Raise edges for the samples to come, not those already taken
+    pthread_mutex_lock(&g->lock);
+    g->raised = due_by(g, sim_now_ns());
+    pthread_mutex_unlock(&g->lock);
+    if ((g->int_fd = eventfd(0, 0)) < 0)
+    {
+      ERR("Failed to create the eventfd of gpio %d.\n\n", pin);
+    }
+    else if (pthread_create(&thread, NULL, &int_run, g))
+    {
+      ERR("Failed to start the INT thread of gpio %d.\n\n", pin);
+      close(g->int_fd);
+      g->int_fd = -1;
+    }
+    else
+    {
+      pthread_detach(thread);
+    }
+  }
+  if (g && (g->int_fd >= 0))
+  {
+    // Clear edges raised for a previous opener, then share the count
+    struct pollfd p = { .fd = g->int_fd, .events = POLLIN };
+    uint64_t stale;
+    if ((poll(&p, 1, 0) > 0) &&
+        (read(g->int_fd, &stale, sizeof(stale)) < 0))
+    {
+      ERR("Failed to clear the eventfd of gpio %d.\n\n", pin);
+    }
+    fd = dup(g->int_fd);
+  }
+  pthread_mutex_unlock(&wiring);
+  return fd;
+}
@@ -0,0 +1,137 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: sim_i2cdev.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "sim_private.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// SIMULATED KERNEL DRIVER
+///////////////////////////////////////////////////////////////////////////////
+/*
+   Stands in for /dev/i2c-N and the kernel driver behind it, running
+   message sets straight against the device models of the bus. The
+   caller is held for as long as the set would take on the wire at
+   the kernel's default 100khz, so that timing matches the BSC model.
+
+   A device that does not acknowledge fails the whole set with
+   EREMOTEIO, as the bcm2835 driver does, leaving earlier messages
+   already carried out.
+*/
+
+// Descriptors handed out, one above the other for each bus
+#define SIM_I2CDEV_FD     0x5100
+// Bus clock the kernel runs at by default
+#define SIM_I2CDEV_HZ     100000ull
+
+// Whether a read is only taken as the last message of a set
+static int read_last;
+
+// Sets whether a read anywhere but last refuses the set
+void sim_i2cdev_read_last(int enforce)                 // sim_i2cdev_read_last
+{
+  read_last = enforce;
+}
+
+// Open /dev/i2c-N for bus N, 0 or 1
+int sim_i2cdev_open(const char *path)                       // sim_i2cdev_open
+{
+  int bus;
+  if ((sscanf(path, "/dev/i2c-%d", &bus) != 1) ||
+      (bus < 0) || (bus >= SIM_BUSES))
+  {
+    errno = ENOENT;
+    return -1;
+  }
+  return SIM_I2CDEV_FD + bus;
+}
+
+// Run the set on the bus, returning the messages run or -1
+static int rdwr(sim_bsc *b, struct i2c_rdwr_ioctl_data *set)
+{
+  // Refuse sets the driver would not take
+  if (!set->nmsgs || (set->nmsgs > I2C_RDWR_IOCTL_MAX_MSGS))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  for (unsigned i = 0; read_last && (i + 1 < set->nmsgs); i++)
+  {
+    if (set->msgs[i].flags & I2C_M_RD)
+    {
+      errno = EOPNOTSUPP;
+      return -1;
+    }
+  }
+  uint64_t start = sim_now_ns(), bits = 0;
+  int nacked = 0;
+  pthread_mutex_lock(&b->lock);
+  for (unsigned i = 0; (i < set->nmsgs) && !nacked; i++)
+  {
+    struct i2c_msg *msg = &set->msgs[i];
+    int read = msg->flags & I2C_M_RD;
+    // The start (or repeated start) and address byte
+    bits += 10;
+    sim_dev *dev = sim_route(b->devs, msg->addr & 0x7f);
+    if (!dev || (dev->start && !dev->start(dev, read)))
+    {
+      nacked = 1;
+      break;
+    }
+    // Then each byte and its acknowledgement
+    for (int j = 0; j < msg->len; j++)
+    {
+      if (read)
+      {
+        msg->buf[j] = dev->read ? dev->read(dev) : 0xff;
+      }
+      else if (dev->write)
+      {
+        dev->write(dev, msg->buf[j]);
+      }
+    }
+    bits += 9 * msg->len;
+  }
+  pthread_mutex_unlock(&b->lock);
+  // Hold the caller until the set (and its STOP) would be done
+  uint64_t end = start + (bits + 1) * 1000000000ull / SIM_I2CDEV_HZ;
+  struct timespec until = { end / 1000000000ull, end % 1000000000ull };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL));
+  if (nacked)
+  {
+    errno = EREMOTEIO;
+    return -1;
+  }
+  return set->nmsgs;
+}
+
+// Carry out the request on the bus behind fd
+int sim_i2cdev_ioctl(int fd,                               // sim_i2cdev_ioctl
+                     unsigned long request,
+                     void *arg)
+{
+  int bus = fd - SIM_I2CDEV_FD;
+  if ((bus < 0) || (bus >= SIM_BUSES))
+  {
+    errno = EBADF;
+    return -1;
+  }
+  switch (request)
+  {
+    // Plain message sets are all that is offered
+    case I2C_FUNCS:
+      *(unsigned long *)arg = I2C_FUNC_I2C;
+      return 0;
+    case I2C_RDWR:
+      return rdwr(sim_bus(bus), arg);
+  }
+  errno = ENOTTY;
+  return -1;
+}
@@ -0,0 +1,197 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: sim_mmap.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <time.h>
+#include "sim_private.h"
+#include "i2c/i2c_res.h"
+#include "gpio/gpio_res.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// SIMULATED PERIPHERALS
+///////////////////////////////////////////////////////////////////////////////
+/*
+   The driver reads and writes the peripherals as plain memory, which
+   gives a model no chance to react - a FIFO read must pop a byte, a
+   write of 1 to a status bit must clear it. So in a TARGET=SIM build
+   the register macros call sim_reg for every access, and are handed
+   the word to use.
+
+   sim_reg cannot see whether the driver then reads or writes the word,
+   so it settles that on the next call to the same block. If the word
+   no longer holds what was placed there, it was written. Registers
+   that read back differently to how they are written (the FIFO, ST
+   and CLEAR in BSC_C, GPSET/GPCLR) are placed so a write always
+   shows. Each block should only be driven from one thread, as the
+   i2c module does with its bus threads.
+*/
+
+// The BSC controllers and GPIO block
+static sim_bsc bsc[SIM_BUSES];
+static sim_gpio gpio_block;
+// Set once the blocks are ready for use
+static pthread_once_t ready = PTHREAD_ONCE_INIT;
+// Set once any device has been attached
+static int attached;
+
+// Monotonic clock in nanoseconds
+uint64_t sim_now_ns(void)                                        // sim_now_ns
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Prepare the blocks, as they would be at power on
+static void init_blocks(void)
+{
+  for (int i = 0; i < SIM_BUSES; i++)
+  {
+    pthread_mutex_init(&bsc[i].lock, NULL);
+    bsc[i].last = -1;
+  }
+  pthread_mutex_init(&gpio_block.lock, NULL);
+  gpio_block.last = -1;
+}
+
+// Return the simulated block at the given physical base, populating
+// the default board if no devices have been attached
+volatile unsigned *sim_mmap(int base)                              // sim_mmap
+{
+  pthread_once(&ready, &init_blocks);
+  if (!attached)
+  {
+    sim_board_default();
+  }
+  if (base == BSC0_BASE)
+  {
+    return bsc[0].regs;
+  }
+  if (base == BSC1_BASE)
+  {
+    return bsc[1].regs;
+  }
+  if (base == GPIO_BASE)
+  {
+    return gpio_block.regs;
+  }
+  ERR("No simulated peripheral at base 0x%08x.\n\n", base);
+  exit(EXIT_FAILURE);
+}
+
+// Return the controller of the bus (0 or 1), populating the default
+// board if no devices have been attached
+sim_bsc *sim_bus(int bus)                                           // sim_bus
+{
+  sim_mmap(bus ? BSC1_BASE : BSC0_BASE);
+  return &bsc[bus ? 1 : 0];
+}
+
+// Hand the access to the model that owns the block. Blocks that are
+// not simulated (the bench's register block) are plain memory.
+volatile unsigned *sim_reg(volatile unsigned *block,                // sim_reg
+                           unsigned word)
+{
+  for (int i = 0; i < SIM_BUSES; i++)
+  {
+    if (block == bsc[i].regs)
+    {
+      return sim_bsc_access(&bsc[i], word);
+    }
+  }
+  if (block == gpio_block.regs)
+  {
+    return sim_gpio_access(&gpio_block, word);
+  }
+  return block + word;
+}
+
+// Drive the level of an input pin, pins 0-53
+void sim_gpio_drive(int pin, int level)                      // sim_gpio_drive
+{
+  pthread_once(&ready, &init_blocks);
+  if ((pin < 0) || (pin > 53))
+  {
+    ERR("No gpio pin %d to drive.\n\n", pin);
+    return;
+  }
+  sim_gpio_input(&gpio_block, pin, level);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// BOARD
+///////////////////////////////////////////////////////////////////////////////
+
+// mallocs a device at addr that does nothing but acknowledge
+sim_dev *sim_dev_malloc(uint8_t addr)                        // sim_dev_malloc
+{
+  sim_dev *dev = calloc(1, sizeof(sim_dev));
+  if (!dev)
+  {
+    ERR("Failed to allocate memory (malloc) for sim_dev.\n\n");
+    exit(EXIT_FAILURE);
+  }
+  dev->addr = addr;
+  return dev;
+}
+
+// Find the device answering to addr in the list, or behind any mux
+// in it. Returns NULL if nothing would acknowledge.
+sim_dev *sim_route(sim_dev *list, uint8_t addr)                   // sim_route
+{
+  sim_dev *found = NULL;
+  for (; list && !found; list = list->next)
+  {
+    if (list->addr == addr)
+    {
+      found = list;
+    }
+    else if (list->route)
+    {
+      found = list->route(list, addr);
+    }
+  }
+  return found;
+}
+
+// Attach the device to the end of the list on the bus
+void sim_attach(int bus, sim_dev *dev)                           // sim_attach
+{
+  pthread_once(&ready, &init_blocks);
+  sim_bsc *b = &bsc[bus ? 1 : 0];
+  pthread_mutex_lock(&b->lock);
+  sim_dev **tail = &b->devs;
+  while (*tail)
+  {
+    tail = &(*tail)->next;
+  }
+  dev->next = NULL;
+  *tail = dev;
+  attached = 1;
+  pthread_mutex_unlock(&b->lock);
+}
+
+// Populate both buses as a side of the IMU board
+void sim_board_default(void)                              // sim_board_default
+{
+  // The gpio lines the INT pins of each bus are wired to
+  static const int pins[SIM_BUSES][3] = { { 17, 27, 22 }, { 5, 6, 13 } };
+  for (int bus = 0; bus < SIM_BUSES; bus++)
+  {
+    sim_dev *pca = sim_pca9548a(0x74),
+            *gyros[3] = { sim_mpu3300(0x69), sim_itg3050(0x68),
+                          sim_itg3050(0x69) };
+    for (int i = 0; i < 3; i++)
+    {
+      sim_gyro_int(gyros[i], pins[bus][i]);
+    }
+    sim_mux_attach(pca, 0, gyros[0]);
+    sim_mux_attach(pca, 0, gyros[1]);
+    sim_mux_attach(pca, 1, gyros[2]);
+    sim_attach(bus, pca);
+  }
+}
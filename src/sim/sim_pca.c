@@ -0,0 +1,98 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: sim_pca.c
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include "sim_private.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// SIMULATED PCA9548A
+///////////////////////////////////////////////////////////////////////////////
+/*
+   The mux has a single control register, one bit for each of its
+   eight channels. Any byte written replaces it, any byte read returns
+   it. Devices on every enabled channel are reachable through it.
+*/
+
+// Channels on the chip
+#define PCA_CHANNELS 8
+
+// State of a mux
+typedef struct pca_model pca_model;
+struct pca_model {
+  // The control register
+  uint8_t control;
+  // Devices on each channel
+  sim_dev *channels[PCA_CHANNELS];
+};
+
+// The mux always acknowledges
+static int pca_start(sim_dev *dev, int read)
+{
+  return 1;
+}
+
+// Any byte written selects the channels
+static void pca_write(sim_dev *dev, uint8_t byte)
+{
+  ((pca_model *)dev->model)->control = byte;
+}
+
+// Any byte read is the control register
+static uint8_t pca_read(sim_dev *dev)
+{
+  return ((pca_model *)dev->model)->control;
+}
+
+// Find addr on any enabled channel
+static sim_dev *pca_route(sim_dev *dev, uint8_t addr)
+{
+  pca_model *m = dev->model;
+  sim_dev *found = NULL;
+  for (int c = 0; (c < PCA_CHANNELS) && !found; c++)
+  {
+    if (m->control & (1u << c))
+    {
+      found = sim_route(m->channels[c], addr);
+    }
+  }
+  return found;
+}
+
+// Create a mux at addr, with every channel disabled
+sim_dev *sim_pca9548a(uint8_t addr)                            // sim_pca9548a
+{
+  sim_dev *dev = sim_dev_malloc(addr);
+  if (!(dev->model = calloc(1, sizeof(pca_model))))
+  {
+    ERR("Failed to allocate memory (malloc) for pca_model.\n\n");
+    exit(EXIT_FAILURE);
+  }
+  dev->start = &pca_start;
+  dev->write = &pca_write;
+  dev->read = &pca_read;
+  dev->route = &pca_route;
+  return dev;
+}
+
+// Attach the device to the end of the given channel of the mux. The
+// mux must have been created by sim_pca9548a.
+void sim_mux_attach(sim_dev *mux, int channel, sim_dev *dev) // sim_mux_attach
+{
+  pca_model *m = mux->model;
+  if ((channel < 0) || (channel >= PCA_CHANNELS))
+  {
+    ERR("No channel %d on simulated mux 0x%02x.\n\n", channel, mux->addr);
+    return;
+  }
+  sim_dev **tail = &m->channels[channel];
+  while (*tail)
+  {
+    tail = &(*tail)->next;
+  }
+  dev->next = NULL;
+  *tail = dev;
+}
@@ -0,0 +1,92 @@
+///////////////////////////////////////////////////////////////////////////////
+// Raspberry Pi GPIO Interface
+// ¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯¯
+// File: sim_private.h
+// PA Consulting - Lawrence Jones
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef SIM_PRIVATE_HEADER_INC
+#define SIM_PRIVATE_HEADER_INC
+
+#include <pthread.h>
+#include "sim.h"
+#include "macros.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// SIMULATED PERIPHERALS
+///////////////////////////////////////////////////////////////////////////////
+
+// Simulated BSC controllers, one for each bus
+#define SIM_BUSES           2
+// Capacity of the BSC fifo
+#define SIM_FIFO_BYTES      16
+// Words of the GPIO block that are modelled (up to GPPUDCLK1)
+#define SIM_GPIO_WORDS      41
+
+// A BSC controller and the devices on its bus
+typedef struct sim_bsc sim_bsc;
+struct sim_bsc {
+  // The register words handed out to the driver
+  volatile unsigned regs[8];
+  // Guards the model against devices being attached mid-access
+  pthread_mutex_t lock;
+  // Word of the last access (-1 for none), what was placed there,
+  // and when
+  int last;
+  unsigned placed;
+  uint64_t t_last;
+  // Control, sticky status bits and data length as latched
+  unsigned c, s, dlen;
+  // The fifo, shared between transmit and receive
+  uint8_t fifo[SIM_FIFO_BYTES];
+  int head, count;
+  // Transfer in progress, a read queued behind it (repeated start),
+  // and whether the address byte has gone out
+  int active, read, pending_read, addressed;
+  // Bytes still to move
+  unsigned remaining;
+  // The byte being sent, if shifting
+  uint8_t shift;
+  int shifting;
+  // When the byte on the wire completes, 0 if waiting on the fifo
+  uint64_t t_next;
+  // The device addressed by the transfer
+  sim_dev *dev;
+  // Devices attached to the bus
+  sim_dev *devs;
+};
+
+// The GPIO block
+typedef struct sim_gpio sim_gpio;
+struct sim_gpio {
+  // The register words handed out to the driver
+  volatile unsigned regs[SIM_GPIO_WORDS];
+  // Guards the input levels, driven from model threads
+  pthread_mutex_t lock;
+  // Word of the last access (-1 for none), and what was placed there
+  int last;
+  unsigned placed;
+  // Latched outputs and externally driven inputs, pins 0-53
+  uint32_t out[2], in[2];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// PRIVATE FUNCTION STUBS
+///////////////////////////////////////////////////////////////////////////////
+
+// Monotonic clock in nanoseconds
+uint64_t sim_now_ns(void);
+// Applies the last access to the BSC and returns the word for this one
+volatile unsigned *sim_bsc_access(sim_bsc *b, unsigned word);
+// Applies the last access to the GPIO and returns the word for this one
+volatile unsigned *sim_gpio_access(sim_gpio *g, unsigned word);
+// Sets the level driven onto an input pin
+void sim_gpio_input(sim_gpio *g, int pin, int level);
+// Returns the BSC controller of the given bus, ready for use
+sim_bsc *sim_bus(int bus);
+// Finds the device answering to addr in the list, or behind a mux in it
+sim_dev *sim_route(sim_dev *list, uint8_t addr);
+// mallocs a device with no behaviour, at addr
+sim_dev *sim_dev_malloc(uint8_t addr);
+
+#endif